@@ -0,0 +1,59 @@
+// Author: Leonardo La Rocca
+// email: info@melopero.com
+// 
+// In this example it is shown how to recognize swipes in 8 directions,
+// approaches (near) and retreats (far), and how fast a swipe was.
+// 
+// First make sure that your connections are setup correctly:
+// I2C pinout:
+// APDS9960 <------> Arduino MKR
+//     VIN <------> VCC
+//     SCL <------> SCL (12)
+//     SDA <------> SDA (11)
+//     GND <------> GND
+// 
+// Note: Do not connect the device to the 5V pin!
+
+#include "Melopero_APDS9960.h"
+
+Melopero_APDS9960 device;
+GestureRecognizer recognizer; // default threshold, sensitivity and time between datasets
+
+const char* gestureNames[] = {"NONE", "UP", "DOWN", "LEFT", "RIGHT", "UP LEFT", "UP RIGHT", 
+                              "DOWN LEFT", "DOWN RIGHT", "NEAR", "FAR"};
+
+void setup() {
+  Serial.begin(9600); // Initialize serial comunication
+  while (!Serial); // wait for serial to be ready
+
+  Wire.begin();
+  device.initI2C(0x39, Wire); // Initialize the comunication library
+  device.reset(); // Reset all interrupt settings and power off the device
+
+  // Gesture engine settings
+  device.enableGesturesEngine(); // enable the gesture engine
+  device.setGestureProxEnterThreshold(25); // Enter the gesture engine when the proximity value is greater than 25
+  device.setGestureExitThreshold(20); // Exit the gesture engine when the proximity value is less than 20
+  device.setGestureExitPersistence(EXIT_AFTER_4_GESTURE_END);
+
+  device.wakeUp(); // wake up the device
+}
+
+void loop() {
+  // push the datasets collected since the last call into the recognizer
+  device.recognizeGestureInFifo(recognizer);
+
+  if (recognizer.complete){
+    GestureRecognizer::Result result = recognizer.result();
+    if (result.gesture != NO_GESTURE){
+      Serial.print("Gesture: ");
+      Serial.print(gestureNames[result.gesture]);
+      Serial.print(" speed: ");
+      Serial.print(result.speed);
+      Serial.println(" swipes/s");
+    }
+    recognizer.reset(); // ready for the next gesture
+  }
+
+  delay(20);
+}
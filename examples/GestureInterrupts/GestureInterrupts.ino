@@ -24,12 +24,18 @@
 
 Melopero_APDS9960 device;
 
-bool interruptOccurred = false;
+// The datasets drained from the sensor fifo are stored in this ring buffer until loop() consumes them.
+// The capacity (number of datasets) must be a power of two, each dataset takes 4 bytes.
+const uint8_t ringCapacity = 64;
+uint8_t ringStorage[ringCapacity * 4];
+GestureRingBuffer ring(ringStorage, ringCapacity);
+
 //This is the pin that will listen for the hardware interrupt.
 const byte interruptPin = 1;
 
 void interruptHandler(){
-  interruptOccurred = true;
+  // The I2C bus can't be used inside an interrupt handler: just tell the device the fifo needs service
+  device.notifyGestureInterrupt();
 }
 
 void setup() {
@@ -66,12 +72,11 @@ void setup() {
   device.enableGestureInterrupts();
   device.setGestureFifoThreshold(FIFO_INT_AFTER_16_DATASETS); // trigger an interrupt as soon as there are 16 datasets in the fifo
   // To clear the interrupt pin we have to read all datasets that are available in the fifo.
-  // Since it takes a little bit of time to read alla these datasets the device may collect 
-  // new ones in the meantime and prevent us from clearing the interrupt ( since the fifo 
-  // would not be empty ). To prevent this behaviour we tell the device to enter the sleep 
-  // state after an interrupt occurred. The device will exit the sleep state when the interrupt
-  // is cleared.
-  device.setSleepAfterInterrupt(true);
+  // serviceGestureInterrupt() drains the whole fifo with a single I2C transaction into the ring 
+  // buffer, so the interrupt is cleared quickly and the device can keep collecting data while 
+  // we process the datasets at our own pace. If we are too slow the ring buffer counts the datasets 
+  // it had to drop (ring.droppedDatasets) and the device counts the fifo overflows (device.gestureFifoOverflows).
+  device.attachGestureRingBuffer(&ring);
 
   //Next we want to setup our interruptPin to detect the interrupt and to call our
   //interruptHandler function each time an interrupt is triggered.
@@ -82,31 +87,31 @@ void setup() {
 }
 
 void loop() {
-  if (interruptOccurred){
-    // clear interrupt
-    interruptOccurred = false;
-    Serial.println("Interrupt occurred!");
-    // The interrupt is cleared by reading all available datasets in the fifo
-
-    // Retrieve number of datasets in fifo 
-    device.updateNumberOfDatasetsInFifo();
-    Serial.print("There are ");
-    Serial.print(device.datasetsInFifo);
-    Serial.println(" datasets in the fifo!");
-
-    // print them out : UP DOWN LEFT RIGHT
-    for (int i = 0; i < device.datasetsInFifo; i++){
-      device.updateGestureData();
-
-      Serial.print(i);
-      Serial.print(" : ");
-      Serial.print(device.gestureData[0]);
-      Serial.print(" ");
-      Serial.print(device.gestureData[1]);
-      Serial.print(" ");
-      Serial.print(device.gestureData[2]);
-      Serial.print(" ");
-      Serial.println(device.gestureData[3]);
-    }
+  // The pin is active low and stays low while the fifo is above the threshold: datasets that arrive
+  // while the fifo is being drained keep it low and no new falling edge comes, so a pin still low
+  // needs another service too.
+  if (digitalRead(interruptPin) == LOW)
+    device.notifyGestureInterrupt();
+
+  // Drain the sensor fifo if an interrupt occurred (does nothing otherwise)
+  device.serviceGestureInterrupt();
+
+  // Consume one dataset per loop : UP DOWN LEFT RIGHT
+  uint8_t dataset[4];
+  if (ring.pop(dataset)){
+    Serial.print(dataset[0]);
+    Serial.print(" ");
+    Serial.print(dataset[1]);
+    Serial.print(" ");
+    Serial.print(dataset[2]);
+    Serial.print(" ");
+    Serial.print(dataset[3]);
+    Serial.print("  (buffered: ");
+    Serial.print(ring.available());
+    Serial.print(" dropped: ");
+    Serial.print(ring.droppedDatasets);
+    Serial.print(" fifo overflows: ");
+    Serial.print(device.gestureFifoOverflows);
+    Serial.println(")");
   }
-}
\ No newline at end of file
+}
@@ -0,0 +1,66 @@
+// Author: Leonardo La Rocca
+// email: info@melopero.com
+//
+// In this example it is shown how to record a binary trace of everything the
+// gesture parser reads from the device (FIFO datasets, FIFO level and status).
+// The trace is written to the serial port as raw bytes, save it on the computer
+// (e.g. cat /dev/ttyACM0 > trace.bin) and replay it with extras/host/apds9960_replay
+// to reproduce a misdetection or to compare two versions of the parser.
+// Open the serial port only after the board has been reset: the trace starts with
+// a 4 bytes header.
+// The trace hook is compiled only with the build flag APDS9960_TRACE=1, for the
+// sketch and the library (PlatformIO: build_flags = -DAPDS9960_TRACE=1, Arduino IDE:
+// compiler.cpp.extra_flags=-DAPDS9960_TRACE=1 in platform.local.txt).
+//
+// First make sure that your connections are setup correctly:
+// I2C pinout:
+// APDS9960 <------> Arduino MKR
+//     VIN <------> VCC
+//     SCL <------> SCL (12)
+//     SDA <------> SDA (11)
+//     GND <------> GND
+//
+// Note: Do not connect the device to the 5V pin!
+
+#include "Melopero_APDS9960.h"
+
+#if !APDS9960_TRACE
+#error "Build with -DAPDS9960_TRACE=1 (see the comment above)"
+#endif
+
+Melopero_APDS9960 device;
+
+uint8_t traceBuffer[1024];
+APDS9960TraceRecorder recorder(traceBuffer, sizeof(traceBuffer));
+
+void setup() {
+  Serial.begin(115200); // Initialize serial comunication
+  while (!Serial); // wait for serial to be ready
+
+  Wire.begin();
+  device.initI2C(0x39, Wire); // Initialize the comunication library
+  device.reset(); // Reset all interrupt settings and power off the device
+
+  // Gesture engine settings
+  device.enableGesturesEngine(); // enable the gesture engine
+  device.setGestureProxEnterThreshold(25); // Enter the gesture engine when the proximity value is greater than 25
+  device.setGestureExitThreshold(20); // Exit the gesture engine when the proximity value is less than 20
+  device.setGestureExitPersistence(EXIT_AFTER_4_GESTURE_END);
+
+  device.wakeUp(); // wake up the device
+
+  device.attachTraceRecorder(&recorder); // record every read from now on
+  device.beginGestureParse(300);
+}
+
+void loop() {
+  device.pollGestureParse();
+  if (device.gestureParseDone)
+    device.beginGestureParse(300); // parse the next window, the result is in the trace anyway
+
+  // Send the trace before the buffer fills up (a record takes at most 135 bytes here)
+  if (recorder.length > sizeof(traceBuffer) / 2){
+    Serial.write(recorder.buffer, recorder.length);
+    recorder.clear();
+  }
+}
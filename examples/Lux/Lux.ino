@@ -0,0 +1,66 @@
+// Author: Leonardo La Rocca
+// email: info@melopero.com
+// 
+// In this example it is shown how to measure the illuminance (lux), the
+// correlated color temperature and the chromaticity of the light without
+// floating point math.
+// 
+// First make sure that your connections are setup correctly:
+// I2C pinout:
+// APDS9960 <------> Arduino MKR
+//     VIN <------> VCC
+//     SCL <------> SCL (12)
+//     SDA <------> SDA (11)
+//     GND <------> GND
+// 
+// Note: Do not connect the device to the 5V pin!
+
+#include "Melopero_APDS9960.h"
+
+Melopero_APDS9960 device;
+LightCalculator light;
+
+void setup() {
+  Serial.begin(9600); // Initialize serial comunication
+  while (!Serial); // wait for serial to be ready
+
+  // Initialize the comunication library
+  Wire.begin(); // use Wire1.begin() to use I2C-1
+  device.initI2C(0x39, Wire); // use device.initI2C(0x39, Wire1) to use I2C-1
+
+  device.reset(); // Reset all interrupt settings and power off the device
+
+  device.enableAlsEngine(); // enable the color/ALS engine
+  device.enableAlsAutoRange(); // let the library choose the gain and the integration time
+
+  // If the sensor is behind a cover glass that lets only half of the light pass
+  // light.setGlassAttenuation(512); // Q8: 256 = open air
+
+  device.wakeUp(); // wake up the device
+}
+
+void loop() {
+  delay(250);
+
+  device.updateColorData(); // update the values stored in device.red/green/blue/clear
+  light.compute(device); // uses the gain and integration time of the readings
+
+  Serial.print("Lux: ");
+  printFixed(light.milliLux, 1000);
+  if (light.saturated) Serial.print(" (saturated)");
+  Serial.print(" CCT: ");
+  Serial.print(light.cct);
+  Serial.print("K x: ");
+  printFixed(light.chromaticityX, 10000);
+  Serial.print(" y: ");
+  printFixed(light.chromaticityY, 10000);
+  Serial.println();
+}
+
+// prints value / unit with all the decimals, unit must be a power of 10
+void printFixed(uint32_t value, uint32_t unit){
+  Serial.print(value / unit);
+  Serial.print(".");
+  for (uint32_t digit = unit / 10; digit > 0; digit /= 10)
+    Serial.print((value / digit) % 10);
+}
@@ -0,0 +1,76 @@
+// Author: Leonardo La Rocca
+// email: info@melopero.com
+// 
+// In this example it is shown how to read many sensors that share the same I2C
+// address, placing them behind a TCA9548A I2C multiplexer.
+// 
+// First make sure that your connections are setup correctly:
+// I2C pinout:
+// TCA9548A <------> Arduino MKR
+//     VIN <------> VCC
+//     SCL <------> SCL (12)
+//     SDA <------> SDA (11)
+//     GND <------> GND
+//
+// Connect one APDS9960 to each of the channels SD0/SC0 ... SD3/SC3 of the mux.
+// The mux address is 0x70 when A0, A1 and A2 are connected to GND.
+//
+// Note: Do not connect the device to the 5V pin!
+
+#include "Melopero_APDS9960_Manager.h"
+
+const uint8_t sensorsCount = 4;
+const uint8_t muxAddress = 0x70;
+
+Melopero_APDS9960 devices[sensorsCount];
+APDS9960Manager manager;
+
+void printProximity(uint8_t sensorIndex, Melopero_APDS9960 &device, uint8_t services){
+  Serial.print("Sensor ");
+  Serial.print(sensorIndex);
+  Serial.print(" proximity: ");
+  Serial.println(device.proximityData);
+}
+
+void setup() {
+  Serial.begin(9600); // Initialize serial comunication
+  while (!Serial); // wait for serial to be ready
+
+  Wire.begin();
+  for (uint8_t i = 0; i < sensorsCount; i++){
+    devices[i].initI2C(0x39, Wire);
+    // Read the proximity of each sensor every 50 milliseconds. The sensor is on channel i of the mux.
+    int8_t index = manager.addSensor(devices[i], SERVICE_PROXIMITY, 50, muxAddress, i);
+
+    // select the mux channel of the sensor before configuring it
+    if (manager.select(index) != NO_ERROR || devices[i].reset() != NO_ERROR){
+      Serial.print("Error during the initialization of sensor ");
+      Serial.println(i);
+      while(true);
+    }
+    devices[i].enableProximityEngine();
+    devices[i].setNonBlockingPowerUp(); // don't wait for the warm up of each sensor
+    devices[i].wakeUp();
+  }
+
+  manager.setServiceCallback(printProximity);
+  Serial.println("Sensors initialized correctly!");
+}
+
+void loop() {
+  // Services the most urgent sensor (if any): selects its mux channel and reads its data
+  manager.service();
+
+  // Print how late each sensor was serviced, on average
+  static unsigned long lastReport = 0;
+  if (millis() - lastReport > 5000){
+    lastReport = millis();
+    for (uint8_t i = 0; i < sensorsCount; i++){
+      const APDS9960Manager::ServiceStats &stats = manager.getServiceStats(i);
+      Serial.print("Sensor ");
+      Serial.print(i);
+      Serial.print(" average latency (us): ");
+      Serial.println(stats.services > 0 ? stats.totalLatencyMicros / stats.services : 0);
+    }
+  }
+}
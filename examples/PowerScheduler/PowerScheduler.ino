@@ -0,0 +1,65 @@
+// Author: Leonardo La Rocca
+// email: info@melopero.com
+//
+// In this example it is shown how to let the power scheduler switch the device
+// between a relaxed profile (one proximity measurement per second, the device
+// sleeps in between) and an active profile (gesture engine without waits) when
+// a hand comes near. It goes back to the relaxed profile after 3 seconds without
+// activity.
+//
+// First make sure that your connections are setup correctly:
+// I2C pinout:
+// APDS9960 <------> Arduino MKR
+//     VIN <------> VCC
+//     SCL <------> SCL (12)
+//     SDA <------> SDA (11)
+//     GND <------> GND
+//
+// Note: Do not connect the device to the 5V pin!
+
+#include "Melopero_APDS9960_Power.h"
+
+Melopero_APDS9960 device;
+// Default profiles: relaxed (proximity about once a second, its interrupt puts the
+// device to sleep until update() clears it) and active (gesture engine, no waits)
+APDS9960PowerScheduler scheduler(device);
+
+void setup() {
+  Serial.begin(9600); // Initialize serial comunication
+  while (!Serial); // wait for serial to be ready
+
+  Wire.begin();
+  if (device.initI2C(0x39, Wire) != NO_ERROR || device.reset() != NO_ERROR){
+    Serial.println("Error during initialization");
+    while(true);
+  }
+  device.enableShadowRegisters(); // a profile switch writes only the registers that differ
+
+  // The profiles can still be tuned before begin()
+  scheduler.active.gestureExitPersistence = EXIT_AFTER_4_GESTURE_END;
+
+  scheduler.proximityThreshold = 50; // a hand nearer than this switches to the active profile
+  scheduler.begin(); // applies the relaxed profile
+}
+
+void loop() {
+  uint8_t profile = scheduler.profile;
+  scheduler.update(); // reads the proximity and switches profile if needed
+
+  if (scheduler.profile == POWER_PROFILE_ACTIVE){
+    device.parseGestureInFifo();
+    if (device.parsedUpDownGesture != NO_GESTURE || device.parsedLeftRightGesture != NO_GESTURE){
+      scheduler.notifyActivity(); // keep sampling fast while gestures come
+      Serial.println("Gesture!");
+    }
+  }
+
+  if (scheduler.profile != profile){
+    Serial.print(scheduler.profile == POWER_PROFILE_ACTIVE ? "Active" : "Relaxed");
+    Serial.print(" profile, estimated sampling rate: ");
+    Serial.print(scheduler.samplingRateMilliHz() / 1000.0);
+    Serial.println(" Hz");
+  }
+
+  delay(scheduler.profile == POWER_PROFILE_ACTIVE ? 30 : 200);
+}
@@ -0,0 +1,230 @@
+//Author: Leonardo La Rocca
+//
+// Bus cost benchmark: runs every public method of the driver against the register simulator
+// and prints, one JSON object per line, the I2C transactions, the bytes on the wire and the 
+// modeled bus time at 100 kHz and 400 kHz. Each call is measured on a freshly reset device, 
+// both without the shadow registers and with a warm (synced) shadow cache. The output is meant to be diffed between versions:
+//
+//   make bench > bench-new.jsonl
+
+#include "Melopero_APDS9960.h"
+#include <stdio.h>
+
+struct BenchContext {
+    APDS9960Simulator bus;
+    Melopero_APDS9960 device;
+};
+
+typedef void (*BenchSetup)(BenchContext &context);
+typedef int8_t (*BenchCall)(BenchContext &context);
+
+// Bus time of the counted traffic: every transaction is START + address byte + data bytes + STOP,
+// every byte takes 9 clock cycles (8 bits + ACK), START and STOP one cycle each.
+static uint32_t busMicros(const APDS9960Simulator &bus, uint32_t clock){
+    uint64_t bits = 9ULL * (bus.transactions + bus.bytesWritten + bus.bytesRead) + 2ULL * bus.transactions;
+    return (uint32_t) ((bits * 1000000ULL + clock - 1) / clock);
+}
+
+static void runBench(const char* name, BenchSetup setup, BenchCall call){
+    for (int shadow = 0; shadow < 2; shadow++){
+        BenchContext context;
+        context.device.initI2C(APDS9960_DEFAULT_I2C_ADDRESS, context.bus);
+        context.device.enableShadowRegisters(shadow != 0);
+        context.device.reset();
+        if (shadow)
+            context.device.syncShadowFromDevice();
+        if (setup != NULL)
+            setup(context);
+
+        context.bus.resetCounters();
+        int8_t status = call(context);
+
+        const APDS9960Simulator &bus = context.bus;
+        printf("{\"call\":\"%s\",\"shadow\":%s,\"status\":%d,\"transactions\":%lu,"
+               "\"bytes_written\":%lu,\"bytes_read\":%lu,\"bus_us_100khz\":%lu,\"bus_us_400khz\":%lu}\n",
+               name, shadow ? "true" : "false", status, 
+               (unsigned long) bus.transactions, (unsigned long) bus.bytesWritten, (unsigned long) bus.bytesRead,
+               (unsigned long) busMicros(bus, 100000), (unsigned long) busMicros(bus, 400000));
+    }
+}
+
+// =========================================================================
+//     Setups
+// =========================================================================
+
+static void powerUp(BenchContext &context){
+    context.device.wakeUp();
+}
+
+static void alsRunning(BenchContext &context){
+    context.device.enableAlsEngine();
+    context.device.wakeUp();
+    context.bus.device.setColorData(1200, 300, 400, 500);
+}
+
+static void proximityRunning(BenchContext &context){
+    context.device.enableProximityEngine();
+    context.device.wakeUp();
+    context.bus.device.setProximityData(42);
+}
+
+static void gestureRunning(BenchContext &context){
+    context.device.enableGesturesEngine();
+    context.device.wakeUp();
+}
+
+static void fillFifo(BenchContext &context, uint8_t datasets){
+    gestureRunning(context);
+    for (uint8_t i = 0; i < datasets; i++)
+        context.bus.device.pushGestureDataset(40 + i * 6, 20 + i * 5, 30, 30);
+}
+
+static void fifo1(BenchContext &context){ fillFifo(context, 1); }
+static void fifo4(BenchContext &context){ fillFifo(context, 4); }
+static void fifo8(BenchContext &context){ fillFifo(context, 8); }
+static void fifo16(BenchContext &context){ fillFifo(context, 16); }
+static void fifo32(BenchContext &context){ fillFifo(context, 32); }
+
+// =========================================================================
+//     Calls
+// =========================================================================
+
+#define BENCH_CALL(function_name, expression) \
+    static int8_t function_name(BenchContext &context){ return context.device.expression; }
+
+BENCH_CALL(callReset, reset())
+BENCH_CALL(callWakeUp, wakeUp())
+BENCH_CALL(callEnableAllEngines, enableAllEnginesAndPowerUp())
+BENCH_CALL(callSetSleepAfterInterrupt, setSleepAfterInterrupt())
+BENCH_CALL(callSetLedDrive, setLedDrive(LED_DRIVE_50_mA))
+BENCH_CALL(callSetLedBoost, setLedBoost(LED_BOOST_200))
+BENCH_CALL(callUpdateStatus, updateStatus())
+BENCH_CALL(callUpdateSnapshot, updateSnapshot())
+
+BENCH_CALL(callEnableProximityEngine, enableProximityEngine())
+BENCH_CALL(callEnableProximityInterrupts, enableProximityInterrupts())
+BENCH_CALL(callEnableProximitySaturationInterrupts, enableProximitySaturationInterrupts())
+BENCH_CALL(callClearProximityInterrupts, clearProximityInterrupts())
+BENCH_CALL(callSetProximityGain, setProximityGain(PROXIMITY_GAIN_4X))
+BENCH_CALL(callSetProximityInterruptThresholds, setProximityInterruptThresholds(10, 200))
+BENCH_CALL(callSetProximityInterruptPersistence, setProximityInterruptPersistence(4))
+BENCH_CALL(callSetProximityPulseCountAndLength, setProximityPulseCountAndLength(8, PULSE_LEN_16_MICROS))
+BENCH_CALL(callSetProximityOffset, setProximityOffset(5, -5))
+BENCH_CALL(callDisablePhotodiodes, disablePhotodiodes(false, true, false, false, true))
+BENCH_CALL(callUpdateProximityData, updateProximityData())
+
+BENCH_CALL(callEnableAlsEngine, enableAlsEngine())
+BENCH_CALL(callEnableAlsInterrupts, enableAlsInterrupts())
+BENCH_CALL(callEnableAlsSaturationInterrupts, enableAlsSaturationInterrupts())
+BENCH_CALL(callClearAlsInterrupts, clearAlsInterrupts())
+BENCH_CALL(callSetAlsGain, setAlsGain(ALS_GAIN_16X))
+BENCH_CALL(callSetAlsThresholds, setAlsThresholds(100, 40000))
+BENCH_CALL(callSetAlsInterruptPersistence, setAlsInterruptPersistence(5))
+BENCH_CALL(callSetAlsIntegrationTime, setAlsIntegrationTime(100))
+BENCH_CALL(callSetAlsIntegrationMicros, setAlsIntegrationMicros(100000))
+BENCH_CALL(callUpdateSaturation, updateSaturation())
+BENCH_CALL(callUpdateColorData, updateColorData())
+
+BENCH_CALL(callEnableGesturesEngine, enableGesturesEngine())
+BENCH_CALL(callEnterImmediatelyGestureEngine, enterImmediatelyGestureEngine())
+BENCH_CALL(callExitGestureEngine, exitGestureEngine())
+BENCH_CALL(callSetGestureProxEnterThreshold, setGestureProxEnterThreshold(25))
+BENCH_CALL(callSetGestureExitThreshold, setGestureExitThreshold(20))
+BENCH_CALL(callSetGestureExitMask, setGestureExitMask(false, false, true, true))
+BENCH_CALL(callSetGestureExitPersistence, setGestureExitPersistence(EXIT_AFTER_4_GESTURE_END))
+BENCH_CALL(callSetGestureGain, setGestureGain(PROXIMITY_GAIN_2X))
+BENCH_CALL(callSetGestureLedDrive, setGestureLedDrive(LED_DRIVE_50_mA))
+BENCH_CALL(callSetGestureWaitTime, setGestureWaitTime(GESTURE_WAIT_8_4_MILLIS))
+BENCH_CALL(callSetGestureOffsets, setGestureOffsets(1, -1, 2, -2))
+BENCH_CALL(callSetGesturePulseCountAndLength, setGesturePulseCountAndLength(10, PULSE_LEN_16_MICROS))
+BENCH_CALL(callSetActivePhotodiodesPairs, setActivePhotodiodesPairs(true, false))
+BENCH_CALL(callEnableGestureInterrupts, enableGestureInterrupts())
+BENCH_CALL(callSetGestureFifoThreshold, setGestureFifoThreshold(FIFO_INT_AFTER_8_DATASETS))
+BENCH_CALL(callResetGestureEngineInterruptSettings, resetGestureEngineInterruptSettings())
+BENCH_CALL(callCheckGestureEngineRunning, checkGestureEngineRunning())
+BENCH_CALL(callUpdateNumberOfDatasetsInFifo, updateNumberOfDatasetsInFifo())
+BENCH_CALL(callUpdateGestureStatus, updateGestureStatus())
+BENCH_CALL(callUpdateGestureData, updateGestureData())
+BENCH_CALL(callParseGestureInFifo, parseGestureInFifo())
+
+BENCH_CALL(callEnableWaitEngine, enableWaitEngine())
+BENCH_CALL(callSetWaitTime, setWaitTime(100))
+BENCH_CALL(callSetWaitMicros, setWaitMicros(100000))
+
+static int8_t callApplyConfig(BenchContext &context){
+    Melopero_APDS9960::Config config;
+    config.powerOn = true;
+    config.proximityEngine = true;
+    config.proximityInterrupts = true;
+    config.proximityHighThreshold = 50;
+    config.gestureEngine = true;
+    config.gestureInterrupts = true;
+    return context.device.applyConfig(config);
+}
+
+int main(){
+    runBench("reset", NULL, callReset);
+    runBench("wakeUp", NULL, callWakeUp);
+    runBench("enableAllEnginesAndPowerUp", NULL, callEnableAllEngines);
+    runBench("setSleepAfterInterrupt", NULL, callSetSleepAfterInterrupt);
+    runBench("setLedDrive", NULL, callSetLedDrive);
+    runBench("setLedBoost", NULL, callSetLedBoost);
+    runBench("updateStatus", powerUp, callUpdateStatus);
+    runBench("updateSnapshot", alsRunning, callUpdateSnapshot);
+    runBench("applyConfig", NULL, callApplyConfig);
+
+    runBench("enableProximityEngine", NULL, callEnableProximityEngine);
+    runBench("enableProximityInterrupts", NULL, callEnableProximityInterrupts);
+    runBench("enableProximitySaturationInterrupts", NULL, callEnableProximitySaturationInterrupts);
+    runBench("clearProximityInterrupts", NULL, callClearProximityInterrupts);
+    runBench("setProximityGain", NULL, callSetProximityGain);
+    runBench("setProximityInterruptThresholds", NULL, callSetProximityInterruptThresholds);
+    runBench("setProximityInterruptPersistence", NULL, callSetProximityInterruptPersistence);
+    runBench("setProximityPulseCountAndLength", NULL, callSetProximityPulseCountAndLength);
+    runBench("setProximityOffset", NULL, callSetProximityOffset);
+    runBench("disablePhotodiodes", NULL, callDisablePhotodiodes);
+    runBench("updateProximityData", proximityRunning, callUpdateProximityData);
+
+    runBench("enableAlsEngine", NULL, callEnableAlsEngine);
+    runBench("enableAlsInterrupts", NULL, callEnableAlsInterrupts);
+    runBench("enableAlsSaturationInterrupts", NULL, callEnableAlsSaturationInterrupts);
+    runBench("clearAlsInterrupts", NULL, callClearAlsInterrupts);
+    runBench("setAlsGain", NULL, callSetAlsGain);
+    runBench("setAlsThresholds", NULL, callSetAlsThresholds);
+    runBench("setAlsInterruptPersistence", NULL, callSetAlsInterruptPersistence);
+    runBench("setAlsIntegrationTime", NULL, callSetAlsIntegrationTime);
+    runBench("setAlsIntegrationMicros", NULL, callSetAlsIntegrationMicros);
+    runBench("updateSaturation", NULL, callUpdateSaturation);
+    runBench("updateColorData", alsRunning, callUpdateColorData);
+
+    runBench("enableGesturesEngine", NULL, callEnableGesturesEngine);
+    runBench("enterImmediatelyGestureEngine", NULL, callEnterImmediatelyGestureEngine);
+    runBench("exitGestureEngine", NULL, callExitGestureEngine);
+    runBench("setGestureProxEnterThreshold", NULL, callSetGestureProxEnterThreshold);
+    runBench("setGestureExitThreshold", NULL, callSetGestureExitThreshold);
+    runBench("setGestureExitMask", NULL, callSetGestureExitMask);
+    runBench("setGestureExitPersistence", NULL, callSetGestureExitPersistence);
+    runBench("setGestureGain", NULL, callSetGestureGain);
+    runBench("setGestureLedDrive", NULL, callSetGestureLedDrive);
+    runBench("setGestureWaitTime", NULL, callSetGestureWaitTime);
+    runBench("setGestureOffsets", NULL, callSetGestureOffsets);
+    runBench("setGesturePulseCountAndLength", NULL, callSetGesturePulseCountAndLength);
+    runBench("setActivePhotodiodesPairs", NULL, callSetActivePhotodiodesPairs);
+    runBench("enableGestureInterrupts", NULL, callEnableGestureInterrupts);
+    runBench("setGestureFifoThreshold", NULL, callSetGestureFifoThreshold);
+    runBench("resetGestureEngineInterruptSettings", NULL, callResetGestureEngineInterruptSettings);
+    runBench("checkGestureEngineRunning", gestureRunning, callCheckGestureEngineRunning);
+    runBench("updateNumberOfDatasetsInFifo", fifo8, callUpdateNumberOfDatasetsInFifo);
+    runBench("updateGestureStatus", fifo8, callUpdateGestureStatus);
+    runBench("updateGestureData", fifo8, callUpdateGestureData);
+    runBench("parseGestureInFifo/1", fifo1, callParseGestureInFifo);
+    runBench("parseGestureInFifo/4", fifo4, callParseGestureInFifo);
+    runBench("parseGestureInFifo/8", fifo8, callParseGestureInFifo);
+    runBench("parseGestureInFifo/16", fifo16, callParseGestureInFifo);
+    runBench("parseGestureInFifo/32", fifo32, callParseGestureInFifo);
+
+    runBench("enableWaitEngine", NULL, callEnableWaitEngine);
+    runBench("setWaitTime", NULL, callSetWaitTime);
+    runBench("setWaitMicros", NULL, callSetWaitMicros);
+    return 0;
+}
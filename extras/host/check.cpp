@@ -0,0 +1,690 @@
+//Author: Leonardo La Rocca
+//
+// Host checks: runs the driver against the register simulator and verifies what it leaves on the device.
+// Prints one JSON object per check and exits with 1 if any of them failed:
+//
+//   make check
+
+#include "Melopero_APDS9960.h"
+#include "Melopero_APDS9960_Power.h"
+#include "Melopero_APDS9960_Manager.h"
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+
+static int checkFailures;
+
+#define CHECK(condition) checkCondition((condition), #condition, __LINE__)
+
+static bool checkCondition(bool passed, const char* condition, int line){
+    if (!passed){
+        fprintf(stderr, "check.cpp:%d: %s\n", line, condition);
+        checkFailures++;
+    }
+    return passed;
+}
+
+static void report(const char* name, int failuresBefore){
+    printf("{\"check\":\"%s\",\"passed\":%s}\n", name, checkFailures == failuresBefore ? "true" : "false");
+}
+
+// =========================================================================
+//     Configuration profiles
+// =========================================================================
+
+// Transactions issued after ENABLE turned something on
+static uint32_t writesAfterEnable;
+static uint8_t enableSeen;
+
+static void watchEnable(void* context){
+    uint8_t enable = ((APDS9960Simulator*) context)->device.registers[ENABLE_REG_ADDRESS];
+    if (enable & ~enableSeen)
+        writesAfterEnable++;
+}
+
+static void checkApplyConfigEnableLast(bool shadow){
+    int failuresBefore = checkFailures;
+    APDS9960Simulator bus;
+    Melopero_APDS9960 device;
+    device.initI2C(APDS9960_DEFAULT_I2C_ADDRESS, bus);
+    device.enableShadowRegisters(shadow);
+    device.reset();
+    if (shadow)
+        device.syncShadowFromDevice();
+
+    Melopero_APDS9960::Config idle;
+    idle.powerOn = true;
+    idle.proximityEngine = true;
+    idle.proximityHighThreshold = 50;
+    idle.waitEngine = true;
+    idle.waitCycles = 200;
+    Melopero_APDS9960::Config active = idle;
+    active.waitEngine = false;
+    active.gestureEngine = true;
+    active.gestureWaitTime = GESTURE_WAIT_0_MILLIS;
+
+    bus.setTransactionHook(watchEnable, &bus);
+    const Melopero_APDS9960::Config* profiles[3] = {&idle, &active, &idle};
+    for (uint8_t i = 0; i < 3; i++){
+        enableSeen = bus.device.registers[ENABLE_REG_ADDRESS];
+        writesAfterEnable = 0;
+        CHECK(device.applyConfig(*profiles[i]) == NO_ERROR);
+        CHECK(writesAfterEnable == 0);
+    }
+    bus.setTransactionHook(NULL, NULL);
+    CHECK(bus.device.registers[ENABLE_REG_ADDRESS] == 0x0D);
+    CHECK(bus.device.registers[WAIT_TIME_REG_ADDRESS] == 56);
+
+    report(shadow ? "applyConfig_enableLast_shadow" : "applyConfig_enableLast", failuresBefore);
+}
+
+// =========================================================================
+//     Gesture parsing
+// =========================================================================
+
+#define SWIPE_DATASETS 20
+
+// An up-down swipe: triangle envelope, the leading channel fades while the trailing one grows
+static void pushSwipe(APDS9960SimDevice &sensor, int32_t first = 0, int32_t count = SWIPE_DATASETS){
+    for (int32_t step = first; step < first + count && step < SWIPE_DATASETS; step++){
+        int32_t envelope = 4 + 196 * (SWIPE_DATASETS - 1 - abs(2 * step - SWIPE_DATASETS + 1)) / (SWIPE_DATASETS - 1);
+        int32_t leading = envelope * (3 * SWIPE_DATASETS - 2 * step) / (2 * SWIPE_DATASETS);
+        int32_t trailing = envelope * (SWIPE_DATASETS + 2 * step) / (2 * SWIPE_DATASETS);
+        sensor.pushGestureDataset(leading > 255 ? 255 : leading, trailing > 255 ? 255 : trailing, envelope, envelope);
+    }
+}
+
+static void setUpGestures(APDS9960Simulator &bus, Melopero_APDS9960 &device){
+    device.initI2C(APDS9960_DEFAULT_I2C_ADDRESS, bus);
+    device.reset();
+    device.enableGesturesEngine();
+    device.wakeUp();
+    device.setGestureEarlyDecision(true);
+}
+
+// The dataset period follows the gesture registers written by the setters and by applyConfig
+static void checkGestureDatasetPeriod(){
+    int failuresBefore = checkFailures;
+    APDS9960Simulator bus;
+    Melopero_APDS9960 device;
+    setUpGestures(bus, device);
+    CHECK(device.gestureDatasetPeriodMicros() == APDS9960Time::gestureDatasetMicros(1, PULSE_LEN_8_MICROS, 
+        GESTURE_WAIT_0_MILLIS, false, false)); // power on values
+
+    device.setGestureWaitTime(GESTURE_WAIT_2_8_MILLIS);
+    device.setGesturePulseCountAndLength(10, PULSE_LEN_16_MICROS);
+    device.setActivePhotodiodesPairs(true, false);
+    CHECK(device.gestureDatasetPeriodMicros() == 700 + 10 * 32 + 2800);
+
+    Melopero_APDS9960::Config config;
+    config.powerOn = true;
+    config.gestureEngine = true;
+    config.gestureWaitTime = GESTURE_WAIT_14_MILLIS;
+    config.gesturePulseCount = 16;
+    config.gesturePulseLength = PULSE_LEN_32_MICROS;
+    CHECK(device.applyConfig(config) == NO_ERROR);
+    CHECK(device.gestureDatasetPeriodMicros() == APDS9960PowerScheduler::gesturePeriodMicros(config));
+
+    device.gestureDatasetMicros = 1000;
+    CHECK(device.gestureDatasetPeriodMicros() == 1000);
+
+    report("gestureDatasetPeriod", failuresBefore);
+}
+
+// parseGestureInFifo reads the whole swipe with one drain: the latency comes from the datasets
+static void checkFifoDecisionLatency(){
+    int failuresBefore = checkFailures;
+    for (uint8_t run = 0; run < 2; run++){
+        APDS9960Simulator bus;
+        Melopero_APDS9960 device;
+        setUpGestures(bus, device);
+        if (run == 1)
+            device.gestureDatasetMicros = 1000;
+
+        pushSwipe(bus.device);
+        delay(100); // the time the datasets wait in the FIFO does not count
+        CHECK(device.parseGestureInFifo() == NO_ERROR);
+        CHECK(device.gestureDecisionLatched);
+        CHECK(device.parsedUpDownGesture != NO_GESTURE);
+        CHECK(device.gestureDecisionDatasets > 1 && device.gestureDecisionDatasets <= SWIPE_DATASETS);
+        CHECK(device.gestureDecisionLatencyMicros == (uint32_t) (SWIPE_DATASETS - 1) * device.gestureDatasetPeriodMicros());
+    }
+    report("parseGestureInFifo_latency", failuresBefore);
+}
+
+// pollGestureParse measures the same thing: the datasets queued in the first drain count, then the time
+// to the drain that decides
+static void checkPollDecisionLatency(){
+    int failuresBefore = checkFailures;
+    // The whole swipe in the first drain: the same latency as parseGestureInFifo
+    {
+        APDS9960Simulator bus;
+        Melopero_APDS9960 device;
+        setUpGestures(bus, device);
+        pushSwipe(bus.device);
+        delay(100);
+        CHECK(device.beginGestureParse(300) == NO_ERROR);
+        CHECK(device.pollGestureParse() == NO_ERROR);
+        CHECK(device.gestureParseDone);
+        CHECK(device.parsedUpDownGesture != NO_GESTURE);
+        CHECK(device.gestureDecisionLatencyMicros == (uint32_t) (SWIPE_DATASETS - 1) * device.gestureDatasetPeriodMicros());
+    }
+
+    // The swipe arriving 4 datasets at a time
+    {
+        APDS9960Simulator bus;
+        Melopero_APDS9960 device;
+        setUpGestures(bus, device);
+        uint32_t period = device.gestureDatasetPeriodMicros();
+        CHECK(device.beginGestureParse(300) == NO_ERROR);
+        pushSwipe(bus.device, 0, 4);
+        CHECK(device.pollGestureParse() == NO_ERROR);
+        uint32_t firstDrain = micros();
+        for (int32_t first = 4; first < SWIPE_DATASETS && !device.gestureParseDone; first += 4){
+            delayMicroseconds(4 * period);
+            pushSwipe(bus.device, first, 4);
+            CHECK(device.pollGestureParse() == NO_ERROR);
+        }
+        CHECK(device.gestureParseDone);
+        CHECK(device.parsedUpDownGesture != NO_GESTURE);
+        CHECK(device.gestureDecisionDatasets > 4);
+        CHECK(device.gestureDecisionLatencyMicros == micros() - firstDrain + 3 * period);
+    }
+    report("pollGestureParse_latency", failuresBefore);
+}
+
+// =========================================================================
+//     Interrupt dispatcher
+// =========================================================================
+
+static uint8_t proximityHandlerCalls;
+
+static void onProximity(Melopero_APDS9960 &device){
+    (void) device;
+    proximityHandlerCalls++;
+}
+
+// The saturation interrupts have no handler, serviceInterrupt must still release the pin
+static void checkSaturationInterrupts(){
+    int failuresBefore = checkFailures;
+    APDS9960Simulator bus;
+    Melopero_APDS9960 device;
+    device.initI2C(APDS9960_DEFAULT_I2C_ADDRESS, bus);
+    device.reset();
+    device.enableAlsEngine();
+    device.enableProximityEngine();
+    device.enableAlsSaturationInterrupts();
+    device.enableProximitySaturationInterrupts();
+    device.wakeUp();
+
+    bus.device.setColorData(65535, 0, 0, 0);
+    CHECK(bus.device.interruptAsserted());
+    CHECK(device.serviceInterrupt() == NO_ERROR);
+    CHECK(device.getStatus().clearSaturation);
+    CHECK(!bus.device.interruptAsserted());
+
+    bus.device.setProximitySaturation();
+    CHECK(bus.device.interruptAsserted());
+    CHECK(device.serviceInterrupt() == NO_ERROR);
+    CHECK(device.getStatus().proximityGestureSaturation);
+    CHECK(!bus.device.interruptAsserted());
+
+    // With a handler the proximity interrupt and PGSAT go with the same clear
+    device.setProximityInterruptHandler(onProximity);
+    device.enableProximityInterrupts();
+    proximityHandlerCalls = 0;
+    bus.device.setColorData(65535, 0, 0, 0);
+    bus.device.setProximitySaturation();
+    bus.device.setProximityData(200);
+    bus.resetCounters();
+    CHECK(device.serviceInterrupt() == NO_ERROR);
+    CHECK(proximityHandlerCalls == 1);
+    CHECK(bus.transactions == 5); // STATUS and PDATA reads (2 each), AICLEAR
+    CHECK(!bus.device.interruptAsserted());
+
+    report("serviceInterrupt_saturation", failuresBefore);
+}
+
+// =========================================================================
+//     Bus errors, bus recovery and brownout
+// =========================================================================
+
+static void setUpDevice(APDS9960Simulator &bus, Melopero_APDS9960 &device){
+    device.initI2C(APDS9960_DEFAULT_I2C_ADDRESS, bus);
+    device.reset();
+}
+
+// Time of a read of ENABLE after the given number of failed attempts
+static uint32_t readMicros(APDS9960Simulator &bus, Melopero_APDS9960 &device, uint16_t nacks, int8_t &status){
+    uint8_t value = 0;
+    bus.injectNacks(nacks);
+    uint32_t start = micros();
+    status = device.read(ENABLE_REG_ADDRESS, &value, 1);
+    return micros() - start;
+}
+
+static void checkBusRetries(){
+    int failuresBefore = checkFailures;
+    APDS9960Simulator bus;
+    Melopero_APDS9960 device;
+    setUpDevice(bus, device);
+    device.setBusRetries(2, 100);
+
+    int8_t status = I2C_ERROR;
+    uint32_t clean = readMicros(bus, device, 0, status);
+    CHECK(status == NO_ERROR);
+
+    // Two failures are absorbed, after 100us and 200us of backoff
+    device.setBusRetries(2, 0);
+    uint32_t noBackoff = readMicros(bus, device, 2, status);
+    CHECK(status == NO_ERROR);
+    CHECK(noBackoff > clean);
+    device.setBusRetries(2, 100);
+    bus.injectedNacks = 0;
+    uint32_t backoff = readMicros(bus, device, 2, status);
+    CHECK(status == NO_ERROR);
+    CHECK(bus.injectedNacks == 2);
+    CHECK(backoff == noBackoff + 300);
+
+    // The third one is returned, nothing is left to the next transfer
+    bus.injectedNacks = 0;
+    readMicros(bus, device, 3, status);
+    CHECK(status == I2C_ERROR);
+    CHECK(bus.injectedNacks == 3);
+    readMicros(bus, device, 0, status);
+    CHECK(status == NO_ERROR);
+
+    device.setBusRetries(0);
+    readMicros(bus, device, 1, status);
+    CHECK(status == I2C_ERROR);
+
+    report("busRetries", failuresBefore);
+}
+
+// A gesture FIFO read that failed after the address was acknowledged is not repeated: the datasets
+// already read are gone. The same failure on another register is retried.
+static void checkFifoNoRetry(){
+    int failuresBefore = checkFailures;
+    APDS9960Simulator bus;
+    Melopero_APDS9960 device;
+    setUpDevice(bus, device);
+    uint8_t buffer[4];
+
+    bus.resetCounters();
+    bus.injectNacks(1, 1); // the data request of the read
+    CHECK(device.read(GESTURE_FIFO_UP_REG_ADDRESS, buffer, 4) == I2C_ERROR);
+    CHECK(bus.transactions == 2);
+
+    bus.resetCounters();
+    bus.injectNacks(1);  // the address
+    CHECK(device.read(GESTURE_FIFO_UP_REG_ADDRESS, buffer, 4) == NO_ERROR);
+    CHECK(bus.transactions == 3);
+
+    bus.resetCounters();
+    bus.injectNacks(1, 1);
+    CHECK(device.read(ENABLE_REG_ADDRESS, buffer, 1) == NO_ERROR);
+    CHECK(bus.transactions == 4);
+
+    report("busRetries_fifo", failuresBefore);
+}
+
+static void checkBusRecovery(){
+    int failuresBefore = checkFailures;
+    APDS9960Simulator bus;
+    Melopero_APDS9960 device;
+    setUpDevice(bus, device);
+    uint8_t value = 0;
+
+    // Without the recovery a held SDA fails every attempt
+    CHECK(device.recoverBus() == INVALID_ARGUMENT);
+    bus.holdSda();
+    bus.injectedNacks = 0;
+    CHECK(device.read(ENABLE_REG_ADDRESS, &value, 1) == I2C_ERROR);
+    CHECK(bus.injectedNacks == APDS9960_BUS_RETRIES + 1);
+    CHECK(bus.busRecoveries == 0);
+
+    // With it the bus is recovered after the last retry and the transfer tried once more
+    device.enableBusRecovery(0, 0);
+    CHECK(device.read(ENABLE_REG_ADDRESS, &value, 1) == NO_ERROR);
+    CHECK(bus.busRecoveries == 1);
+    CHECK(device.read(ENABLE_REG_ADDRESS, &value, 1) == NO_ERROR);
+    CHECK(bus.busRecoveries == 1);
+
+    bus.holdSda();
+    CHECK(device.recoverBus() == NO_ERROR);
+    CHECK(device.read(ENABLE_REG_ADDRESS, &value, 1) == NO_ERROR);
+    CHECK(bus.busRecoveries == 2);
+
+    report("busRecovery", failuresBefore);
+}
+
+static void setUpBrownout(APDS9960Simulator &bus, Melopero_APDS9960 &device, Melopero_APDS9960::Config &config){
+    setUpDevice(bus, device);
+    device.enableShadowRegisters();
+    config.powerOn = true;
+    config.proximityEngine = true;
+    config.proximityInterrupts = true;
+    config.proximityHighThreshold = 50;
+    config.waitEngine = true;
+    CHECK(device.applyConfig(config) == NO_ERROR);
+}
+
+static void checkBrownoutRestore(){
+    int failuresBefore = checkFailures;
+    Melopero_APDS9960::Config config;
+
+    // Without the cache there is nothing to restore from
+    APDS9960Simulator plainBus;
+    Melopero_APDS9960 plain;
+    setUpDevice(plainBus, plain);
+    CHECK(plain.setBrownoutCheck(true) == INVALID_ARGUMENT);
+    CHECK(plain.checkBrownout() == INVALID_ARGUMENT);
+
+    // After a transfer saved by a retry
+    APDS9960Simulator bus;
+    Melopero_APDS9960 device;
+    setUpBrownout(bus, device, config);
+    uint8_t enable = bus.device.registers[ENABLE_REG_ADDRESS];
+    CHECK(device.setBrownoutCheck(true) == NO_ERROR);
+    CHECK(device.updateSnapshot() == NO_ERROR);
+    CHECK(device.brownouts == 0);
+
+    bus.device.powerOnReset();
+    bus.injectNacks(1);
+    CHECK(device.updateSnapshot() == NO_ERROR);
+    CHECK(device.brownouts == 0); // the check runs at the next call
+    CHECK(device.updateSnapshot() == NO_ERROR);
+    CHECK(device.brownouts == 1);
+    CHECK(bus.device.registers[ENABLE_REG_ADDRESS] == enable);
+    CHECK(bus.device.registers[PROX_INT_HIGH_THR_REG_ADDRESS] == 50);
+
+    // Periodically
+    APDS9960Simulator timedBus;
+    Melopero_APDS9960 timed;
+    setUpBrownout(timedBus, timed, config);
+    CHECK(timed.setBrownoutCheck(true, 1000) == NO_ERROR);
+    timedBus.device.powerOnReset();
+    delay(500);
+    CHECK(timed.updateSnapshot() == NO_ERROR);
+    CHECK(timed.brownouts == 0);
+    delay(500);
+    CHECK(timed.updateSnapshot() == NO_ERROR);
+    CHECK(timed.brownouts == 1);
+    CHECK(timedBus.device.registers[ENABLE_REG_ADDRESS] == enable);
+    CHECK(timedBus.device.registers[PROX_INT_HIGH_THR_REG_ADDRESS] == 50);
+
+    // Disabling the cache stops the check
+    timed.enableShadowRegisters(false);
+    timedBus.device.powerOnReset();
+    delay(1000);
+    CHECK(timed.updateSnapshot() == NO_ERROR);
+    CHECK(timed.brownouts == 1);
+
+    report("brownout", failuresBefore);
+}
+
+// =========================================================================
+//     Power scheduler
+// =========================================================================
+
+static void checkPowerSchedulerDefaults(){
+    int failuresBefore = checkFailures;
+    APDS9960Simulator bus;
+    Melopero_APDS9960 device;
+    device.initI2C(APDS9960_DEFAULT_I2C_ADDRESS, bus);
+    device.reset();
+    device.enableShadowRegisters();
+    APDS9960PowerScheduler scheduler(device);
+    const uint8_t* registers = bus.device.registers;
+
+    // Relaxed: proximity with its interrupt and long waits
+    CHECK(scheduler.begin() == NO_ERROR);
+    CHECK(scheduler.profile == POWER_PROFILE_RELAXED);
+    CHECK(registers[ENABLE_REG_ADDRESS] == 0x2D); // PON, PEN, WEN, PIEN
+    CHECK(registers[WAIT_TIME_REG_ADDRESS] == 256 - POWER_DEFAULT_RELAXED_WAIT_CYCLES);
+    CHECK(registers[PROX_INT_HIGH_THR_REG_ADDRESS] == POWER_DEFAULT_PROXIMITY_THRESHOLD);
+    CHECK(scheduler.samplingRateMilliHz() > 900 && scheduler.samplingRateMilliHz() < 1100);
+
+    // A hand: active, gesture engine without waits
+    bus.device.setProximityData(200);
+    CHECK(scheduler.update() == NO_ERROR);
+    CHECK(scheduler.profile == POWER_PROFILE_ACTIVE);
+    CHECK(registers[ENABLE_REG_ADDRESS] == 0x65); // PON, PEN, PIEN, GEN
+    CHECK((registers[GESTURE_CONFIG_2_REG_ADDRESS] & 0x07) == GESTURE_WAIT_0_MILLIS);
+
+    report("powerScheduler_defaults", failuresBefore);
+}
+
+// =========================================================================
+//     Crosstalk calibration
+// =========================================================================
+
+static const uint8_t CROSSTALK_UP_RIGHT = 23;
+static const uint8_t CROSSTALK_DOWN_LEFT = 61;
+static const uint8_t CROSSTALK_UDLR[4] = {17, 42, 5, 90};
+
+// The gesture engine must stay off while a proximity pair is measured (PCMP set by the calibration)
+static bool gestureDuringProximityPhase;
+
+static void watchCalibrationPhases(void* context){
+    const uint8_t* registers = ((APDS9960Simulator*) context)->device.registers;
+    if ((registers[CONFIG_3_REG_ADDRESS] & 0x20) && (registers[ENABLE_REG_ADDRESS] & 0x40))
+        gestureDuringProximityPhase = true;
+}
+
+static void setUpCalibration(APDS9960Simulator &bus, Melopero_APDS9960 &device, bool shadow){
+    device.initI2C(APDS9960_DEFAULT_I2C_ADDRESS, bus);
+    device.enableShadowRegisters(shadow);
+    device.reset();
+    if (shadow)
+        device.syncShadowFromDevice();
+    bus.device.setCrosstalk(CROSSTALK_UP_RIGHT, CROSSTALK_DOWN_LEFT, CROSSTALK_UDLR);
+
+    // An application configuration that the calibration must give back
+    device.enableProximityEngine();
+    device.enableGesturesEngine();
+    device.setGestureExitThreshold(30);
+    device.setProximityOffset(-3, 4);
+    device.setGestureOffsets(1, -2, 3, -4);
+    device.wakeUp();
+}
+
+static void checkCalibration(bool shadow){
+    int failuresBefore = checkFailures;
+    APDS9960Simulator bus;
+    Melopero_APDS9960 device;
+    setUpCalibration(bus, device, shadow);
+    const uint8_t* registers = bus.device.registers;
+    uint8_t enable = registers[ENABLE_REG_ADDRESS];
+    uint8_t config3 = registers[CONFIG_3_REG_ADDRESS];
+    uint8_t config4 = registers[GESTURE_CONFIG_4_REG_ADDRESS] & ~0x04; // GFIFO_CLR reads back as 0
+
+    gestureDuringProximityPhase = false;
+    bus.setTransactionHook(watchCalibrationPhases, &bus);
+    uint8_t blob[CALIBRATION_BLOB_SIZE];
+    CHECK(device.calibrateCrosstalk(blob, 2) == NO_ERROR);
+    bus.setTransactionHook(NULL, NULL);
+
+    const uint8_t expected[CALIBRATION_BLOB_SIZE - 1] = {CALIBRATION_BLOB_MAGIC, CROSSTALK_UP_RIGHT, CROSSTALK_DOWN_LEFT,
+        CROSSTALK_UDLR[0], CROSSTALK_UDLR[1], CROSSTALK_UDLR[2], CROSSTALK_UDLR[3]};
+    CHECK(memcmp(blob, expected, sizeof(expected)) == 0);
+    CHECK(!gestureDuringProximityPhase);
+
+    // The offsets found are applied, everything else is restored
+    CHECK(registers[PROX_UP_RIGHT_OFFSET_REG_ADDRESS] == CROSSTALK_UP_RIGHT);
+    CHECK(registers[PROX_DOWN_LEFT_OFFSET_REG_ADDRESS] == CROSSTALK_DOWN_LEFT);
+    CHECK(registers[GESTURE_OFFSET_UP_REG_ADDRESSES] == CROSSTALK_UDLR[0]);
+    CHECK(registers[GESTURE_OFFSET_RIGHT_REG_ADDRESSES] == CROSSTALK_UDLR[3]);
+    CHECK(registers[ENABLE_REG_ADDRESS] == enable);
+    CHECK(registers[CONFIG_3_REG_ADDRESS] == config3);
+    CHECK(registers[GESTURE_EXIT_THR_REG_ADDRESS] == 30);
+    CHECK(registers[GESTURE_CONFIG_4_REG_ADDRESS] == config4);
+
+    // The blob gives the same offsets on another device
+    APDS9960Simulator otherBus;
+    Melopero_APDS9960 other;
+    other.initI2C(APDS9960_DEFAULT_I2C_ADDRESS, otherBus);
+    other.reset();
+    CHECK(other.applyCalibration(blob) == NO_ERROR);
+    CHECK(memcmp(otherBus.device.registers + PROX_UP_RIGHT_OFFSET_REG_ADDRESS,
+        registers + PROX_UP_RIGHT_OFFSET_REG_ADDRESS, 2) == 0);
+    CHECK(memcmp(otherBus.device.registers + GESTURE_OFFSET_UP_REG_ADDRESSES,
+        registers + GESTURE_OFFSET_UP_REG_ADDRESSES, 6) == 0);
+
+    report(shadow ? "calibrateCrosstalk_shadow" : "calibrateCrosstalk", failuresBefore);
+}
+
+// A bus error in the middle of the search leaves the device as it was before the calibration
+static void checkCalibrationError(){
+    int failuresBefore = checkFailures;
+    APDS9960Simulator bus;
+    Melopero_APDS9960 device;
+    setUpCalibration(bus, device, false);
+    uint8_t before[256];
+    memcpy(before, bus.device.registers, sizeof(before));
+
+    // Enough consecutive NACKs to exhaust the retries, past the reads of the saved registers
+    uint8_t blob[CALIBRATION_BLOB_SIZE];
+    bus.injectNacks(APDS9960_BUS_RETRIES + 1, 40);
+    CHECK(device.calibrateCrosstalk(blob, 2) == I2C_ERROR);
+    CHECK(blob[0] != CALIBRATION_BLOB_MAGIC);
+
+    static const uint8_t restored[] = {ENABLE_REG_ADDRESS, CONFIG_3_REG_ADDRESS, GESTURE_EXIT_THR_REG_ADDRESS,
+        PROX_UP_RIGHT_OFFSET_REG_ADDRESS, PROX_DOWN_LEFT_OFFSET_REG_ADDRESS, GESTURE_OFFSET_UP_REG_ADDRESSES,
+        GESTURE_OFFSET_DOWN_REG_ADDRESSES, GESTURE_OFFSET_LEFT_REG_ADDRESSES, GESTURE_OFFSET_RIGHT_REG_ADDRESSES};
+    for (uint8_t i = 0; i < sizeof(restored); i++)
+        CHECK(bus.device.registers[restored[i]] == before[restored[i]]);
+    CHECK((bus.device.registers[GESTURE_CONFIG_4_REG_ADDRESS] & 0x01) == 0); // GMODE released
+
+    report("calibrateCrosstalk_error", failuresBefore);
+}
+
+// =========================================================================
+//     Multiple sensors
+// =========================================================================
+
+static void checkMuxes(){
+    int failuresBefore = checkFailures;
+    // Two muxes on one bus, two sensors behind each of them
+    const uint8_t muxAddresses[4] = { 0x70, 0x70, 0x71, 0x71 };
+    const uint8_t muxChannels[4] = { 0, 1, 0, 3 };
+    APDS9960Simulator bus;
+    bus.attachMux(0x70);
+    bus.attachMux(0x71);
+    APDS9960SimDevice sensors[4];
+    Melopero_APDS9960 devices[4];
+    APDS9960Manager manager;
+    for (uint8_t i = 0; i < 4; i++){
+        bus.connectToMuxChannel(muxAddresses[i], muxChannels[i], &sensors[i]);
+        devices[i].initI2C(APDS9960_DEFAULT_I2C_ADDRESS, bus);
+        CHECK(manager.addSensor(devices[i], SERVICE_PROXIMITY, 0, muxAddresses[i], muxChannels[i]) == i);
+    }
+    for (uint8_t i = 0; i < 4; i++){
+        CHECK(manager.select(i) == NO_ERROR);
+        CHECK(devices[i].reset() == NO_ERROR);
+        CHECK(devices[i].enableProximityEngine() == NO_ERROR);
+        CHECK(devices[i].wakeUp() == NO_ERROR);
+        sensors[i].setProximityData(10 * (i + 1));
+    }
+
+    // A mux is written only when its selection changes, the other one is closed first
+    const uint8_t sequence[6] = { 0, 1, 2, 3, 3, 0 };
+    const uint32_t expectedSelections[6] = { 2, 3, 5, 6, 6, 8 };
+    manager.invalidateMuxCache();
+    bus.resetCounters();
+    for (uint8_t i = 0; i < 6; i++){
+        CHECK(manager.select(sequence[i]) == NO_ERROR);
+        CHECK(bus.muxSelections == expectedSelections[i]);
+    }
+
+    for (uint8_t i = 0; i < 4; i++)
+        manager.notifyInterrupt(i);
+    for (uint8_t i = 0; i < 4; i++)
+        CHECK(manager.service() == NO_ERROR);
+    for (uint8_t i = 0; i < 4; i++){
+        CHECK(devices[i].proximityData == 10 * (i + 1));
+        CHECK(manager.getServiceStats(i).services == 1);
+        CHECK(manager.getServiceStats(i).errors == 0);
+    }
+    CHECK(bus.muxConflicts == 0);
+
+    report("manager_muxes", failuresBefore);
+}
+
+// A NACK on a mux write is retried like any other transfer of the sensor, and the bus is recovered
+// after the last retry
+static void checkMuxRetries(){
+    int failuresBefore = checkFailures;
+    APDS9960Simulator bus;
+    bus.attachMux(0x70);
+    bus.attachMux(0x71);
+    APDS9960SimDevice sensors[2];
+    Melopero_APDS9960 devices[2];
+    APDS9960Manager manager;
+    for (uint8_t i = 0; i < 2; i++){
+        bus.connectToMuxChannel(0x70 + i, 0, &sensors[i]);
+        devices[i].initI2C(APDS9960_DEFAULT_I2C_ADDRESS, bus);
+        devices[i].setBusRetries(2, 100);
+        manager.addSensor(devices[i], SERVICE_PROXIMITY, 0, 0x70 + i, 0);
+        CHECK(manager.select(i) == NO_ERROR);
+        CHECK(devices[i].reset() == NO_ERROR);
+        CHECK(devices[i].enableProximityEngine() == NO_ERROR);
+        CHECK(devices[i].wakeUp() == NO_ERROR);
+        sensors[i].setProximityData(10 * (i + 1));
+    }
+
+    // Closing 0x70 fails twice: the retries of sensor 1 cover it
+    bus.resetCounters();
+    bus.injectNacks(2);
+    manager.notifyInterrupt(0);
+    CHECK(manager.service() == NO_ERROR);
+    CHECK(manager.lastServicedSensor == 0);
+    CHECK(bus.injectedNacks == 2);
+    CHECK(bus.muxSelections == 2);
+    CHECK(devices[0].proximityData == 10);
+    CHECK(manager.getServiceStats(0).errors == 0);
+
+    // Without retries the error reaches service() and the selection is written again at the next one
+    devices[1].setBusRetries(0);
+    bus.resetCounters();
+    bus.injectNacks(1);
+    manager.notifyInterrupt(1);
+    CHECK(manager.service() == I2C_ERROR);
+    CHECK(manager.getServiceStats(1).errors == 1);
+    manager.notifyInterrupt(1);
+    CHECK(manager.service() == NO_ERROR);
+    CHECK(devices[1].proximityData == 20);
+    CHECK(bus.muxSelections == 2);
+
+    // SDA held low during the mux write: the bus recovery frees it
+    devices[0].enableBusRecovery(0, 0);
+    bus.resetCounters();
+    bus.holdSda();
+    manager.notifyInterrupt(0);
+    CHECK(manager.service() == NO_ERROR);
+    CHECK(bus.busRecoveries == 1);
+    CHECK(devices[0].proximityData == 10);
+    CHECK(bus.muxConflicts == 0);
+
+    report("manager_muxRetries", failuresBefore);
+}
+
+int main(){
+    checkApplyConfigEnableLast(false);
+    checkApplyConfigEnableLast(true);
+    checkGestureDatasetPeriod();
+    checkFifoDecisionLatency();
+    checkPollDecisionLatency();
+    checkSaturationInterrupts();
+    checkBusRetries();
+    checkFifoNoRetry();
+    checkBusRecovery();
+    checkBrownoutRestore();
+    checkPowerSchedulerDefaults();
+    checkCalibration(false);
+    checkCalibration(true);
+    checkCalibrationError();
+    checkMuxes();
+    checkMuxRetries();
+    return checkFailures == 0 ? 0 : 1;
+}
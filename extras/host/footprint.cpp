@@ -0,0 +1,26 @@
+//Author: Leonardo La Rocca
+//
+// Footprint report of one build configuration (make footprint builds it once per configuration with
+// the APDS9960_ENABLE_X, APDS9960_BUS_STATS and APDS9960_TRACE flags): prints the RAM taken by a driver object and the code and data size of
+// the driver translation unit compiled with -Os, measured by the Makefile and passed as arguments.
+// The sizes are those of the host compiler: use them to compare the configurations, the absolute
+// values on the target are given by the size tool of its toolchain.
+//
+//   ./apds9960_footprint name text data bss
+
+#include "Melopero_APDS9960.h"
+#include <stdio.h>
+#include <stdlib.h>
+
+int main(int argc, char** argv){
+    if (argc != 5){
+        fprintf(stderr, "usage: apds9960_footprint name text data bss\n");
+        return 2;
+    }
+    printf("{\"config\":\"%s\",\"als\":%d,\"proximity\":%d,\"gesture\":%d,\"bus_stats\":%d,\"trace\":%d,"
+           "\"driver_ram\":%u,\"text\":%lu,\"data\":%lu,\"bss\":%lu}\n", argv[1], APDS9960_ENABLE_ALS,
+           APDS9960_ENABLE_PROXIMITY, APDS9960_ENABLE_GESTURE, APDS9960_BUS_STATS, APDS9960_TRACE,
+           (unsigned) sizeof(Melopero_APDS9960), strtoul(argv[2], NULL, 10),
+           strtoul(argv[3], NULL, 10), strtoul(argv[4], NULL, 10));
+    return 0;
+}
@@ -0,0 +1,290 @@
+//Author: Leonardo La Rocca
+//
+// Trace replay: feeds a trace recorded with APDS9960TraceRecorder to the driver through the register
+// simulator and prints the gestures found by the chosen parser, one JSON object per line. The virtual
+// clock makes every run deterministic, so the output of two versions of the parser can be diffed:
+//
+//   ./apds9960_replay [--parser window|fifo|recognizer] [--window ms] [--poll ms] [--early] trace.bin
+//   ./apds9960_replay --dump trace.bin        prints the records
+//   ./apds9960_replay --synth trace.bin       records a synthetic trace (two swipes) with the window
+//                                             parser, printing what it finds while recording
+
+#include "Melopero_APDS9960.h"
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+
+#if !APDS9960_TRACE
+#error "the replay tool needs the trace hook: build it with -DAPDS9960_TRACE=1 (make replay)"
+#endif
+
+#define PARSER_WINDOW 0
+#define PARSER_FIFO 1
+#define PARSER_RECOGNIZER 2
+
+struct ReplayOptions {
+    uint8_t parser = PARSER_WINDOW;
+    uint16_t windowMillis = 300;
+    uint16_t pollMillis = 30;
+    bool early = false;
+};
+
+static const char* GESTURE_NAMES[] = {
+    "none", "up", "down", "left", "right", "up_left", "up_right", "down_left", "down_right", "near", "far"
+};
+
+static const char* gestureName(uint8_t gesture){
+    return gesture <= FAR_GESTURE ? GESTURE_NAMES[gesture] : "unknown";
+}
+
+static void printParsed(uint32_t micros, const Melopero_APDS9960 &device){
+    if (device.parsedUpDownGesture == NO_GESTURE && device.parsedLeftRightGesture == NO_GESTURE)
+        return;
+    printf("{\"us\":%lu,\"up_down\":\"%s\",\"left_right\":\"%s\"}\n", (unsigned long) micros,
+           gestureName(device.parsedUpDownGesture), gestureName(device.parsedLeftRightGesture));
+}
+
+static void configure(Melopero_APDS9960 &device, APDS9960Simulator &bus, const ReplayOptions &options){
+    device.initI2C(APDS9960_DEFAULT_I2C_ADDRESS, bus);
+    device.reset();
+    device.enableAlsEngine();
+    device.enableProximityEngine();
+    device.enableGesturesEngine();
+    device.setGestureEarlyDecision(options.early);
+    device.wakeUp();
+    delay(APDS9960_POWER_UP_MICROS / 1000 + 1);
+}
+
+// =========================================================================
+//     Replay
+// =========================================================================
+
+static int replay(const uint8_t* trace, uint32_t size, const ReplayOptions &options){
+    APDS9960Simulator bus;
+    Melopero_APDS9960 device;
+    configure(device, bus, options);
+
+    APDS9960TraceReplay replay(trace, size);
+    if (!replay.reader.valid){
+        fprintf(stderr, "not a trace (or unsupported version)\n");
+        return 1;
+    }
+    GestureRecognizer recognizer;
+    uint32_t start = micros();
+    replay.start(bus);
+
+    // Keep parsing until the trace is over and a last window/poll has seen its tail
+    bool tail = true;
+    while (!replay.finished() || tail){
+        if (replay.finished())
+            tail = false;
+        switch (options.parser){
+            case PARSER_WINDOW:
+                device.parseGesture(options.windowMillis);
+                printParsed(micros() - start, device);
+                break;
+            case PARSER_FIFO:
+                device.parseGestureInFifo();
+                printParsed(micros() - start, device);
+                delay(options.pollMillis);
+                break;
+            case PARSER_RECOGNIZER:
+                device.recognizeGestureInFifo(recognizer);
+                if (recognizer.complete){
+                    GestureRecognizer::Result result = recognizer.result();
+                    printf("{\"us\":%lu,\"gesture\":\"%s\",\"speed\":%u,\"duration_us\":%lu}\n",
+                           (unsigned long) (micros() - start), gestureName(result.gesture), result.speed,
+                           (unsigned long) result.durationMicros);
+                    recognizer.reset();
+                }
+                delay(options.pollMillis);
+                break;
+        }
+    }
+
+    printf("{\"records\":%lu,\"datasets\":%lu,\"lost_datasets\":%lu,\"trace_us\":%lu,\"valid\":%s}\n",
+           (unsigned long) replay.appliedRecords, (unsigned long) replay.pushedDatasets,
+           (unsigned long) replay.lostDatasets, (unsigned long) replay.durationMicros(),
+           replay.reader.valid ? "true" : "false");
+    return replay.reader.valid ? 0 : 1;
+}
+
+static int dump(const uint8_t* trace, uint32_t size){
+    APDS9960TraceReader reader(trace, size);
+    APDS9960TraceRecord record;
+    while (reader.next(record)){
+        printf("{\"us\":%lu,\"register\":%u,\"bytes\":[", (unsigned long) record.micros, record.address);
+        for (uint8_t i = 0; i < record.length; i++)
+            printf(i == 0 ? "%u" : ",%u", record.values[i]);
+        printf("]}\n");
+    }
+    if (!reader.valid){
+        fprintf(stderr, "invalid or truncated trace at byte %lu\n", (unsigned long) reader.position);
+        return 1;
+    }
+    return 0;
+}
+
+// =========================================================================
+//     Synthetic trace
+// =========================================================================
+
+// Two swipes of 20 datasets, one every 2.8ms: the first along the up-down axis, the second along
+// the left-right one, each followed by the exit of the gesture engine.
+struct Synthesizer {
+    APDS9960Simulator* bus;
+    uint32_t startMicros;
+    uint32_t pushed;
+};
+
+#define SYNTH_DATASET_MICROS 2800
+#define SYNTH_SWIPE_DATASETS 20
+#define SYNTH_SWIPE_MICROS 400000UL
+
+static uint8_t clampChannel(int32_t value){
+    return value > 255 ? 255 : value < 0 ? 0 : value;
+}
+
+static void synthesize(void* context){
+    Synthesizer* synth = (Synthesizer*) context;
+    uint32_t elapsed = micros() - synth->startMicros;
+    uint32_t due = 0;
+    for (uint8_t swipe = 0; swipe < 2; swipe++){
+        uint32_t first = swipe * SYNTH_SWIPE_MICROS + 50000;
+        if (elapsed < first)
+            break;
+        uint32_t datasets = (elapsed - first) / SYNTH_DATASET_MICROS + 1;
+        due += datasets < SYNTH_SWIPE_DATASETS ? datasets : SYNTH_SWIPE_DATASETS;
+    }
+
+    APDS9960SimDevice &device = synth->bus->device;
+    while (synth->pushed < due){
+        uint8_t swipe = synth->pushed / SYNTH_SWIPE_DATASETS;
+        int32_t step = synth->pushed % SYNTH_SWIPE_DATASETS;
+        // Triangle envelope, the leading channel fades while the trailing one grows
+        int32_t envelope = 4 + 196 * (SYNTH_SWIPE_DATASETS - 1 - abs(2 * step - SYNTH_SWIPE_DATASETS + 1)) / (SYNTH_SWIPE_DATASETS - 1);
+        uint8_t leading = clampChannel(envelope * (3 * SYNTH_SWIPE_DATASETS - 2 * step) / (2 * SYNTH_SWIPE_DATASETS));
+        uint8_t trailing = clampChannel(envelope * (SYNTH_SWIPE_DATASETS + 2 * step) / (2 * SYNTH_SWIPE_DATASETS));
+        uint8_t even = clampChannel(envelope);
+        if (swipe == 0)
+            device.pushGestureDataset(leading, trailing, even, even);
+        else
+            device.pushGestureDataset(even, even, leading, trailing);
+        synth->pushed++;
+    }
+
+    // The engine exits 20ms after the last dataset of a swipe
+    bool inSwipe = false;
+    for (uint8_t swipe = 0; swipe < 2; swipe++){
+        uint32_t first = swipe * SYNTH_SWIPE_MICROS + 50000;
+        if (elapsed >= first && elapsed < first + SYNTH_SWIPE_DATASETS * SYNTH_DATASET_MICROS + 20000)
+            inSwipe = true;
+    }
+    if (!inSwipe)
+        device.registers[GESTURE_CONFIG_4_REG_ADDRESS] &= ~0x01;
+}
+
+static int synthesizeTrace(const char* path, const ReplayOptions &options){
+    APDS9960Simulator bus;
+    Melopero_APDS9960 device;
+    configure(device, bus, options);
+
+    static uint8_t buffer[60000];
+    APDS9960TraceRecorder recorder(buffer, sizeof(buffer));
+    Synthesizer synth = { &bus, (uint32_t) micros(), 0 };
+    bus.setTransactionHook(synthesize, &synth);
+    device.attachTraceRecorder(&recorder);
+
+    uint32_t start = micros();
+    while (micros() - start < 2 * SYNTH_SWIPE_MICROS){
+        device.parseGesture(options.windowMillis);
+        printParsed(micros() - start, device);
+    }
+    device.attachTraceRecorder(NULL);
+
+    FILE* file = fopen(path, "wb");
+    if (file == NULL || fwrite(recorder.buffer, 1, recorder.length, file) != recorder.length){
+        fprintf(stderr, "cannot write %s\n", path);
+        if (file != NULL)
+            fclose(file);
+        return 1;
+    }
+    fclose(file);
+    fprintf(stderr, "%lu records, %u bytes\n", (unsigned long) recorder.records, recorder.length);
+    return recorder.droppedRecords == 0 ? 0 : 1;
+}
+
+// =========================================================================
+//     Main
+// =========================================================================
+
+static uint8_t* loadFile(const char* path, uint32_t &size){
+    FILE* file = fopen(path, "rb");
+    if (file == NULL)
+        return NULL;
+    fseek(file, 0, SEEK_END);
+    long length = ftell(file);
+    fseek(file, 0, SEEK_SET);
+    uint8_t* data = length > 0 ? (uint8_t*) malloc(length) : NULL;
+    if (data == NULL || fread(data, 1, length, file) != (size_t) length){
+        free(data);
+        fclose(file);
+        return NULL;
+    }
+    fclose(file);
+    size = length;
+    return data;
+}
+
+static int usage(){
+    fprintf(stderr, "usage: apds9960_replay [--parser window|fifo|recognizer] [--window ms] [--poll ms] [--early] trace.bin\n"
+                    "       apds9960_replay --dump trace.bin\n"
+                    "       apds9960_replay --synth trace.bin\n");
+    return 2;
+}
+
+int main(int argc, char** argv){
+    ReplayOptions options;
+    bool dumpOnly = false;
+    bool synth = false;
+    const char* path = NULL;
+
+    for (int i = 1; i < argc; i++){
+        if (strcmp(argv[i], "--dump") == 0)
+            dumpOnly = true;
+        else if (strcmp(argv[i], "--synth") == 0)
+            synth = true;
+        else if (strcmp(argv[i], "--early") == 0)
+            options.early = true;
+        else if (strcmp(argv[i], "--window") == 0 && i + 1 < argc)
+            options.windowMillis = atoi(argv[++i]);
+        else if (strcmp(argv[i], "--poll") == 0 && i + 1 < argc)
+            options.pollMillis = atoi(argv[++i]);
+        else if (strcmp(argv[i], "--parser") == 0 && i + 1 < argc){
+            const char* parser = argv[++i];
+            if (strcmp(parser, "window") == 0) options.parser = PARSER_WINDOW;
+            else if (strcmp(parser, "fifo") == 0) options.parser = PARSER_FIFO;
+            else if (strcmp(parser, "recognizer") == 0) options.parser = PARSER_RECOGNIZER;
+            else return usage();
+        }
+        else if (argv[i][0] != '-' && path == NULL)
+            path = argv[i];
+        else
+            return usage();
+    }
+    if (path == NULL)
+        return usage();
+
+    if (synth)
+        return synthesizeTrace(path, options);
+
+    uint32_t size = 0;
+    uint8_t* trace = loadFile(path, size);
+    if (trace == NULL){
+        fprintf(stderr, "cannot read %s\n", path);
+        return 1;
+    }
+    int result = dumpOnly ? dump(trace, size) : replay(trace, size, options);
+    free(trace);
+    return result;
+}
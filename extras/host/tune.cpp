@@ -0,0 +1,408 @@
+//Author: Leonardo La Rocca
+//
+// Gesture parameter tuner: classifies labeled recordings of UDLR datasets with the GestureClassifier used by
+// parseGestureInFifo and searches the tolerance, der_tolerance and confidence that work best for them. The
+// parameter sets are evaluated in parallel on all the CPU cores. Every result is one JSON object per line:
+//
+//   ./apds9960_tune [options] label=file ...
+//
+// label is up, down, left, right or none (recordings of things that must not be reported: hovering, noise).
+// A file holds the datasets as printed by the GestureRawData example, one "U D L R" line per dataset (spaces or
+// commas), the recordings are separated by blank lines or lines starting with '#'.
+//
+// Options:
+//   --search grid|climb     full grid (default) or hill climb from 12/6/6 over the same grid steps
+//   --tolerance min:max:step, --der-tolerance min:max:step, --confidence min:max:step   the grid
+//   --false-weight w        score = accuracy - w * false trigger rate (default 1)
+//   --dataset-us us         time between two datasets, for the decision latency (default 2800)
+//   --threads n             worker threads (default: all the cores)
+//   --top n                 number of parameter sets printed, best first (default 10, 0 prints all)
+
+#include "Melopero_APDS9960_GestureClassifier.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+#include <string>
+#include <thread>
+#include <atomic>
+#include <algorithm>
+
+#define LABEL_NONE NO_GESTURE
+
+struct Recording {
+    uint8_t label; // NO_GESTURE or UP_GESTURE ... RIGHT_GESTURE
+    std::vector<uint8_t> datasets; // 4 bytes per dataset
+};
+
+struct Parameters {
+    uint8_t tolerance;
+    uint8_t derTolerance;
+    uint16_t confidence;
+};
+
+struct Evaluation {
+    Parameters parameters;
+    uint32_t gestures; // recordings with a gesture label
+    uint32_t correct; // whole recording classified as the label (parseGestureInFifo)
+    uint32_t earlyCorrect; // first decision equal to the label (early decision mode)
+    uint32_t wrong; // a different gesture reported
+    uint32_t idle; // recordings labeled none
+    uint32_t falseTriggers; // gesture reported on a none recording
+    uint64_t latencyDatasets; // sum over the early correct recordings
+    double score;
+};
+
+struct Range {
+    int min;
+    int max;
+    int step;
+};
+
+struct TunerOptions {
+    bool climb = false;
+    Range tolerance = {0, 40, 2};
+    Range derTolerance = {0, 20, 1};
+    Range confidence = {1, 30, 1};
+    double falseWeight = 1.0;
+    uint32_t datasetMicros = 2800;
+    unsigned threads = 0;
+    unsigned top = 10;
+};
+
+static const char* LABEL_NAMES[] = {"none", "up", "down", "left", "right"};
+
+// =========================================================================
+//     Corpus
+// =========================================================================
+
+static int parseLabel(const char* name){
+    for (int i = 0; i <= RIGHT_GESTURE; i++)
+        if (strcmp(name, LABEL_NAMES[i]) == 0)
+            return i;
+    return -1;
+}
+
+static bool loadRecordings(const char* path, uint8_t label, std::vector<Recording> &corpus){
+    FILE* file = fopen(path, "r");
+    if (file == NULL){
+        fprintf(stderr, "cannot read %s\n", path);
+        return false;
+    }
+
+    Recording current;
+    current.label = label;
+    char line[256];
+    unsigned lineNumber = 0;
+    bool ok = true;
+    while (fgets(line, sizeof(line), file) != NULL){
+        lineNumber++;
+        int values[4];
+        int count = 0;
+        char* cursor = line;
+        while (count < 4){
+            while (*cursor == ' ' || *cursor == ',' || *cursor == '\t')
+                cursor++;
+            char* end;
+            long value = strtol(cursor, &end, 10);
+            if (end == cursor)
+                break;
+            values[count++] = value;
+            cursor = end;
+        }
+
+        if (count == 0){
+            // Blank line or comment: the end of a recording
+            if (!current.datasets.empty())
+                corpus.push_back(current);
+            current.datasets.clear();
+            continue;
+        }
+        if (count != 4){
+            fprintf(stderr, "%s:%u: expected 4 values\n", path, lineNumber);
+            ok = false;
+            break;
+        }
+        for (int i = 0; i < 4; i++){
+            if (values[i] < 0 || values[i] > 255){
+                fprintf(stderr, "%s:%u: value out of range\n", path, lineNumber);
+                ok = false;
+                break;
+            }
+            current.datasets.push_back(values[i]);
+        }
+        if (!ok)
+            break;
+    }
+    if (ok && !current.datasets.empty())
+        corpus.push_back(current);
+    fclose(file);
+    return ok;
+}
+
+// =========================================================================
+//     Evaluation
+// =========================================================================
+
+// True if the result reports exactly the labeled gesture
+static bool matches(const GestureClassifier::Result &result, uint8_t label){
+    if (label == UP_GESTURE || label == DOWN_GESTURE)
+        return result.upDown == label && result.leftRight == NO_GESTURE;
+    return result.leftRight == label && result.upDown == NO_GESTURE;
+}
+
+static bool reported(const GestureClassifier::Result &result){
+    return result.upDown != NO_GESTURE || result.leftRight != NO_GESTURE;
+}
+
+static void evaluate(const std::vector<Recording> &corpus, const TunerOptions &options, Evaluation &evaluation){
+    const Parameters &parameters = evaluation.parameters;
+    GestureClassifier classifier(parameters.tolerance, parameters.derTolerance, parameters.confidence);
+    evaluation.gestures = 0;
+    evaluation.correct = 0;
+    evaluation.earlyCorrect = 0;
+    evaluation.wrong = 0;
+    evaluation.idle = 0;
+    evaluation.falseTriggers = 0;
+    evaluation.latencyDatasets = 0;
+
+    for (size_t r = 0; r < corpus.size(); r++){
+        const Recording &recording = corpus[r];
+        classifier.reset();
+
+        // Same sequence as the early decision mode: the first dataset after which a gesture is reported
+        uint32_t decisionDatasets = 0;
+        GestureClassifier::Result decision = {NO_GESTURE, NO_GESTURE};
+        size_t count = recording.datasets.size() / 4;
+        for (size_t i = 0; i < count; i++){
+            classifier.push(&recording.datasets[i * 4]);
+            if (decisionDatasets == 0){
+                GestureClassifier::Result result = classifier.result();
+                if (reported(result)){
+                    decision = result;
+                    decisionDatasets = i + 1;
+                }
+            }
+        }
+        GestureClassifier::Result result = classifier.result();
+
+        if (recording.label == LABEL_NONE){
+            evaluation.idle++;
+            if (reported(result) || decisionDatasets != 0)
+                evaluation.falseTriggers++;
+            continue;
+        }
+        evaluation.gestures++;
+        if (matches(result, recording.label))
+            evaluation.correct++;
+        else if (reported(result))
+            evaluation.wrong++;
+        if (decisionDatasets != 0 && matches(decision, recording.label)){
+            evaluation.earlyCorrect++;
+            evaluation.latencyDatasets += decisionDatasets;
+        }
+    }
+
+    double accuracy = evaluation.gestures > 0 ? (double) evaluation.correct / evaluation.gestures : 0;
+    double falseRate = evaluation.idle > 0 ? (double) evaluation.falseTriggers / evaluation.idle : 0;
+    evaluation.score = accuracy - options.falseWeight * falseRate;
+}
+
+// Evaluates every parameter set on the worker threads, each one takes the next set not yet evaluated
+static void evaluateAll(const std::vector<Recording> &corpus, const TunerOptions &options, std::vector<Evaluation> &evaluations){
+    std::atomic<size_t> next(0);
+    unsigned threads = options.threads;
+    if (threads > evaluations.size())
+        threads = evaluations.size();
+    if (threads == 0)
+        threads = 1;
+
+    std::vector<std::thread> workers;
+    for (unsigned t = 0; t < threads; t++){
+        workers.push_back(std::thread([&](){
+            size_t index;
+            while ((index = next++) < evaluations.size())
+                evaluate(corpus, options, evaluations[index]);
+        }));
+    }
+    for (size_t t = 0; t < workers.size(); t++)
+        workers[t].join();
+}
+
+static bool better(const Evaluation &first, const Evaluation &second){
+    if (first.score != second.score)
+        return first.score > second.score;
+    // Same score: the faster decision, then the parameters closer to the defaults
+    uint64_t firstLatency = first.latencyDatasets * (second.earlyCorrect > 0 ? second.earlyCorrect : 1);
+    uint64_t secondLatency = second.latencyDatasets * (first.earlyCorrect > 0 ? first.earlyCorrect : 1);
+    if (firstLatency != secondLatency)
+        return firstLatency < secondLatency;
+    if (first.parameters.confidence != second.parameters.confidence)
+        return first.parameters.confidence < second.parameters.confidence;
+    if (first.parameters.tolerance != second.parameters.tolerance)
+        return first.parameters.tolerance < second.parameters.tolerance;
+    return first.parameters.derTolerance < second.parameters.derTolerance;
+}
+
+static bool sameParameters(const Evaluation &first, const Evaluation &second){
+    return first.parameters.tolerance == second.parameters.tolerance && first.parameters.derTolerance == second.parameters.derTolerance &&
+        first.parameters.confidence == second.parameters.confidence;
+}
+
+static void print(const Evaluation &evaluation, const TunerOptions &options){
+    const Parameters &parameters = evaluation.parameters;
+    double accuracy = evaluation.gestures > 0 ? (double) evaluation.correct / evaluation.gestures : 0;
+    double earlyAccuracy = evaluation.gestures > 0 ? (double) evaluation.earlyCorrect / evaluation.gestures : 0;
+    double falseRate = evaluation.idle > 0 ? (double) evaluation.falseTriggers / evaluation.idle : 0;
+    double latency = evaluation.earlyCorrect > 0 ? (double) evaluation.latencyDatasets / evaluation.earlyCorrect : 0;
+    printf("{\"tolerance\":%u,\"der_tolerance\":%u,\"confidence\":%u,\"score\":%.4f,\"accuracy\":%.4f,"
+           "\"early_accuracy\":%.4f,\"wrong\":%lu,\"false_trigger_rate\":%.4f,\"decision_datasets\":%.2f,\"decision_us\":%.0f}\n",
+           parameters.tolerance, parameters.derTolerance, parameters.confidence, evaluation.score, accuracy,
+           earlyAccuracy, (unsigned long) evaluation.wrong, falseRate, latency, latency * options.datasetMicros);
+}
+
+// =========================================================================
+//     Search
+// =========================================================================
+
+static Evaluation candidate(int tolerance, int derTolerance, int confidence){
+    Evaluation evaluation;
+    memset(&evaluation, 0, sizeof(evaluation));
+    evaluation.parameters.tolerance = tolerance;
+    evaluation.parameters.derTolerance = derTolerance;
+    evaluation.parameters.confidence = confidence;
+    return evaluation;
+}
+
+static bool inRange(const Range &range, int value){
+    return value >= range.min && value <= range.max;
+}
+
+static void gridSearch(const std::vector<Recording> &corpus, const TunerOptions &options, std::vector<Evaluation> &results){
+    for (int t = options.tolerance.min; t <= options.tolerance.max; t += options.tolerance.step)
+        for (int d = options.derTolerance.min; d <= options.derTolerance.max; d += options.derTolerance.step)
+            for (int c = options.confidence.min; c <= options.confidence.max; c += options.confidence.step)
+                results.push_back(candidate(t, d, c));
+    evaluateAll(corpus, options, results);
+}
+
+// Moves to the best of the 26 neighbors (one grid step on any combination of the axes) while it improves the score
+static void hillClimb(const std::vector<Recording> &corpus, const TunerOptions &options, std::vector<Evaluation> &results){
+    std::vector<Evaluation> current(1, candidate(
+        std::min(std::max(12, options.tolerance.min), options.tolerance.max),
+        std::min(std::max(6, options.derTolerance.min), options.derTolerance.max),
+        std::min(std::max(6, options.confidence.min), options.confidence.max)));
+    evaluateAll(corpus, options, current);
+    results.push_back(current[0]);
+
+    while (true){
+        const Parameters &from = current[0].parameters;
+        std::vector<Evaluation> neighbors;
+        for (int dt = -1; dt <= 1; dt++)
+            for (int dd = -1; dd <= 1; dd++)
+                for (int dc = -1; dc <= 1; dc++){
+                    int t = from.tolerance + dt * options.tolerance.step;
+                    int d = from.derTolerance + dd * options.derTolerance.step;
+                    int c = from.confidence + dc * options.confidence.step;
+                    if ((dt || dd || dc) && inRange(options.tolerance, t) && inRange(options.derTolerance, d) && inRange(options.confidence, c))
+                        neighbors.push_back(candidate(t, d, c));
+                }
+        evaluateAll(corpus, options, neighbors);
+        results.insert(results.end(), neighbors.begin(), neighbors.end());
+
+        size_t best = 0;
+        for (size_t i = 1; i < neighbors.size(); i++)
+            if (better(neighbors[i], neighbors[best]))
+                best = i;
+        if (neighbors.empty() || neighbors[best].score <= current[0].score)
+            break;
+        current[0] = neighbors[best];
+    }
+}
+
+// =========================================================================
+//     Main
+// =========================================================================
+
+static bool parseRange(const char* text, Range &range, int max){
+    int values[3];
+    if (sscanf(text, "%d:%d:%d", &values[0], &values[1], &values[2]) != 3)
+        return false;
+    if (values[0] < 0 || values[1] < values[0] || values[1] > max || values[2] < 1)
+        return false;
+    range.min = values[0];
+    range.max = values[1];
+    range.step = values[2];
+    return true;
+}
+
+static int usage(){
+    fprintf(stderr, "usage: apds9960_tune [--search grid|climb] [--tolerance min:max:step] [--der-tolerance min:max:step]\n"
+                    "                     [--confidence min:max:step] [--false-weight w] [--dataset-us us] [--threads n]\n"
+                    "                     [--top n] label=file ...   (label: up, down, left, right, none)\n");
+    return 2;
+}
+
+int main(int argc, char** argv){
+    TunerOptions options;
+    std::vector<Recording> corpus;
+
+    for (int i = 1; i < argc; i++){
+        const char* arg = argv[i];
+        bool hasValue = i + 1 < argc;
+        if (strcmp(arg, "--search") == 0 && hasValue){
+            const char* search = argv[++i];
+            if (strcmp(search, "grid") == 0) options.climb = false;
+            else if (strcmp(search, "climb") == 0) options.climb = true;
+            else return usage();
+        }
+        else if (strcmp(arg, "--tolerance") == 0 && hasValue){
+            if (!parseRange(argv[++i], options.tolerance, 255)) return usage();
+        }
+        else if (strcmp(arg, "--der-tolerance") == 0 && hasValue){
+            if (!parseRange(argv[++i], options.derTolerance, 255)) return usage();
+        }
+        else if (strcmp(arg, "--confidence") == 0 && hasValue){
+            // parseGestureInFifo takes the confidence as an uint8_t
+            if (!parseRange(argv[++i], options.confidence, 255)) return usage();
+        }
+        else if (strcmp(arg, "--false-weight") == 0 && hasValue)
+            options.falseWeight = atof(argv[++i]);
+        else if (strcmp(arg, "--dataset-us") == 0 && hasValue)
+            options.datasetMicros = atoi(argv[++i]);
+        else if (strcmp(arg, "--threads") == 0 && hasValue)
+            options.threads = atoi(argv[++i]);
+        else if (strcmp(arg, "--top") == 0 && hasValue)
+            options.top = atoi(argv[++i]);
+        else if (arg[0] != '-' && strchr(arg, '=') != NULL){
+            std::string label(arg, strchr(arg, '=') - arg);
+            int code = parseLabel(label.c_str());
+            if (code < 0)
+                return usage();
+            if (!loadRecordings(strchr(arg, '=') + 1, code, corpus))
+                return 1;
+        }
+        else
+            return usage();
+    }
+    if (corpus.empty())
+        return usage();
+    if (options.threads == 0)
+        options.threads = std::thread::hardware_concurrency();
+
+    std::vector<Evaluation> results;
+    if (options.climb)
+        hillClimb(corpus, options, results);
+    else
+        gridSearch(corpus, options, results);
+
+    std::sort(results.begin(), results.end(), better);
+    // The hill climb evaluates some parameter sets more than once
+    results.erase(std::unique(results.begin(), results.end(), sameParameters), results.end());
+    size_t printed = options.top == 0 || options.top > results.size() ? results.size() : options.top;
+    for (size_t i = 0; i < printed; i++)
+        print(results[i], options);
+    fprintf(stderr, "%lu recordings, %lu parameter sets, %u threads\n", (unsigned long) corpus.size(),
+            (unsigned long) results.size(), options.threads);
+    return 0;
+}
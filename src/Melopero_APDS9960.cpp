@@ -2,30 +2,176 @@
 
 #include "Melopero_APDS9960.h"
 
+// Configuration registers mirrored by the shadow cache, sorted by address.
+// The reserved addresses (0x82, 0x88, 0x8A, 0xA8) are never written.
+static const uint8_t SHADOW_ADDRESSES[SHADOW_REGISTERS_COUNT] = {
+    ENABLE_REG_ADDRESS, ALS_ATIME_REG_ADDRESS, WAIT_TIME_REG_ADDRESS,
+    ALS_INT_LOW_THR_LOW_BYTE_REG_ADDRESS, ALS_INT_LOW_THR_HIGH_BYTE_REG_ADDRESS,
+    ALS_INT_HIGH_THR_LOW_BYTE_REG_ADDRESS, ALS_INT_HIGH_THR_HIGH_BYTE_REG_ADDRESS,
+    PROX_INT_LOW_THR_REG_ADDRESS, PROX_INT_HIGH_THR_REG_ADDRESS, INTERRUPT_PERSISTANCE_REG_ADDRESS,
+    CONFIG_1_REG_ADDRESS, PROX_PULSE_COUNT_REG_ADDRESS, CONTROL_1_REG_ADDRESS, CONFIG_2_REG_ADDRESS,
+    PROX_UP_RIGHT_OFFSET_REG_ADDRESS, PROX_DOWN_LEFT_OFFSET_REG_ADDRESS, CONFIG_3_REG_ADDRESS,
+    GESTURE_PROX_ENTER_THR_REG_ADDRESS, GESTURE_EXIT_THR_REG_ADDRESS, GESTURE_CONFIG_1_REG_ADDRESS,
+    GESTURE_CONFIG_2_REG_ADDRESS, GESTURE_OFFSET_UP_REG_ADDRESSES, GESTURE_OFFSET_DOWN_REG_ADDRESSES,
+    GESTURE_PULSE_COUNT_AND_LEN_REG_ADDRESS, GESTURE_OFFSET_LEFT_REG_ADDRESSES,
+    GESTURE_OFFSET_RIGHT_REG_ADDRESSES, GESTURE_CONFIG_3_REG_ADDRESS, GESTURE_CONFIG_4_REG_ADDRESS
+};
+#define SHADOW_ENABLE_INDEX 0
+#define SHADOW_ATIME_INDEX 1
+#define SHADOW_WTIME_INDEX 2
+#define SHADOW_ALS_THRESHOLDS_INDEX 3
+#define SHADOW_PROX_LOW_THR_INDEX 7
+#define SHADOW_PROX_HIGH_THR_INDEX 8
+#define SHADOW_PERSISTANCE_INDEX 9
+#define SHADOW_CONFIG_1_INDEX 10
+#define SHADOW_PROX_PULSE_INDEX 11
+#define SHADOW_CONTROL_1_INDEX 12
+#define SHADOW_CONFIG_2_INDEX 13
+#define SHADOW_PROX_OFFSETS_INDEX 14
+#define SHADOW_CONFIG_3_INDEX 16
+#define SHADOW_GESTURE_ENTER_THR_INDEX 17
+#define SHADOW_GESTURE_EXIT_THR_INDEX 18
+#define SHADOW_GESTURE_CONFIG_1_INDEX 19
+#define SHADOW_GESTURE_CONFIG_2_INDEX 20
+#define SHADOW_GESTURE_OFFSET_UP_INDEX 21
+#define SHADOW_GESTURE_OFFSET_DOWN_INDEX 22
+#define SHADOW_GESTURE_PULSE_INDEX 23
+#define SHADOW_GESTURE_OFFSET_LEFT_INDEX 24
+#define SHADOW_GESTURE_OFFSET_RIGHT_INDEX 25
+#define SHADOW_GESTURE_CONFIG_3_INDEX 26
+#define SHADOW_GESTURE_CONFIG_4_INDEX 27
+
+// A clean register between two dirty ones is rewritten with its known value rather than
+// starting a new transaction, as long as no more than this many bytes are bridged.
+#define MAX_BRIDGED_REGISTERS 2
+
+// GMODE (GCONF4 bit 0) is set and cleared by the gesture state machine and GFIFO_CLR 
+// (GCONF4 bit 2) clears itself, so they can't be trusted / must never be replayed from the cache.
+#define GESTURE_CONFIG_4_HARDWARE_BITS APDS9960Field::GestureMode::mask
+// Extra shadowValid flag: the cached GMODE bit is still the value seen on the device
+#define SHADOW_GESTURE_MODE_VALID (1UL << SHADOW_REGISTERS_COUNT)
+#define GESTURE_CONFIG_4_SELF_CLEARING_BITS APDS9960Field::GestureFifoClear::mask
+
+// Returned by readOnce when the register address was acknowledged but the data did not come: the
+// FIFO datasets already read are lost, so such a read of the FIFO must not be repeated
+#define BUS_DATA_ERROR -3
+
+static int8_t shadowIndex(uint8_t registerAddress){
+    for (int8_t i = 0; i < SHADOW_REGISTERS_COUNT; i++)
+        if (SHADOW_ADDRESSES[i] == registerAddress)
+            return i;
+    return -1;
+}
+
 Melopero_APDS9960::Melopero_APDS9960(){
-    
+    shadowEnabled = false;
+    shadowValid = 0;
+    nonBlockingPowerUp = false;
+    devicePoweredOn = false;
+    powerUpPending = false;
+    snapshotMicros = 0;
+    waitCycles = 1;
+    longWait = false;
+    busRetries = APDS9960_BUS_RETRIES;
+    busRetryBackoffMicros = APDS9960_BUS_RETRY_BACKOFF_MICROS;
+    brownouts = 0;
+    busErrorRecovered = false;
+    brownoutCheck = false;
+    brownoutCheckMillis = 0;
+    lastBrownoutCheckMillis = 0;
+#if APDS9960_BUS_RECOVERY
+    busRecovery = false;
+    recoverySdaPin = 0;
+    recoverySclPin = 0;
+    recoveryBusClock = 0;
+#endif
+#if APDS9960_TRACE
+    traceRecorder = NULL;
+#endif
+#if APDS9960_ENABLE_GESTURE
+    gestureParseRunning = false;
+    gestureParseDone = false;
+    gestureParsePollInterval = GESTURE_PARSE_POLL_INTERVAL_MILLIS;
+    gestureParseCallback = NULL;
+    gestureEarlyDecision = false;
+    gestureDecisionLatched = false;
+    gestureDecisionDatasets = 0;
+    gestureDecisionLatencyMicros = 0;
+    gestureDatasetMicros = 0;
+    parseMotionSeen = false;
+    parseFirstMotionMicros = 0;
+    // Power on values
+    gestureConfig2 = 0x00;
+    gesturePulse = 0x40;
+    gestureConfig3 = 0x00;
+    gestureRingBuffer = NULL;
+    gestureInterruptPending = false;
+    gestureFifoOverflows = 0;
+    gestureFifoOverflow = false;
+    gestureFifoHasData = false;
+    gestureInterruptHandler = NULL;
+#endif
+#if APDS9960_ENABLE_PROXIMITY
+    proximityDataValid = false;
+    proximityInterruptHandler = NULL;
+#endif
+#if APDS9960_ENABLE_ALS
+    colorDataValid = false;
+    alsInterruptHandler = NULL;
+    alsAutoRange = false;
+    alsAutoRangeSettling = false;
+    updateAlsScale(ALS_GAIN_1X, 1);
+#endif
 }
 
 //=========================================================================
 //    I2C functions
 //=========================================================================
 
-int8_t Melopero_APDS9960::initI2C(uint8_t i2cAddr, TwoWire &bus){
+int8_t Melopero_APDS9960::initI2C(uint8_t i2cAddr, APDS9960_TRANSPORT &bus){
     i2cAddress = i2cAddr;
     i2c = &bus;
     return NO_ERROR;
 }
 
 int8_t Melopero_APDS9960::read(uint8_t registerAddress, uint8_t* buffer, uint8_t amount){
+    uint8_t attempt = 0;
+    int8_t status = readOnce(registerAddress, buffer, amount);
+    while (status != NO_ERROR && (status != BUS_DATA_ERROR || registerAddress < GESTURE_FIFO_UP_REG_ADDRESS) 
+            && prepareRetry(attempt))
+        status = readOnce(registerAddress, buffer, amount);
+    if (status == NO_ERROR && attempt > 0)
+        busErrorRecovered = true;
+    return status == NO_ERROR ? NO_ERROR : I2C_ERROR;
+}
+
+int8_t Melopero_APDS9960::readOnce(uint8_t registerAddress, uint8_t* buffer, uint8_t amount){
+#if APDS9960_BUS_STATS
+    uint32_t startMicros = micros();
+    busStats.transactions++;
+    busStats.bytesWritten++;
+#endif
+#if APDS9960_TRACE
+    uint32_t traceMicros = traceRecorder != NULL ? micros() : 0;
+#endif
     i2c->beginTransmission(i2cAddress);
     i2c->write(registerAddress);
     uint8_t i2cStatus = i2c->endTransmission();
-    if (i2cStatus != 0) return I2C_ERROR;
+    if (i2cStatus != 0){
+#if APDS9960_BUS_STATS
+        busStats.errors[BUS_SITE_READ_ADDRESS]++;
+        recordTransfer(BUS_TRANSFER_READ, startMicros);
+#endif
+        return I2C_ERROR;
+    }
 
     uint32_t dataIndex = 0;
     do {
         uint8_t request = amount > 32 ? 32 : amount;
         i2c->requestFrom(i2cAddress, request);
+#if APDS9960_BUS_STATS
+        busStats.transactions++;
+#endif
         for (uint8_t i = 0; i < request; i++){
             if (i2c->available()){
                 buffer[dataIndex] = i2c->read();
@@ -33,26 +179,89 @@ int8_t Melopero_APDS9960::read(uint8_t registerAddress, uint8_t* buffer, uint8_t
                 amount--;
             }
             else {
-                return I2C_ERROR;
+#if APDS9960_BUS_STATS
+                busStats.bytesRead += dataIndex;
+                busStats.shortReads++;
+                busStats.errors[BUS_SITE_READ_DATA]++;
+                recordTransfer(BUS_TRANSFER_READ, startMicros);
+#endif
+                return BUS_DATA_ERROR;
             }
         }
     }
     while (amount > 0);
+
+#if APDS9960_BUS_STATS
+    busStats.bytesRead += dataIndex;
+    recordTransfer(BUS_TRANSFER_READ, startMicros);
+#endif
+#if APDS9960_TRACE
+    if (traceRecorder != NULL)
+        traceRecorder->record(registerAddress, buffer, dataIndex, traceMicros);
+#endif
+    if (registerAddress == ENABLE_REG_ADDRESS)
+        trackPowerState(APDS9960Field::PowerOn::decode(buffer[0]), false);
+#if APDS9960_ENABLE_GESTURE
+    trackGestureTiming(registerAddress, buffer, dataIndex);
+#endif
+    if (shadowEnabled)
+        updateShadow(registerAddress, buffer, dataIndex);
     return NO_ERROR;
 }
     
 int8_t Melopero_APDS9960::write(uint8_t registerAddress, uint8_t* values, uint8_t len){
+    uint8_t attempt = 0;
+    int8_t status = writeOnce(registerAddress, values, len);
+    while (status != NO_ERROR && prepareRetry(attempt))
+        status = writeOnce(registerAddress, values, len);
+    if (status == NO_ERROR && attempt > 0)
+        busErrorRecovered = true;
+    return status;
+}
+
+int8_t Melopero_APDS9960::writeOnce(uint8_t registerAddress, uint8_t* values, uint8_t len){
+#if APDS9960_BUS_STATS
+    uint32_t startMicros = micros();
+#endif
     i2c->beginTransmission(i2cAddress);
     i2c->write(registerAddress);
     i2c->write(values, len);
     uint8_t i2cStatus = i2c->endTransmission();
+#if APDS9960_BUS_STATS
+    busStats.transactions++;
+    busStats.bytesWritten += 1 + len;
+    if (i2cStatus != 0)
+        busStats.errors[BUS_SITE_WRITE]++;
+    recordTransfer(BUS_TRANSFER_WRITE, startMicros);
+#endif
     if (i2cStatus != 0)
         return I2C_ERROR;
-    else 
-        return NO_ERROR;
+
+    if (registerAddress == ENABLE_REG_ADDRESS && len > 0)
+        trackPowerState(APDS9960Field::PowerOn::decode(values[0]), true);
+#if APDS9960_ENABLE_GESTURE
+    trackGestureTiming(registerAddress, values, len);
+#endif
+    if (shadowEnabled)
+        updateShadow(registerAddress, values, len);
+    return NO_ERROR;
 }
 
 int8_t Melopero_APDS9960::andOrRegister(uint8_t registerAddress, uint8_t andValue, uint8_t orValue){
+    int8_t index = shadowEnabled ? shadowIndex(registerAddress) : -1;
+    if (index >= 0 && (shadowValid & (1UL << index))){
+        // The bits that keep their old value must not be owned by the hardware
+        uint8_t keptBits = andValue & ~orValue;
+        bool cacheUsable = true;
+        if (index == SHADOW_GESTURE_CONFIG_4_INDEX && (keptBits & GESTURE_CONFIG_4_HARDWARE_BITS))
+            cacheUsable = (shadowValid & SHADOW_GESTURE_MODE_VALID) && !gestureStateMachineActive();
+
+        if (cacheUsable){
+            uint8_t cachedValue = (shadowRegisters[index] & andValue) | orValue;
+            return write(registerAddress, &cachedValue, 1);
+        }
+    }
+
     uint8_t value = 0;
     int8_t status = read(registerAddress, &value, 1);
     if (status != NO_ERROR) return status;
@@ -62,92 +271,662 @@ int8_t Melopero_APDS9960::andOrRegister(uint8_t registerAddress, uint8_t andValu
 }
 
 int8_t Melopero_APDS9960::addressAccess(uint8_t registerAddress){
+    uint8_t attempt = 0;
+    int8_t status = addressAccessOnce(registerAddress);
+    while (status != NO_ERROR && prepareRetry(attempt))
+        status = addressAccessOnce(registerAddress);
+    if (status == NO_ERROR && attempt > 0)
+        busErrorRecovered = true;
+    return status;
+}
+
+int8_t Melopero_APDS9960::addressAccessOnce(uint8_t registerAddress){
+#if APDS9960_BUS_STATS
+    uint32_t startMicros = micros();
+#endif
     i2c->beginTransmission(i2cAddress);
     i2c->write(registerAddress);
     uint8_t i2cStatus = i2c->endTransmission();
+#if APDS9960_BUS_STATS
+    busStats.transactions++;
+    busStats.bytesWritten++;
+    if (i2cStatus != 0)
+        busStats.errors[BUS_SITE_ADDRESS_ACCESS]++;
+    recordTransfer(BUS_TRANSFER_ADDRESS_ACCESS, startMicros);
+#endif
     if (i2cStatus != 0)
         return I2C_ERROR;
     else 
         return NO_ERROR;
 }
 
+int8_t Melopero_APDS9960::writeToAddress(uint8_t address, const uint8_t* values, uint8_t len){
+    uint8_t attempt = 0;
+    int8_t status = writeToAddressOnce(address, values, len);
+    while (status != NO_ERROR && prepareRetry(attempt))
+        status = writeToAddressOnce(address, values, len);
+    if (status == NO_ERROR && attempt > 0)
+        busErrorRecovered = true;
+    return status;
+}
+
+int8_t Melopero_APDS9960::writeToAddressOnce(uint8_t address, const uint8_t* values, uint8_t len){
+#if APDS9960_BUS_STATS
+    uint32_t startMicros = micros();
+#endif
+    i2c->beginTransmission(address);
+    i2c->write(values, len);
+    uint8_t i2cStatus = i2c->endTransmission();
+#if APDS9960_BUS_STATS
+    busStats.transactions++;
+    busStats.bytesWritten += len;
+    if (i2cStatus != 0)
+        busStats.errors[BUS_SITE_WRITE]++;
+    recordTransfer(BUS_TRANSFER_WRITE, startMicros);
+#endif
+    return i2cStatus != 0 ? I2C_ERROR : NO_ERROR;
+}
+
+void Melopero_APDS9960::setBusRetries(uint8_t retries, uint16_t backoffMicros){
+    busRetries = retries;
+    busRetryBackoffMicros = backoffMicros;
+}
+
+bool Melopero_APDS9960::prepareRetry(uint8_t &attempt){
+    if (attempt < busRetries){
+        uint32_t backoff = (uint32_t) busRetryBackoffMicros << (attempt < 16 ? attempt : 16);
+        delay(backoff / 1000);
+        delayMicroseconds(backoff % 1000);
+        attempt++;
+#if APDS9960_BUS_STATS
+        busStats.retries++;
+#endif
+        return true;
+    }
+#if APDS9960_BUS_RECOVERY
+    // One recovery per transfer, after the last retry
+    if (attempt == busRetries && busRecovery){
+        attempt++;
+        return recoverBus() == NO_ERROR;
+    }
+#endif
+    return false;
+}
+
+#if APDS9960_BUS_RECOVERY
+void Melopero_APDS9960::enableBusRecovery(uint8_t sdaPin, uint8_t sclPin, bool enable, uint32_t busClock){
+    recoverySdaPin = sdaPin;
+    recoverySclPin = sclPin;
+    recoveryBusClock = busClock;
+    busRecovery = enable;
+}
+
+int8_t Melopero_APDS9960::recoverBus(){
+    if (!busRecovery)
+        return INVALID_ARGUMENT;
+#if APDS9960_BUS_STATS
+    busStats.recoveries++;
+#endif
+#if defined(APDS9960_SIMULATED_TRANSPORT)
+    return i2c->recoverBus() ? NO_ERROR : I2C_ERROR;
+#elif defined(ARDUINO)
+#ifdef APDS9960_DEFAULT_TRANSPORT
+    i2c->end(); // gives the pins back to the port
+#endif
+    // Open drain: a line is driven low as an output, released as an input with pull up
+    pinMode(recoverySdaPin, INPUT_PULLUP);
+    pinMode(recoverySclPin, INPUT_PULLUP);
+    // 9 clocks finish any byte the slave is sending, it releases SDA on the (not acknowledged) 9th
+    for (uint8_t i = 0; i < 9 && digitalRead(recoverySdaPin) == LOW; i++){
+        pinMode(recoverySclPin, OUTPUT);
+        digitalWrite(recoverySclPin, LOW);
+        delayMicroseconds(5);
+        pinMode(recoverySclPin, INPUT_PULLUP);
+        delayMicroseconds(5);
+    }
+    // STOP: SDA rises while SCL is high
+    pinMode(recoverySdaPin, OUTPUT);
+    digitalWrite(recoverySdaPin, LOW);
+    delayMicroseconds(5);
+    pinMode(recoverySdaPin, INPUT_PULLUP);
+    delayMicroseconds(5);
+    bool released = digitalRead(recoverySdaPin) == HIGH;
+#ifdef APDS9960_DEFAULT_TRANSPORT
+    i2c->begin();
+    // begin() goes back to the default clock, TwoWire cannot tell which one was set
+    if (recoveryBusClock != 0)
+        i2c->setClock(recoveryBusClock);
+#endif
+    return released ? NO_ERROR : I2C_ERROR;
+#else
+    return INVALID_ARGUMENT;
+#endif
+}
+#endif
+
+#if APDS9960_BUS_STATS
+void Melopero_APDS9960::resetBusStats(){
+    busStats = BusStats();
+}
+
+void Melopero_APDS9960::recordTransfer(uint8_t kind, uint32_t startMicros){
+    uint32_t elapsed = (uint32_t) micros() - startMicros;
+    busStats.transfers[kind]++;
+    busStats.totalMicros[kind] += elapsed;
+    if (elapsed > busStats.maxMicros[kind])
+        busStats.maxMicros[kind] = elapsed;
+}
+#endif
+
+#if APDS9960_TRACE
+void Melopero_APDS9960::attachTraceRecorder(APDS9960TraceRecorder* recorder){
+    traceRecorder = recorder;
+}
+#endif
+
+//=========================================================================
+//    Shadow Register Methods
+//=========================================================================
+
+void Melopero_APDS9960::enableShadowRegisters(bool enable){
+    shadowEnabled = enable;
+    shadowValid = 0;
+    // The brownout check compares with the cache
+    if (!enable)
+        brownoutCheck = false;
+}
+
+int8_t Melopero_APDS9960::syncShadowFromDevice(){
+    if (!shadowEnabled)
+        return INVALID_ARGUMENT;
+
+    // read() refreshes the cache with every shadowed register it comes across
+    uint8_t buffer[32];
+    int8_t status = read(ENABLE_REG_ADDRESS, buffer, 32); // 0x80 - 0x9F
+    if (status != NO_ERROR) return status;
+    return read(GESTURE_PROX_ENTER_THR_REG_ADDRESS, buffer, 12); // 0xA0 - 0xAB
+}
+
+void Melopero_APDS9960::invalidateShadowRegisters(){
+    shadowValid = 0;
+}
+
+static uint8_t signMagnitude(int8_t offset){
+    return offset < 0 ? 0x80 | ((uint8_t) -offset) : (uint8_t) offset;
+}
+
+int8_t Melopero_APDS9960::applyConfig(const Config &config){
+    using namespace APDS9960Field;
+    if (!(LedDrive::fits(config.ledDrive) && GestureLedDrive::fits(config.gestureLedDrive) && LedBoost::fits(config.ledBoost)))
+        return INVALID_ARGUMENT;
+    if (!(APDS9960Time::fits(config.waitCycles) && APDS9960Time::fits(config.alsIntegrationCycles)))
+        return INVALID_ARGUMENT;
+    if (!(AlsGain::fits(config.alsGain) && ProximityGain::fits(config.proximityGain) && GestureGain::fits(config.gestureGain)))
+        return INVALID_ARGUMENT;
+    if (!(AlsPersistence::fits(config.alsPersistence) && ProximityPersistence::fits(config.proximityPersistence)))
+        return INVALID_ARGUMENT;
+    if (!(1 <= config.proximityPulseCount && ProximityPulseCount::fits(config.proximityPulseCount - 1)))
+        return INVALID_ARGUMENT;
+    if (!(1 <= config.gesturePulseCount && GesturePulseCount::fits(config.gesturePulseCount - 1)))
+        return INVALID_ARGUMENT;
+    if (!(ProximityPulseLength::fits(config.proximityPulseLength) && GesturePulseLength::fits(config.gesturePulseLength)))
+        return INVALID_ARGUMENT;
+    if (!(GestureFifoThreshold::fits(config.gestureFifoThreshold) && GestureExitPersistence::fits(config.gestureExitPersistence)))
+        return INVALID_ARGUMENT;
+    if (!GestureWaitTime::fits(config.gestureWaitTime))
+        return INVALID_ARGUMENT;
+
+    uint8_t image[SHADOW_REGISTERS_COUNT];
+    image[SHADOW_ENABLE_INDEX] = PowerOn::encode(config.powerOn) | AlsEnable::encode(config.alsEngine) 
+        | ProximityEnable::encode(config.proximityEngine) | WaitEnable::encode(config.waitEngine) 
+        | AlsInterruptEnable::encode(config.alsInterrupts) | ProximityInterruptEnable::encode(config.proximityInterrupts) 
+        | GestureEnable::encode(config.gestureEngine);
+    image[SHADOW_ATIME_INDEX] = APDS9960Time::registerFromCycles(config.alsIntegrationCycles);
+    image[SHADOW_WTIME_INDEX] = APDS9960Time::registerFromCycles(config.waitCycles);
+    image[SHADOW_ALS_THRESHOLDS_INDEX] = config.alsLowThreshold & 0xFF;
+    image[SHADOW_ALS_THRESHOLDS_INDEX + 1] = config.alsLowThreshold >> 8;
+    image[SHADOW_ALS_THRESHOLDS_INDEX + 2] = config.alsHighThreshold & 0xFF;
+    image[SHADOW_ALS_THRESHOLDS_INDEX + 3] = config.alsHighThreshold >> 8;
+    image[SHADOW_PROX_LOW_THR_INDEX] = config.proximityLowThreshold;
+    image[SHADOW_PROX_HIGH_THR_INDEX] = config.proximityHighThreshold;
+    image[SHADOW_PERSISTANCE_INDEX] = ProximityPersistence::encode(config.proximityPersistence) | AlsPersistence::encode(config.alsPersistence);
+    image[SHADOW_CONFIG_1_INDEX] = 0x40 | WaitLong::encode(config.longWait); // bit 6 is reserved and must be written as 1
+    image[SHADOW_PROX_PULSE_INDEX] = ProximityPulseLength::encode(config.proximityPulseLength) 
+        | ProximityPulseCount::encode(config.proximityPulseCount - 1);
+    image[SHADOW_CONTROL_1_INDEX] = LedDrive::encode(config.ledDrive) | ProximityGain::encode(config.proximityGain) 
+        | AlsGain::encode(config.alsGain);
+    image[SHADOW_CONFIG_2_INDEX] = ProximitySaturationInterruptEnable::encode(config.proximitySaturationInterrupts) 
+        | AlsSaturationInterruptEnable::encode(config.alsSaturationInterrupts)
+        | LedBoost::encode(config.ledBoost) | 0x01; // bit 0 is reserved and must be written as 1
+    image[SHADOW_PROX_OFFSETS_INDEX] = signMagnitude(config.proximityUpRightOffset);
+    image[SHADOW_PROX_OFFSETS_INDEX + 1] = signMagnitude(config.proximityDownLeftOffset);
+    image[SHADOW_CONFIG_3_INDEX] = ProximityGainCompensation::encode(config.proximityGainCompensation) 
+        | SleepAfterInterrupt::encode(config.sleepAfterInterrupt)
+        | ProximityMask::encode((config.proximityMaskUp << 3) | (config.proximityMaskDown << 2) 
+            | (config.proximityMaskLeft << 1) | config.proximityMaskRight);
+    image[SHADOW_GESTURE_ENTER_THR_INDEX] = config.gestureEnterThreshold;
+    image[SHADOW_GESTURE_EXIT_THR_INDEX] = config.gestureExitThreshold;
+    image[SHADOW_GESTURE_CONFIG_1_INDEX] = GestureFifoThreshold::encode(config.gestureFifoThreshold) 
+        | GestureExitMask::encode((config.gestureExitMaskUp << 3) | (config.gestureExitMaskDown << 2) 
+            | (config.gestureExitMaskLeft << 1) | config.gestureExitMaskRight)
+        | GestureExitPersistence::encode(config.gestureExitPersistence);
+    image[SHADOW_GESTURE_CONFIG_2_INDEX] = GestureGain::encode(config.gestureGain) | GestureLedDrive::encode(config.gestureLedDrive) 
+        | GestureWaitTime::encode(config.gestureWaitTime);
+    image[SHADOW_GESTURE_OFFSET_UP_INDEX] = signMagnitude(config.gestureUpOffset);
+    image[SHADOW_GESTURE_OFFSET_DOWN_INDEX] = signMagnitude(config.gestureDownOffset);
+    image[SHADOW_GESTURE_PULSE_INDEX] = GesturePulseLength::encode(config.gesturePulseLength) 
+        | GesturePulseCount::encode(config.gesturePulseCount - 1);
+    image[SHADOW_GESTURE_OFFSET_LEFT_INDEX] = signMagnitude(config.gestureLeftOffset);
+    image[SHADOW_GESTURE_OFFSET_RIGHT_INDEX] = signMagnitude(config.gestureRightOffset);
+    image[SHADOW_GESTURE_CONFIG_3_INDEX] = GestureDimensions::encode((config.gestureLeftRightActive << 1) | config.gestureUpDownActive);
+    image[SHADOW_GESTURE_CONFIG_4_INDEX] = GestureInterruptEnable::encode(config.gestureInterrupts);
+
+    // GCONF4 also holds GMODE, which belongs to the gesture state machine: it is updated 
+    // separately with andOrRegister.
+    uint32_t known = (1UL << SHADOW_GESTURE_CONFIG_4_INDEX) - 1;
+    uint32_t dirty = known;
+    if (shadowEnabled)
+        for (uint8_t i = 0; i < SHADOW_GESTURE_CONFIG_4_INDEX; i++)
+            if ((shadowValid & (1UL << i)) && shadowRegisters[i] == image[i])
+                dirty &= ~(1UL << i);
+
+    // GCONF4 goes first: while the gesture engine is still off its GMODE bit can be taken from the cache.
+    int8_t status = NO_ERROR;
+    if (!(shadowEnabled && (shadowValid & (1UL << SHADOW_GESTURE_CONFIG_4_INDEX)) 
+            && GestureInterruptEnable::decode(shadowRegisters[SHADOW_GESTURE_CONFIG_4_INDEX]) == config.gestureInterrupts)){
+        status = setField<GestureInterruptEnable>(config.gestureInterrupts);
+        if (status != NO_ERROR) return status;
+    }
+
+    // An ENABLE value that turns something on is written last, on its own, so that the engines start with
+    // the new configuration. One that only turns things off stays in the first burst and stops them first.
+    bool enableLast = false;
+    if (dirty & (1UL << SHADOW_ENABLE_INDEX)){
+        uint8_t enabled = (shadowEnabled && (shadowValid & (1UL << SHADOW_ENABLE_INDEX))) ? shadowRegisters[SHADOW_ENABLE_INDEX] : 0;
+        enableLast = (image[SHADOW_ENABLE_INDEX] & ~enabled) != 0;
+        if (enableLast)
+            dirty &= ~(1UL << SHADOW_ENABLE_INDEX);
+    }
+
+    status = writeRegisterImage(image, dirty, known);
+    if (status == NO_ERROR && enableLast)
+        status = write(ENABLE_REG_ADDRESS, &image[SHADOW_ENABLE_INDEX], 1);
+    if (status != NO_ERROR) return status;
+
+#if APDS9960_ENABLE_ALS
+    updateAlsScale(config.alsGain, config.alsIntegrationCycles);
+#endif
+    waitCycles = config.waitCycles;
+    longWait = config.longWait;
+
+    if (config.powerOn && !nonBlockingPowerUp)
+        waitUntilReady();
+    return NO_ERROR;
+}
+
+int8_t Melopero_APDS9960::writeRegisterImage(const uint8_t* image, uint32_t dirty, uint32_t known){
+    uint8_t i = 0;
+    while (i < SHADOW_REGISTERS_COUNT){
+        if (!(dirty & (1UL << i))){
+            i++;
+            continue;
+        }
+
+        // Extend the burst while the addresses are contiguous and the values are known
+        uint8_t last = i;
+        for (uint8_t j = i + 1; j < SHADOW_REGISTERS_COUNT; j++){
+            if (SHADOW_ADDRESSES[j] != SHADOW_ADDRESSES[j - 1] + 1 || !(known & (1UL << j)))
+                break;
+            if (dirty & (1UL << j))
+                last = j;
+            else if (j - last > MAX_BRIDGED_REGISTERS)
+                break;
+        }
+
+        uint8_t buffer[SHADOW_REGISTERS_COUNT];
+        for (uint8_t j = i; j <= last; j++)
+            buffer[j - i] = image[j];
+        int8_t status = write(SHADOW_ADDRESSES[i], buffer, last - i + 1);
+        if (status != NO_ERROR) return status;
+        i = last + 1;
+    }
+    return NO_ERROR;
+}
+
+void Melopero_APDS9960::updateShadow(uint8_t registerAddress, const uint8_t* values, uint8_t len){
+    // Only the configuration register ranges are mirrored
+    if (registerAddress > GESTURE_CONFIG_4_REG_ADDRESS || registerAddress + len <= ENABLE_REG_ADDRESS)
+        return;
+
+    for (uint8_t i = 0; i < len; i++){
+        int8_t index = shadowIndex(registerAddress + i);
+        if (index < 0) continue;
+
+        uint8_t value = values[i];
+        if (index == SHADOW_ENABLE_INDEX && gestureStateMachineActive())
+            // the state machine may have changed GMODE while it was running
+            shadowValid &= ~SHADOW_GESTURE_MODE_VALID;
+        if (index == SHADOW_GESTURE_CONFIG_4_INDEX){
+            value &= ~GESTURE_CONFIG_4_SELF_CLEARING_BITS;
+            shadowValid |= SHADOW_GESTURE_MODE_VALID;
+        }
+
+        shadowRegisters[index] = value;
+        shadowValid |= (1UL << index);
+    }
+}
+
+bool Melopero_APDS9960::gestureStateMachineActive(){
+    // When the cached ENABLE register is unknown assume the worst case
+    if (!(shadowValid & (1UL << SHADOW_ENABLE_INDEX)))
+        return true;
+    uint8_t enable = shadowRegisters[SHADOW_ENABLE_INDEX];
+    return APDS9960Field::PowerOn::decode(enable) && APDS9960Field::GestureEnable::decode(enable);
+}
+
+int8_t Melopero_APDS9960::checkBrownout(){
+    if (!shadowEnabled || !(shadowValid & (1UL << SHADOW_ENABLE_INDEX)))
+        return INVALID_ARGUMENT;
+    busErrorRecovered = false;
+    lastBrownoutCheckMillis = millis();
+
+    // read() refreshes the cache, the expected value is kept aside
+    uint8_t expected = shadowRegisters[SHADOW_ENABLE_INDEX];
+    uint8_t enable = 0;
+    int8_t status = read(ENABLE_REG_ADDRESS, &enable, 1);
+    if (status != NO_ERROR) return status;
+    if (enable != 0 || expected == 0)
+        return NO_ERROR;
+
+    // Power on values everywhere: the whole cached configuration is written back, the engines are
+    // enabled last so that they start with it. GMODE is left to the gesture state machine.
+    brownouts++;
+    shadowRegisters[SHADOW_ENABLE_INDEX] = expected;
+    shadowRegisters[SHADOW_GESTURE_CONFIG_4_INDEX] &= ~GESTURE_CONFIG_4_HARDWARE_BITS;
+    uint32_t known = shadowValid & ((1UL << SHADOW_REGISTERS_COUNT) - 1);
+    status = writeRegisterImage(shadowRegisters, known & ~(1UL << SHADOW_ENABLE_INDEX), known);
+    if (status != NO_ERROR) return status;
+    status = write(ENABLE_REG_ADDRESS, &expected, 1);
+    if (status != NO_ERROR) return status;
+    if (!nonBlockingPowerUp)
+        waitUntilReady();
+    return NO_ERROR;
+}
+
+int8_t Melopero_APDS9960::setBrownoutCheck(bool enable, uint16_t intervalMillis){
+    if (enable && !shadowEnabled)
+        return INVALID_ARGUMENT;
+    brownoutCheck = enable;
+    brownoutCheckMillis = intervalMillis;
+    lastBrownoutCheckMillis = millis();
+    return NO_ERROR;
+}
+
+int8_t Melopero_APDS9960::autoCheckBrownout(){
+    if (!brownoutCheck)
+        return NO_ERROR;
+    bool due = busErrorRecovered || (brownoutCheckMillis != 0 && millis() - lastBrownoutCheckMillis >= brownoutCheckMillis);
+    if (!due)
+        return NO_ERROR;
+    int8_t status = checkBrownout();
+    return status == INVALID_ARGUMENT ? NO_ERROR : status; // ENABLE not cached yet, nothing to compare with
+}
+
 // =========================================================================
 //     Device Methods
 // =========================================================================
 
 int8_t Melopero_APDS9960::wakeUp(bool wakeUp){
-    int8_t status = NO_ERROR;
-    status = andOrRegister(ENABLE_REG_ADDRESS, ((uint8_t) wakeUp) | 0xFE, (uint8_t) wakeUp);
-    delay(10);
+    int8_t status = setField<APDS9960Field::PowerOn>(wakeUp);
+    if (status == NO_ERROR && wakeUp && !nonBlockingPowerUp)
+        waitUntilReady();
     return status;
 }
 
+void Melopero_APDS9960::setNonBlockingPowerUp(bool enable){
+    nonBlockingPowerUp = enable;
+}
+
+bool Melopero_APDS9960::isReady(){
+    return remainingPowerUpMicros() == 0;
+}
+
+uint32_t Melopero_APDS9960::remainingPowerUpMicros(){
+    if (!powerUpPending)
+        return 0;
+
+    int32_t remaining = (int32_t) (readyDeadlineMicros - (uint32_t) micros());
+    if (remaining <= 0){
+        powerUpPending = false;
+        return 0;
+    }
+    return (uint32_t) remaining;
+}
+
+void Melopero_APDS9960::waitUntilReady(){
+    uint32_t remaining = remainingPowerUpMicros();
+    if (remaining == 0)
+        return;
+
+    delay(remaining / 1000);
+    delayMicroseconds(remaining % 1000);
+    powerUpPending = false;
+}
+
+void Melopero_APDS9960::trackPowerState(bool poweredOn, bool written){
+    // Only a PON rising edge starts a warm up, a device found already powered on is ready
+    if (written && poweredOn && !devicePoweredOn){
+        readyDeadlineMicros = (uint32_t) micros() + APDS9960_POWER_UP_MICROS;
+        powerUpPending = true;
+    }
+    if (!poweredOn)
+        powerUpPending = false;
+    devicePoweredOn = poweredOn;
+}
+
 int8_t Melopero_APDS9960::reset(){
+    // The interrupts of all the engines are disabled, also of those that are not compiled in
+    using namespace APDS9960Field;
     int8_t status = NO_ERROR;
     status = setSleepAfterInterrupt(false);
     if (status != NO_ERROR) return status;
     status = enableAllEnginesAndPowerUp(false);
     if (status != NO_ERROR) return status;
-    status = enableProximityInterrupts(false);
+    status = setField<ProximityInterruptEnable>(false);
     if (status != NO_ERROR) return status;
-    status = enableProximitySaturationInterrupts(false);
+    status = setField<ProximitySaturationInterruptEnable>(false);
     if (status != NO_ERROR) return status;
-    status = enableAlsInterrupts(false);
+    status = setField<AlsInterruptEnable>(false);
     if (status != NO_ERROR) return status;
-    status = enableAlsSaturationInterrupts(false);
+    status = setField<AlsSaturationInterruptEnable>(false);
     if (status != NO_ERROR) return status;
-    status = enableGestureInterrupts(false);
+    status = setField<GestureInterruptEnable>(false);
     return status;
 }
 
 int8_t Melopero_APDS9960::enableAllEnginesAndPowerUp(bool enable){
-    uint8_t value = enable ? 0b01001111 : 0;
+    using namespace APDS9960Field;
+    uint8_t value = enable ? PowerOn::mask | AlsEnable::mask | ProximityEnable::mask | WaitEnable::mask | GestureEnable::mask : 0;
     int8_t status = write(ENABLE_REG_ADDRESS, &value, 1);
-    delay(10);
+    if (status == NO_ERROR && enable && !nonBlockingPowerUp)
+        waitUntilReady();
     return status;
 }
 
 int8_t Melopero_APDS9960::setSleepAfterInterrupt(bool enable){
-    int8_t status = NO_ERROR;
-    status = andOrRegister(CONFIG_3_REG_ADDRESS, (enable << 4) | 0xEF, enable << 4);
-    return status;
+    return setField<APDS9960Field::SleepAfterInterrupt>(enable);
 }
 
 int8_t Melopero_APDS9960::setLedDrive(uint8_t ledDrive){
-    if (!(LED_DRIVE_100_mA <= ledDrive && ledDrive <= LED_DRIVE_12_5_mA))
-        return INVALID_ARGUMENT;
-
-    return andOrRegister(CONTROL_1_REG_ADDRESS, (ledDrive << 6) | 0x3F, ledDrive << 6);
+    return setField<APDS9960Field::LedDrive>(ledDrive);
 }
 
 int8_t Melopero_APDS9960::setLedBoost(uint8_t ledBoost){
-        if (!(LED_BOOST_100 <= ledBoost && ledBoost <= LED_BOOST_300))
-            return INVALID_ARGUMENT;
-
-        return andOrRegister(CONFIG_2_REG_ADDRESS, (ledBoost << 4) | 0xCF, (ledBoost << 4));
+    return setField<APDS9960Field::LedBoost>(ledBoost);
 }
 
 int8_t Melopero_APDS9960::updateStatus(){
-    // TODO: add simple way to retrieve status flags:
-    // Clear photodiode saturation (0x80) | Proximity/Gesture saturation (0x40) | Proximity interrupt (0x20) | ALS Interrupt (0x10)
-    // | Gesture Interrupt (0x04) | Proximity valid (0x02) | ALS valid (0x01)
+    int8_t status = autoCheckBrownout();
+    if (status != NO_ERROR) return status;
+    // The flags can be decoded with getStatus
     return read(STATUS_REG_ADDRESS, &deviceStatus, 1);
 }
 
+int8_t Melopero_APDS9960::updateSnapshot(){
+    int8_t status = autoCheckBrownout();
+    if (status != NO_ERROR) return status;
+    waitUntilReady();
+    uint8_t buffer[SNAPSHOT_LENGTH] = {0};
+    uint32_t startMicros = micros();
+    status = read(STATUS_REG_ADDRESS, buffer, SNAPSHOT_LENGTH);
+    if (status != NO_ERROR) return status;
+
+    snapshotMicros = startMicros;
+    deviceStatus = buffer[0];
+#if APDS9960_ENABLE_ALS
+    colorDataValid = deviceStatus & STATUS_ALS_VALID;
+    if (colorDataValid){
+        clear = ((uint16_t) buffer[2]) << 8 | (uint16_t) buffer[1];
+        red = ((uint16_t) buffer[4]) << 8 | (uint16_t) buffer[3];
+        green = ((uint16_t) buffer[6]) << 8 | (uint16_t) buffer[5];
+        blue = ((uint16_t) buffer[8]) << 8 | (uint16_t) buffer[7];
+    }
+#endif
+#if APDS9960_ENABLE_PROXIMITY
+    proximityDataValid = deviceStatus & STATUS_PROX_VALID;
+    if (proximityDataValid)
+        proximityData = buffer[9];
+#endif
+    return NO_ERROR;
+}
+
+Melopero_APDS9960::Status Melopero_APDS9960::getStatus() const {
+    Status decoded;
+    decoded.clearSaturation = deviceStatus & STATUS_CLEAR_SATURATION;
+    decoded.proximityGestureSaturation = deviceStatus & STATUS_PROX_GESTURE_SATURATION;
+    decoded.proximityInterrupt = deviceStatus & STATUS_PROX_INTERRUPT;
+    decoded.alsInterrupt = deviceStatus & STATUS_ALS_INTERRUPT;
+    decoded.gestureInterrupt = deviceStatus & STATUS_GESTURE_INTERRUPT;
+    decoded.proximityValid = deviceStatus & STATUS_PROX_VALID;
+    decoded.alsValid = deviceStatus & STATUS_ALS_VALID;
+#if APDS9960_ENABLE_GESTURE
+    decoded.gestureFifoOverflow = gestureFifoOverflow;
+    decoded.gestureValid = gestureFifoHasData;
+#else
+    decoded.gestureFifoOverflow = false;
+    decoded.gestureValid = false;
+#endif
+    return decoded;
+}
+
+#if APDS9960_ENABLE_PROXIMITY
+void Melopero_APDS9960::setProximityInterruptHandler(APDS9960InterruptHandler handler){
+    proximityInterruptHandler = handler;
+}
+#endif
+
+#if APDS9960_ENABLE_ALS
+void Melopero_APDS9960::setAlsInterruptHandler(APDS9960InterruptHandler handler){
+    alsInterruptHandler = handler;
+}
+#endif
+
+#if APDS9960_ENABLE_GESTURE
+void Melopero_APDS9960::setGestureInterruptHandler(APDS9960InterruptHandler handler){
+    gestureInterruptHandler = handler;
+}
+#endif
+
+int8_t Melopero_APDS9960::serviceInterrupt(){
+    int8_t status = read(STATUS_REG_ADDRESS, &deviceStatus, 1);
+    if (status != NO_ERROR) return status;
+
+#if APDS9960_ENABLE_PROXIMITY
+    bool proximity = (deviceStatus & STATUS_PROX_INTERRUPT) && proximityInterruptHandler != NULL;
+#else
+    bool proximity = false;
+#endif
+#if APDS9960_ENABLE_ALS
+    bool als = (deviceStatus & STATUS_ALS_INTERRUPT) && alsInterruptHandler != NULL;
+#else
+    bool als = false;
+#endif
+    // The saturation flags have no handler of their own: they are cleared with the command of their
+    // engine (PICLEAR also clears PGSAT, CICLEAR also clears CPSAT), otherwise with PSIEN or CPSIEN
+    // set they would hold the pin low forever
+    bool clearProximity = proximity || (deviceStatus & STATUS_PROX_GESTURE_SATURATION);
+    bool clearAls = als || (deviceStatus & STATUS_CLEAR_SATURATION);
+
+    if (proximity || als){
+        // CDATAL ... BDATAH are followed by PDATA: one burst covers the sources that fired
+        uint8_t buffer[9] = {0};
+        uint8_t first = als ? CLEAR_DATA_LOW_BYTE_REG_ADDRESS : PROX_DATA_REG_ADDRESS;
+        uint8_t last = proximity ? PROX_DATA_REG_ADDRESS : BLUE_DATA_HIGH_BYTE_REG_ADDRESS;
+        status = read(first, buffer, last - first + 1);
+        if (status != NO_ERROR) return status;
+
+#if APDS9960_ENABLE_ALS
+        if (als){
+            clear = ((uint16_t) buffer[1]) << 8 | (uint16_t) buffer[0];
+            red = ((uint16_t) buffer[3]) << 8 | (uint16_t) buffer[2];
+            green = ((uint16_t) buffer[5]) << 8 | (uint16_t) buffer[4];
+            blue = ((uint16_t) buffer[7]) << 8 | (uint16_t) buffer[6];
+        }
+#endif
+#if APDS9960_ENABLE_PROXIMITY
+        if (proximity)
+            proximityData = buffer[last - first];
+#endif
+    }
+
+    // Cleared before calling the handlers, so that an interrupt raised meanwhile is not lost
+    if (clearProximity || clearAls){
+        if (clearProximity && clearAls)
+            status = addressAccess(CLEAR_ALL_NON_GEST_INT_REG_ADDRESS);
+        else if (clearProximity)
+            status = addressAccess(PROXIMITY_INT_CLEAR_REG_ADDRESS);
+        else 
+            status = addressAccess(ALS_INT_CLEAR_REG_ADDRESS);
+        if (status != NO_ERROR) return status;
+    }
+
+    if (proximity || als){
+#if APDS9960_ENABLE_PROXIMITY
+        if (proximity) proximityInterruptHandler(*this);
+#endif
+#if APDS9960_ENABLE_ALS
+        if (als) alsInterruptHandler(*this);
+#endif
+    }
+
+#if APDS9960_ENABLE_GESTURE
+    if ((deviceStatus & STATUS_GESTURE_INTERRUPT) && gestureInterruptHandler != NULL){
+        // Draining the FIFO is what clears GINT
+        if (gestureRingBuffer != NULL){
+            status = serviceGestureFifo();
+            if (status != NO_ERROR) return status;
+        }
+        gestureInterruptHandler(*this);
+    }
+#endif
+    return NO_ERROR;
+}
+
+#if APDS9960_ENABLE_PROXIMITY
 // =========================================================================
 //     Proximity Engine Methods
 // =========================================================================
 
 int8_t Melopero_APDS9960::enableProximityEngine(bool enable){
-    return andOrRegister(ENABLE_REG_ADDRESS, (enable << 2) | 0xFB, enable << 2);
+    return setField<APDS9960Field::ProximityEnable>(enable);
 }
 
 int8_t Melopero_APDS9960::enableProximityInterrupts(bool enable){
-    return andOrRegister(ENABLE_REG_ADDRESS, (enable << 5) | 0xDF, enable << 5);
+    return setField<APDS9960Field::ProximityInterruptEnable>(enable);
 }
 
 int8_t Melopero_APDS9960::enableProximitySaturationInterrupts(bool enable){
-    return andOrRegister(CONFIG_2_REG_ADDRESS, (enable << 7) | 0x7F, enable << 7);
+    return setField<APDS9960Field::ProximitySaturationInterruptEnable>(enable);
 }
 
 // Interrupts are cleared by “address accessing” the appropriate register. This is special I2C transaction
@@ -157,10 +936,7 @@ int8_t Melopero_APDS9960::clearProximityInterrupts(){
 }
 
 int8_t Melopero_APDS9960::setProximityGain(uint8_t proxGain){
-    if (!(PROXIMITY_GAIN_1X <= proxGain && proxGain <= PROXIMITY_GAIN_8X))
-        return INVALID_ARGUMENT;
-
-    return andOrRegister(CONTROL_1_REG_ADDRESS, (proxGain << 2) | 0xF3, proxGain << 2);
+    return setField<APDS9960Field::ProximityGain>(proxGain);
 }
 
 int8_t Melopero_APDS9960::setProximityInterruptThresholds(uint8_t lowThr, uint8_t highThr){
@@ -172,20 +948,15 @@ int8_t Melopero_APDS9960::setProximityInterruptThresholds(uint8_t lowThr, uint8_
 }
 
 int8_t Melopero_APDS9960::setProximityInterruptPersistence(uint8_t persistence){
-    if (!(0 <= persistence && persistence <= 15))
-        return INVALID_ARGUMENT;
-
-    return andOrRegister(INTERRUPT_PERSISTANCE_REG_ADDRESS, (persistence << 4) | 0x0F, persistence << 4);
+    return setField<APDS9960Field::ProximityPersistence>(persistence);
 }
 
 int8_t Melopero_APDS9960::setProximityPulseCountAndLength(uint8_t pulseCount, uint8_t pulseLength){
-    if (!(1 <= pulseCount && pulseCount <= 64))
+    using namespace APDS9960Field;
+    if (!(1 <= pulseCount && ProximityPulseCount::fits(pulseCount - 1) && ProximityPulseLength::fits(pulseLength)))
         return INVALID_ARGUMENT;
-    if (!(PULSE_LEN_4_MICROS <= pulseLength && pulseLength <= PULSE_LEN_32_MICROS))
-        return INVALID_ARGUMENT;       
 
-    uint8_t regValue = pulseLength << 6;
-    regValue |= pulseCount - 1;
+    uint8_t regValue = ProximityPulseLength::encode(pulseLength) | ProximityPulseCount::encode(pulseCount - 1);
     return write(PROX_PULSE_COUNT_REG_ADDRESS, &regValue, 1);
 }
 
@@ -201,30 +972,34 @@ int8_t Melopero_APDS9960::setProximityOffset(int8_t upRightOffset, int8_t downLe
 }
 
 int8_t Melopero_APDS9960::disablePhotodiodes(bool mask_up, bool mask_down, bool mask_left, bool mask_right, bool proximity_gain_compensation){
-    uint8_t and_flag = 0xD0 | (proximity_gain_compensation << 5) | (mask_up << 3) | (mask_down << 2) | (mask_left << 1) | ((uint8_t) mask_right);
-    uint8_t or_flag = (proximity_gain_compensation << 5) | (mask_up << 3) | (mask_down << 2) | (mask_left << 1) | ((uint8_t) mask_right);
-
-    return andOrRegister(CONFIG_3_REG_ADDRESS, and_flag, or_flag);
+    using namespace APDS9960Field;
+    uint8_t mask = (mask_up << 3) | (mask_down << 2) | (mask_left << 1) | ((uint8_t) mask_right);
+    uint8_t or_flag = ProximityGainCompensation::encode(proximity_gain_compensation) | ProximityMask::encode(mask);
+    return andOrRegister(CONFIG_3_REG_ADDRESS, (uint8_t) ~(ProximityGainCompensation::mask | ProximityMask::mask), or_flag);
 }
 
 int8_t Melopero_APDS9960::updateProximityData(){
+    waitUntilReady();
     return read(PROX_DATA_REG_ADDRESS, &proximityData, 1);
 }
 
+#endif // APDS9960_ENABLE_PROXIMITY
+
+#if APDS9960_ENABLE_ALS
 // =========================================================================
 //     ALS Engine Methods
 // =========================================================================
 
 int8_t Melopero_APDS9960::enableAlsEngine(bool enable){
-    return andOrRegister(ENABLE_REG_ADDRESS, (enable << 1) | 0xFD, enable << 1);
+    return setField<APDS9960Field::AlsEnable>(enable);
 }
 
 int8_t Melopero_APDS9960::enableAlsInterrupts(bool enable){
-    return andOrRegister(ENABLE_REG_ADDRESS, (enable << 4) | 0xEF, enable << 4);
+    return setField<APDS9960Field::AlsInterruptEnable>(enable);
 }
 
 int8_t Melopero_APDS9960::enableAlsSaturationInterrupts(bool enable){
-    return andOrRegister(CONFIG_2_REG_ADDRESS, (enable << 6) | 0xBF, enable << 6);
+    return setField<APDS9960Field::AlsSaturationInterruptEnable>(enable);
 }
 
 // Interrupts are cleared by “address accessing” the appropriate register. This is special I2C transaction
@@ -234,10 +1009,10 @@ int8_t Melopero_APDS9960::clearAlsInterrupts(){
 }
 
 int8_t Melopero_APDS9960::setAlsGain(uint8_t als_gain){
-    if (!(ALS_GAIN_1X <= als_gain && als_gain <= ALS_GAIN_64X))
-        return INVALID_ARGUMENT;
-    
-    return andOrRegister(CONTROL_1_REG_ADDRESS, (als_gain) | 0xFC, als_gain);
+    int8_t status = setField<APDS9960Field::AlsGain>(als_gain);
+    if (status != NO_ERROR) return status;
+    updateAlsScale(als_gain, alsIntegrationCycles);
+    return NO_ERROR;
 }
 
 int8_t Melopero_APDS9960::setAlsThresholds(uint16_t low_thr, uint16_t high_thr){
@@ -250,18 +1025,37 @@ int8_t Melopero_APDS9960::setAlsThresholds(uint16_t low_thr, uint16_t high_thr){
 }
 
 int8_t Melopero_APDS9960::setAlsInterruptPersistence(uint8_t persistence){
-    if (persistence > 15)
-        return INVALID_ARGUMENT;
-    
-    return andOrRegister(INTERRUPT_PERSISTANCE_REG_ADDRESS, persistence | 0xF0, persistence);
+    return setField<APDS9960Field::AlsPersistence>(persistence);
 }
 
 int8_t Melopero_APDS9960::setAlsIntegrationTime(float wtime){
     if (!(2.78f <= wtime && wtime <= 712.0f))
         return INVALID_ARGUMENT;
 
-    uint8_t value = 256 - (int)(wtime / 2.78f);
-    return write(ALS_ATIME_REG_ADDRESS, &value, 1);
+    // Only a float multiplication, the division by the cycle length is an integer one
+    return setAlsIntegrationCycles((uint32_t) (wtime * 1000.0f + 0.5f) / APDS9960Time::CYCLE_MICROS);
+}
+
+int8_t Melopero_APDS9960::setAlsIntegrationMicros(uint32_t micros){
+    uint32_t cycles = APDS9960Time::roundedCycles(micros);
+    if (!APDS9960Time::fits(cycles))
+        return INVALID_ARGUMENT;
+    return setAlsIntegrationCycles(cycles);
+}
+
+uint32_t Melopero_APDS9960::getAlsIntegrationMicros(){
+    return APDS9960Time::microsFromCycles(alsIntegrationCycles);
+}
+
+int8_t Melopero_APDS9960::setAlsIntegrationCycles(uint16_t cycles){
+    if (!APDS9960Time::fits(cycles))
+        return INVALID_ARGUMENT;
+
+    uint8_t value = APDS9960Time::registerFromCycles(cycles);
+    int8_t status = write(ALS_ATIME_REG_ADDRESS, &value, 1);
+    if (status != NO_ERROR) return status;
+    updateAlsScale(alsGainSetting, cycles);
+    return NO_ERROR;
 }
 
 int8_t Melopero_APDS9960::updateSaturation(){ 
@@ -269,12 +1063,12 @@ int8_t Melopero_APDS9960::updateSaturation(){
         int8_t status = read(ALS_ATIME_REG_ADDRESS, &reg_value, 1);
         if (status != NO_ERROR) return status;
 
-        int cycles = (256 - reg_value) * 1025;
-        alsSaturation = cycles < 65535 ? cycles : 65535;
+        updateAlsScale(alsGainSetting, APDS9960Time::cyclesFromRegister(reg_value));
         return NO_ERROR;
 }
 
 int8_t Melopero_APDS9960::updateColorData(){
+    waitUntilReady();
     uint8_t color_buffer[8] = {0};
     int8_t status = read(CLEAR_DATA_LOW_BYTE_REG_ADDRESS, color_buffer, 8);
     if (status != NO_ERROR) return status;
@@ -283,25 +1077,115 @@ int8_t Melopero_APDS9960::updateColorData(){
     red = ((uint16_t) color_buffer[3]) << 8 | (uint16_t) color_buffer[2];
     green = ((uint16_t) color_buffer[5]) << 8 | (uint16_t) color_buffer[4];
     blue = ((uint16_t) color_buffer[7]) << 8 | (uint16_t) color_buffer[6];
+
+    if (alsAutoRange)
+        return autoRangeAls();
+    return NO_ERROR;
+}
+
+void Melopero_APDS9960::updateAlsScale(uint8_t gain, uint16_t cycles){
+    alsGainSetting = gain;
+    alsGainMultiplier = 1 << (2 * gain); // 1x, 4x, 16x, 64x
+    alsIntegrationCycles = cycles;
+    alsScale = (uint32_t) alsGainMultiplier * cycles;
+    uint32_t saturation = (uint32_t) cycles * 1025;
+    alsSaturation = saturation < 65535 ? saturation : 65535;
+}
+
+int8_t Melopero_APDS9960::enableAlsAutoRange(bool enable, uint16_t maxIntegrationCycles, uint16_t minIntegrationCycles){
+    if (!(1 <= minIntegrationCycles && minIntegrationCycles <= maxIntegrationCycles && maxIntegrationCycles <= 256))
+        return INVALID_ARGUMENT;
+
+    alsAutoRange = false;
+    alsAutoRangeSettling = false;
+    if (!enable)
+        return NO_ERROR;
+
+    // Start from the settings the device is using
+    uint8_t gain = 0;
+    int8_t status = getField<APDS9960Field::AlsGain>(gain);
+    if (status != NO_ERROR) return status;
+    alsGainSetting = gain;
+    status = updateSaturation();
+    if (status != NO_ERROR) return status;
+
+    alsMinCycles = minIntegrationCycles;
+    alsMaxCycles = maxIntegrationCycles;
+    alsAutoRange = true;
     return NO_ERROR;
 }
 
+int8_t Melopero_APDS9960::autoRangeAls(){
+    uint32_t now = millis();
+    if (alsAutoRangeSettling){
+        if ((int32_t) (now - alsSettleDeadlineMillis) < 0)
+            return NO_ERROR;
+        alsAutoRangeSettling = false;
+        alsScale = (uint32_t) alsGainMultiplier * alsIntegrationCycles;
+    }
+
+    uint32_t saturation = alsSaturation;
+    if (saturation * ALS_AUTO_RANGE_LOW_PERCENT <= (uint32_t) clear * 100 
+            && (uint32_t) clear * 100 <= saturation * ALS_AUTO_RANGE_HIGH_PERCENT)
+        return NO_ERROR;
+
+    // Light level in 1/16 counts per integration cycle at 1x
+    uint32_t rate = ((uint32_t) clear << 4) / alsScale;
+    if ((uint32_t) clear * 100 >= saturation * 98)
+        rate *= 4; // saturated: the real level is unknown, step down at least 4x
+    if (rate == 0)
+        rate = 1;
+
+    // The highest gain that keeps the counts of a cycle (at most 1025) near the target...
+    uint8_t gain = ALS_GAIN_64X;
+    while (gain > ALS_GAIN_1X && rate * (1UL << (2 * gain)) * 100 > (1025UL << 4) * ALS_AUTO_RANGE_TARGET_PERCENT)
+        gain--;
+    // ... then the longest integration time that keeps the total counts (at most 65535) near the target
+    uint32_t cycles = (65535UL << 4) * ALS_AUTO_RANGE_TARGET_PERCENT / 100 / (rate * (1UL << (2 * gain)));
+    if (cycles > alsMaxCycles) cycles = alsMaxCycles;
+    if (cycles < alsMinCycles) cycles = alsMinCycles;
+
+    if (gain == alsGainSetting && cycles == alsIntegrationCycles)
+        return NO_ERROR; // already the best range for this light level
+
+    // The reading in progress still uses the old settings: the new ones are effective after it and a full new integration
+    uint32_t settleMillis = APDS9960Time::microsFromCycles(alsIntegrationCycles + cycles) / 1000 + 2;
+    uint16_t previousCycles = alsIntegrationCycles;
+    uint8_t previousGain = alsGainSetting;
+    uint8_t atime = APDS9960Time::registerFromCycles(cycles);
+    int8_t status = setField<APDS9960Field::AlsGain>(gain);
+    if (status == NO_ERROR)
+        status = write(ALS_ATIME_REG_ADDRESS, &atime, 1);
+    if (status != NO_ERROR) return status;
+
+    // alsScale keeps describing the readings taken with the old settings until the new ones settle
+    updateAlsScale(gain, cycles);
+    alsScale = (uint32_t) (1 << (2 * previousGain)) * previousCycles;
+    alsAutoRangeSettling = true;
+    alsSettleDeadlineMillis = now + settleMillis;
+    return NO_ERROR;
+}
+
+#endif // APDS9960_ENABLE_ALS
+
+#if APDS9960_ENABLE_GESTURE
 // =========================================================================
 //     Gestures Engine Methods
 // =========================================================================
 
 int8_t Melopero_APDS9960::enableGesturesEngine(bool enable){
-    int8_t status = enableProximityEngine();
+    // The gesture engine needs the proximity one, also in the builds without its methods
+    int8_t status = setField<APDS9960Field::ProximityEnable>(true);
     if (status != NO_ERROR) return status;
-    return andOrRegister(ENABLE_REG_ADDRESS, (enable << 6) | 0xBF, enable << 6);
+    return setField<APDS9960Field::GestureEnable>(enable);
 }
 
 int8_t Melopero_APDS9960::enterImmediatelyGestureEngine(){
-    return andOrRegister(GESTURE_CONFIG_4_REG_ADDRESS, 0xFF, 1);
+    return setField<APDS9960Field::GestureMode>(1);
 }
 
 int8_t Melopero_APDS9960::exitGestureEngine(){
-    return andOrRegister(GESTURE_CONFIG_4_REG_ADDRESS, 0xFE, 0);
+    return setField<APDS9960Field::GestureMode>(0);
 }
 
 int8_t Melopero_APDS9960::setGestureProxEnterThreshold(uint8_t enter_thr){
@@ -313,85 +1197,76 @@ int8_t Melopero_APDS9960::setGestureExitThreshold(uint8_t exit_thr){
 }
 
 int8_t Melopero_APDS9960::setGestureExitMask(bool mask_up, bool mask_down, bool mask_left, bool mask_right){
-    uint8_t flag = (mask_up << 5) | (mask_down << 4) | (mask_left << 3) | (mask_right << 2);
-    return andOrRegister(GESTURE_CONFIG_1_REG_ADDRESS, flag | 0xC3, flag);
+    uint8_t mask = (mask_up << 3) | (mask_down << 2) | (mask_left << 1) | ((uint8_t) mask_right);
+    return setField<APDS9960Field::GestureExitMask>(mask);
 }
 
 int8_t Melopero_APDS9960::setGestureExitPersistence(uint8_t persistence){
-    if (!(EXIT_AFTER_1_GESTURE_END <= persistence && persistence <= EXIT_AFTER_7_GESTURE_END))
-        return INVALID_ARGUMENT;
-    
-    return andOrRegister(GESTURE_CONFIG_1_REG_ADDRESS, (persistence) | 0xFC, persistence);
+    return setField<APDS9960Field::GestureExitPersistence>(persistence);
 }
 
 int8_t Melopero_APDS9960::setGestureGain(uint8_t gesture_gain){
-    if (!(PROXIMITY_GAIN_1X <= gesture_gain && gesture_gain <= PROXIMITY_GAIN_8X))
-        return INVALID_ARGUMENT;
-
-    return andOrRegister(GESTURE_CONFIG_2_REG_ADDRESS, (gesture_gain << 5) | 0x9F, gesture_gain << 5);
+    return setField<APDS9960Field::GestureGain>(gesture_gain);
 }
 
 int8_t Melopero_APDS9960::setGestureLedDrive(uint8_t led_drive){
-    if (!(LED_DRIVE_100_mA <= led_drive && led_drive <= LED_DRIVE_12_5_mA))
-        return INVALID_ARGUMENT;
-    
-    return andOrRegister(GESTURE_CONFIG_2_REG_ADDRESS, (led_drive << 3) | 0x7E, led_drive << 3);
+    return setField<APDS9960Field::GestureLedDrive>(led_drive);
 }
 
 int8_t Melopero_APDS9960::setGestureWaitTime(uint8_t wait_time){
-    if (!(GESTURE_WAIT_0_MILLIS <= wait_time && wait_time <= GESTURE_WAIT_39_2_MILLIS))
-        return INVALID_ARGUMENT;
-
-    return andOrRegister(GESTURE_CONFIG_2_REG_ADDRESS, wait_time | 0xF8, wait_time);
+    return setField<APDS9960Field::GestureWaitTime>(wait_time);
 }
 
 int8_t Melopero_APDS9960::setGestureOffsets(int8_t up_offset, int8_t down_offset, int8_t left_offset, int8_t right_offset){
-    uint8_t offsets[4] = {0};
-    offsets[0] = up_offset < 0 ? 0x80 | ((uint8_t) -up_offset) : up_offset;
-    offsets[1] = down_offset < 0 ? 0x80 | ((uint8_t) -down_offset) : down_offset;
-    offsets[2] = left_offset < 0 ? 0x80 | ((uint8_t) -left_offset) : left_offset;
-    offsets[3] = right_offset < 0 ? 0x80 | ((uint8_t) -right_offset) : right_offset;
-
-    return write(GESTURE_OFFSET_UP_REG_ADDRESSES, offsets, 4);
+    // The offset registers are not contiguous (0xA6 holds the pulse settings and 0xA8 is reserved),
+    // when the pulse register is cached it is rewritten with its current value to save a transaction.
+    uint8_t image[SHADOW_REGISTERS_COUNT];
+    image[SHADOW_GESTURE_OFFSET_UP_INDEX] = signMagnitude(up_offset);
+    image[SHADOW_GESTURE_OFFSET_DOWN_INDEX] = signMagnitude(down_offset);
+    image[SHADOW_GESTURE_PULSE_INDEX] = shadowRegisters[SHADOW_GESTURE_PULSE_INDEX];
+    image[SHADOW_GESTURE_OFFSET_LEFT_INDEX] = signMagnitude(left_offset);
+    image[SHADOW_GESTURE_OFFSET_RIGHT_INDEX] = signMagnitude(right_offset);
+
+    uint32_t dirty = (1UL << SHADOW_GESTURE_OFFSET_UP_INDEX) | (1UL << SHADOW_GESTURE_OFFSET_DOWN_INDEX) 
+        | (1UL << SHADOW_GESTURE_OFFSET_LEFT_INDEX) | (1UL << SHADOW_GESTURE_OFFSET_RIGHT_INDEX);
+    uint32_t known = dirty;
+    if (shadowEnabled)
+        known |= shadowValid & (1UL << SHADOW_GESTURE_PULSE_INDEX);
+
+    return writeRegisterImage(image, dirty, known);
 }
 
 int8_t Melopero_APDS9960::setGesturePulseCountAndLength(uint8_t pulse_count, uint8_t pulse_length){
-    if (!(1 <= pulse_count && pulse_count <= 64))
-        return INVALID_ARGUMENT;
-    if (!(PULSE_LEN_4_MICROS <= pulse_length && pulse_length <= PULSE_LEN_32_MICROS))
+    using namespace APDS9960Field;
+    if (!(1 <= pulse_count && GesturePulseCount::fits(pulse_count - 1) && GesturePulseLength::fits(pulse_length)))
         return INVALID_ARGUMENT;
 
-    uint8_t reg_value = (pulse_count - 1) | (pulse_length << 6);
+    uint8_t reg_value = GesturePulseLength::encode(pulse_length) | GesturePulseCount::encode(pulse_count - 1);
     return write(GESTURE_PULSE_COUNT_AND_LEN_REG_ADDRESS, &reg_value, 1);
 }
 
 int8_t Melopero_APDS9960::setActivePhotodiodesPairs(bool up_down_active, bool right_left_active){
-    uint8_t flag = (right_left_active << 1 | (uint8_t) up_down_active);
-    return andOrRegister(GESTURE_CONFIG_3_REG_ADDRESS, flag | 0xFC, flag);
+    return setField<APDS9960Field::GestureDimensions>((right_left_active << 1) | (uint8_t) up_down_active);
 }
 
 int8_t Melopero_APDS9960::enableGestureInterrupts(bool enable_interrupts){
-    return andOrRegister(GESTURE_CONFIG_4_REG_ADDRESS, (enable_interrupts << 1) | 0xFD, enable_interrupts << 1);
+    return setField<APDS9960Field::GestureInterruptEnable>(enable_interrupts);
 }
 
 int8_t Melopero_APDS9960::setGestureFifoThreshold(uint8_t fifo_thr){
-    if (!(FIFO_INT_AFTER_1_DATASET <= fifo_thr && fifo_thr <= FIFO_INT_AFTER_16_DATASETS))
-        return INVALID_ARGUMENT;
-
-    return andOrRegister(GESTURE_CONFIG_1_REG_ADDRESS, (fifo_thr << 6) | 0x3F, fifo_thr << 6);
+    return setField<APDS9960Field::GestureFifoThreshold>(fifo_thr);
 }
 
 int8_t Melopero_APDS9960::resetGestureEngineInterruptSettings(){
-    uint8_t flag = (1 << 2);
-    return andOrRegister(GESTURE_CONFIG_4_REG_ADDRESS, flag | 0xFB, flag);
+    return setField<APDS9960Field::GestureFifoClear>(1);
 }
 
 int8_t Melopero_APDS9960::checkGestureEngineRunning(){
-    uint8_t reg_value = 0;
-    int8_t status = read(GESTURE_CONFIG_4_REG_ADDRESS, &reg_value, 1);
+    uint8_t gestureMode = 0;
+    int8_t status = getField<APDS9960Field::GestureMode>(gestureMode);
     if (status != NO_ERROR) return status;
 
-    gestureEngineRunning = (bool) reg_value & 0x01;
+    gestureEngineRunning = gestureMode != 0;
     return NO_ERROR;
 }
 
@@ -404,232 +1279,517 @@ int8_t Melopero_APDS9960::updateGestureStatus(){
     int8_t status = read(GESTURE_STATUS_REG_ADDRESS, &reg_value, 1);
     if (status != NO_ERROR) return status;
 
-    gestureFifoOverflow = (bool) (reg_value & 0x02);
-    gestureFifoHasData = (bool) (reg_value & 0x01);
+    gestureFifoOverflow = APDS9960Field::GestureFifoOverflow::decode(reg_value);
+    gestureFifoHasData = APDS9960Field::GestureValid::decode(reg_value);
     return NO_ERROR;
 }
 
 int8_t Melopero_APDS9960::updateGestureData(){
+    waitUntilReady();
     return read(GESTURE_FIFO_UP_REG_ADDRESS, gestureData, 4);       
 }
 
-int8_t Melopero_APDS9960::parseGestureInFifo(uint8_t tolerance, uint8_t der_tolerance, uint8_t confidence){
-    // Detecting method:
-    // 1) identify instants where difference between values on same axis is greater than tolerance
-    // 2) identify instants where both curves are raising or falling 
-    // 2.1) the curves must be both raising or both falling at the same instants   
-    // 3) In those instants which value is greater ? 
-    // 3.1) if up[i] > down[i] 
-    //          if dup > 0 and ddown > 0 (curves are raising):
-    //              up_count++; 
-    //          else if dup < 0 and ddown < 0 (curves are falling):
-    //              down_count++ 
-    // 4) After having processed all datasets in the fifo see if there is enough "confidence" to tell a gesture has been detected
-    //      if up_count > down_count + confidence: 
-    //          gesture = UP_GESTURE
-    //      else if down_count > up_count + confidence:
-    //          gesture = DOWN_GESTURE
-    //      else 
-    //          gesture = NO_GESTURE
+int8_t Melopero_APDS9960::drainGestureFifo(uint8_t* buffer, uint8_t maxDatasets){
+    if (!(1 <= maxDatasets && maxDatasets <= GESTURE_FIFO_SIZE))
+        return INVALID_ARGUMENT;
+    waitUntilReady();
 
-    int8_t status = NO_ERROR;
-    status = updateNumberOfDatasetsInFifo();
+    datasetsDrained = 0;
+    // GFLVL and GSTATUS are adjacent: read both in the same transaction
+    uint8_t levelAndStatus[2];
+    int8_t status = read(GESTURE_FIFO_LEVEL_REG_ADDRESS, levelAndStatus, 2);
     if (status != NO_ERROR) return status;
 
-    if (datasetsInFifo == 0){
-        parsedUpDownGesture = NO_GESTURE;
-        parsedLeftRightGesture = NO_GESTURE;
-
-        return status;
-    }
+    datasetsInFifo = levelAndStatus[0];
+    gestureFifoOverflow = APDS9960Field::GestureFifoOverflow::decode(levelAndStatus[1]);
+    gestureFifoHasData = APDS9960Field::GestureValid::decode(levelAndStatus[1]);
+    if (gestureFifoOverflow && gestureFifoOverflows != 0xFFFF)
+        gestureFifoOverflows++;
 
-    uint8_t up_count = 0;
-    uint8_t down_count = 0;
-    uint8_t left_count = 0;
-    uint8_t right_count = 0;
+    uint8_t amount = datasetsInFifo < maxDatasets ? datasetsInFifo : maxDatasets;
+    if (amount == 0) return NO_ERROR;
 
-    uint8_t prev_dataset[4];
-    status = updateGestureData();
+    // The FIFO registers are read as a page: the register pointer wraps from the RIGHT 
+    // register back to the UP register, so all datasets come out in one transaction.
+    status = read(GESTURE_FIFO_UP_REG_ADDRESS, buffer, amount * 4);
     if (status != NO_ERROR) return status;
 
-    for (int i = 0; i < 4; i++)
-        prev_dataset[i] = gestureData[i];
+    datasetsDrained = amount;
+    return NO_ERROR;
+}
 
-    for (int i = 1; i < datasetsInFifo; i++){
-        status = updateGestureData();
-        if (status != NO_ERROR) return status;
+void Melopero_APDS9960::attachGestureRingBuffer(GestureRingBuffer* ringBuffer){
+    gestureRingBuffer = ringBuffer;
+}
 
-        int8_t up_der = gestureData[0] - prev_dataset[0]; 
-        int8_t down_der = gestureData[1] - prev_dataset[1]; 
-        int8_t left_der = gestureData[2] - prev_dataset[2]; 
-        int8_t right_der = gestureData[3] - prev_dataset[3];
+void Melopero_APDS9960::notifyGestureInterrupt(){
+    gestureInterruptPending = true;
+}
 
-        int8_t up_down_diff = (int8_t) gestureData[0] - (int8_t) gestureData[1];
+int8_t Melopero_APDS9960::serviceGestureFifo(){
+    if (gestureRingBuffer == NULL)
+        return INVALID_ARGUMENT;
 
-        if ((abs(up_down_diff) > tolerance) && (abs(up_der) > der_tolerance || abs(down_der) > der_tolerance)){
-            if (up_der >= 0 && down_der >= 0){
-                if (gestureData[0] > gestureData[1])
-                    up_count++;
-                else 
-                    down_count++;
-            }
-            else if (up_der <= 0 && down_der <= 0) {
-                if (gestureData[0] < gestureData[1])
-                    up_count++;
-                else 
-                    down_count++;
-            }
-        }
+    // Cleared before reading so that an interrupt arriving during the drain is not lost
+    gestureInterruptPending = false;
 
-        int8_t left_right_diff = (int8_t) gestureData[2] - (int8_t) gestureData[3];
+    uint8_t fifo[GESTURE_FIFO_SIZE * 4];
+    int8_t status = drainGestureFifo(fifo, GESTURE_FIFO_SIZE);
+    if (status != NO_ERROR) return status;
 
-        if ((abs(left_right_diff) > tolerance) && (abs(left_der) > der_tolerance || abs(right_der) > der_tolerance)){
-            if (left_der >= 0 && right_der >= 0){
-                if (gestureData[2] > gestureData[3])
-                    left_count++;
-                else 
-                    right_count++;
-            }
-            else if (left_der <= 0 && right_der <= 0) {
-                if (gestureData[2] < gestureData[3])
-                    left_count++;
-                else 
-                    right_count++;
-            }
-        }
+    // The whole FIFO is always drained to release the INT pin, what doesn't fit is counted as dropped
+    gestureRingBuffer->push(fifo, datasetsDrained);
+    return NO_ERROR;
+}
 
-        for (int i = 0; i < 4; i++)
-            prev_dataset[i] = gestureData[i];
+int8_t Melopero_APDS9960::serviceGestureInterrupt(){
+    if (!gestureInterruptPending)
+        return NO_ERROR;
+    return serviceGestureFifo();
+}
 
-    }
+int8_t Melopero_APDS9960::parseGestureInFifo(uint8_t tolerance, uint8_t der_tolerance, uint8_t confidence){
+    uint8_t fifo[GESTURE_FIFO_SIZE * 4];
+    int8_t status = drainGestureFifo(fifo, GESTURE_FIFO_SIZE);
+    if (status != NO_ERROR) return status;
 
-    if (down_count >= up_count + confidence)
-        parsedUpDownGesture = DOWN_GESTURE;
-    else if (up_count >= down_count + confidence)
-        parsedUpDownGesture = UP_GESTURE;
-    else 
+    GestureClassifier classifier(tolerance, der_tolerance, confidence);
+    if (gestureDecisionLatched){
+        // The gesture was already reported: its datasets are discarded
         parsedUpDownGesture = NO_GESTURE;
-
-    if (right_count >= left_count + confidence)
-        parsedLeftRightGesture = RIGHT_GESTURE;
-    else if (left_count >= right_count + confidence)
-        parsedLeftRightGesture = LEFT_GESTURE;
-    else 
         parsedLeftRightGesture = NO_GESTURE;
-    
-    return status; // should be no error
+        return releaseGestureDecision();
+    }
+    uint32_t firstMotion = firstMotionMicros();
+    if (classifyDatasets(classifier, fifo, datasetsDrained))
+        gestureDecisionLatencyMicros = micros() - firstMotion;
+    if (datasetsDrained > 0)
+        for (int i = 0; i < 4; i++)
+            gestureData[i] = fifo[(datasetsDrained - 1) * 4 + i];
+
+    GestureClassifier::Result result = classifier.result();
+    parsedUpDownGesture = result.upDown;
+    parsedLeftRightGesture = result.leftRight;
+    return NO_ERROR;
+}
+
+int8_t Melopero_APDS9960::recognizeGestureInFifo(GestureRecognizer &recognizer){
+    uint8_t fifo[GESTURE_FIFO_SIZE * 4];
+    int8_t status = drainGestureFifo(fifo, GESTURE_FIFO_SIZE);
+    if (status != NO_ERROR) return status;
+
+    recognizer.push(fifo, datasetsDrained);
+    if (datasetsDrained > 0)
+        for (int i = 0; i < 4; i++)
+            gestureData[i] = fifo[(datasetsDrained - 1) * 4 + i];
+    return NO_ERROR;
 }
 
 int8_t Melopero_APDS9960::parseGesture(uint16_t parse_millis, uint8_t tolerance, uint8_t der_tolerance, uint16_t confidence){
     // Detecting method:
-    // same as parseGestureInFifo(...) see comments there.
-    int start_millis = millis();
-    int8_t status = NO_ERROR;
+    // see GestureClassifier.
+    int8_t status = beginGestureParse(parse_millis, tolerance, der_tolerance, confidence);
+    while (status == NO_ERROR && !gestureParseDone){
+        status = pollGestureParse();
+        // Wait for the next poll instead of spinning on millis()
+        if (status == NO_ERROR && !gestureParseDone && (int32_t) (parseNextPollMillis - millis()) > 0)
+            delay(1);
+    }
 
-    uint32_t up_count = 0;
-    uint32_t down_count = 0;
-    uint32_t left_count = 0;
-    uint32_t right_count = 0;
+    gestureParseRunning = false;
+    return status;
+}
 
-    uint8_t prev_dataset[4];
-    bool first_iteration = true;
+int8_t Melopero_APDS9960::beginGestureParse(uint16_t parse_millis, uint8_t tolerance, uint8_t der_tolerance, uint16_t confidence){
+    parseStartMillis = millis();
+    parseNextPollMillis = parseStartMillis;
+    parseWindowMillis = parse_millis;
+    parseClassifier.configure(tolerance, der_tolerance, confidence);
+    parseClassifier.reset();
+    parseMotionSeen = false;
 
-    while (start_millis + parse_millis > millis()){
-        status = updateNumberOfDatasetsInFifo();
-        if (status != NO_ERROR) return status;
-        if (datasetsInFifo > 0){
-            if (first_iteration){
-                first_iteration = false;
-                status = updateGestureData();
-                if (status != NO_ERROR) return status;
-
-                for (int i = 0; i < 4; i++)
-                    prev_dataset[i] = gestureData[i];
-            }
-            else {
-                for (int i = 0; i < datasetsInFifo; i++){
-                    status = updateGestureData();
-                    if (status != NO_ERROR) return status;
-
-                    int8_t up_der = gestureData[0] - prev_dataset[0]; 
-                    int8_t down_der = gestureData[1] - prev_dataset[1]; 
-                    int8_t left_der = gestureData[2] - prev_dataset[2]; 
-                    int8_t right_der = gestureData[3] - prev_dataset[3];
-
-                    int8_t up_down_diff = (int8_t) gestureData[0] - (int8_t) gestureData[1];
-
-                    if ((abs(up_down_diff) > tolerance) && (abs(up_der) > der_tolerance || abs(down_der) > der_tolerance)){
-                        if (up_der >= 0 && down_der >= 0){
-                            if (gestureData[0] > gestureData[1])
-                                up_count++;
-                            else 
-                                down_count++;
-                        }
-                        else if (up_der <= 0 && down_der <= 0) {
-                            if (gestureData[0] < gestureData[1])
-                                up_count++;
-                            else 
-                                down_count++;
-                        }
-                    }
-
-                    int8_t left_right_diff = (int8_t) gestureData[2] - (int8_t) gestureData[3];
-
-                    if ((abs(left_right_diff) > tolerance) && (abs(left_der) > der_tolerance || abs(right_der) > der_tolerance)){
-                        if (left_der >= 0 && right_der >= 0){
-                            if (gestureData[2] > gestureData[3])
-                                left_count++;
-                            else 
-                                right_count++;
-                        }
-                        else if (left_der <= 0 && right_der <= 0) {
-                            if (gestureData[2] < gestureData[3])
-                                left_count++;
-                            else 
-                                right_count++;
-                        }
-                    }
-
-                    for (int i = 0; i < 4; i++)
-                        prev_dataset[i] = gestureData[i];
-                }
-            }
+    gestureParseDone = false;
+    gestureParseRunning = true;
+    return NO_ERROR;
+}
+
+int8_t Melopero_APDS9960::pollGestureParse(){
+    if (!gestureParseRunning)
+        return NO_ERROR;
+
+    uint32_t now = millis();
+    if (now - parseStartMillis >= parseWindowMillis){
+        // The parsing window is over
+        finishGestureParse();
+        return NO_ERROR;
+    }
+
+    // Don't flood the bus with FIFO level reads while there is nothing to parse
+    if ((int32_t) (now - parseNextPollMillis) < 0)
+        return NO_ERROR;
+
+    uint8_t fifo[GESTURE_FIFO_SIZE * 4];
+    int8_t status = drainGestureFifo(fifo, GESTURE_FIFO_SIZE);
+    if (status != NO_ERROR){
+        gestureParseRunning = false;
+        return status;
+    }
+    if (gestureDecisionLatched){
+        // The gesture was already reported: its datasets are discarded until the engine exits
+        if (datasetsDrained == 0)
+            parseNextPollMillis = now + gestureParsePollInterval;
+        status = releaseGestureDecision();
+        if (status != NO_ERROR){
+            gestureParseRunning = false;
+            return status;
+        }
+        if (!gestureDecisionLatched)
+            parseStartMillis = now; // the window starts with the next gesture
+        return NO_ERROR;
+    }
+    if (datasetsDrained == 0){
+        parseNextPollMillis = now + gestureParsePollInterval;
+        return NO_ERROR;
+    }
+
+    if (!parseMotionSeen){
+        parseMotionSeen = true;
+        parseFirstMotionMicros = firstMotionMicros();
+    }
+    bool decided = classifyDatasets(parseClassifier, fifo, datasetsDrained);
+    for (int i = 0; i < 4; i++)
+        gestureData[i] = fifo[(datasetsDrained - 1) * 4 + i];
+    if (decided){
+        gestureDecisionLatencyMicros = micros() - parseFirstMotionMicros;
+        finishGestureParse();
+    }
+    return NO_ERROR;
+}
+
+void Melopero_APDS9960::finishGestureParse(){
+    GestureClassifier::Result result = parseClassifier.result();
+    parsedUpDownGesture = result.upDown;
+    parsedLeftRightGesture = result.leftRight;
+
+    gestureParseRunning = false;
+    gestureParseDone = true;
+    if (gestureParseCallback != NULL)
+        gestureParseCallback(parsedUpDownGesture, parsedLeftRightGesture);
+}
+
+bool Melopero_APDS9960::classifyDatasets(GestureClassifier &classifier, const uint8_t* datasets, uint8_t count){
+    if (!gestureEarlyDecision){
+        classifier.push(datasets, count);
+        return false;
+    }
+
+    // Early decision: the margin is checked after every dataset, the rest of the gesture is not needed
+    for (uint8_t i = 0; i < count; i++){
+        classifier.push(datasets + i * 4);
+        GestureClassifier::Result result = classifier.result();
+        if (result.upDown != NO_GESTURE || result.leftRight != NO_GESTURE){
+            gestureDecisionLatched = true;
+            gestureDecisionDatasets = classifier.datasets;
+            return true;
         }
     }
+    return false;
+}
 
-    if (down_count >= up_count + confidence)
-        parsedUpDownGesture = DOWN_GESTURE;
-    else if (up_count >= down_count + confidence)
-        parsedUpDownGesture = UP_GESTURE;
-    else 
-        parsedUpDownGesture = NO_GESTURE;
+uint32_t Melopero_APDS9960::firstMotionMicros(){
+    // The datasets of the last drain were produced one period apart, the last one just before the drain
+    if (datasetsDrained == 0)
+        return micros();
+    return micros() - (uint32_t) (datasetsDrained - 1) * gestureDatasetPeriodMicros();
+}
 
-    if (right_count >= left_count + confidence)
-        parsedLeftRightGesture = RIGHT_GESTURE;
-    else if (left_count >= right_count + confidence)
-        parsedLeftRightGesture = LEFT_GESTURE;
-    else 
-        parsedLeftRightGesture = NO_GESTURE;
-    
-    return status; // should be no error
+uint32_t Melopero_APDS9960::gestureDatasetPeriodMicros() const {
+    if (gestureDatasetMicros != 0)
+        return gestureDatasetMicros;
+    using namespace APDS9960Field;
+    uint8_t dimensions = GestureDimensions::decode(gestureConfig3);
+    return APDS9960Time::gestureDatasetMicros(GesturePulseCount::decode(gesturePulse) + 1, GesturePulseLength::decode(gesturePulse),
+        GestureWaitTime::decode(gestureConfig2), dimensions & 0x01, (dimensions & 0x02) != 0);
+}
+
+void Melopero_APDS9960::trackGestureTiming(uint8_t registerAddress, const uint8_t* values, uint8_t len){
+    if (registerAddress > GESTURE_CONFIG_3_REG_ADDRESS || registerAddress + len <= GESTURE_CONFIG_2_REG_ADDRESS)
+        return;
+    for (uint8_t i = 0; i < len; i++){
+        uint8_t address = registerAddress + i;
+        if (address == GESTURE_CONFIG_2_REG_ADDRESS)
+            gestureConfig2 = values[i];
+        else if (address == GESTURE_PULSE_COUNT_AND_LEN_REG_ADDRESS)
+            gesturePulse = values[i];
+        else if (address == GESTURE_CONFIG_3_REG_ADDRESS)
+            gestureConfig3 = values[i];
+    }
 }
 
+int8_t Melopero_APDS9960::releaseGestureDecision(){
+    // Datasets still coming belong to the reported gesture: only an empty FIFO can mean it is over
+    if (datasetsDrained != 0)
+        return NO_ERROR;
+    int8_t status = checkGestureEngineRunning();
+    if (status != NO_ERROR) return status;
+    if (!gestureEngineRunning)
+        gestureDecisionLatched = false;
+    return NO_ERROR;
+}
+
+void Melopero_APDS9960::setGestureEarlyDecision(bool enable){
+    gestureEarlyDecision = enable;
+    gestureDecisionLatched = false;
+}
+
+void Melopero_APDS9960::setGestureParseCallback(APDS9960GestureCallback callback){
+    gestureParseCallback = callback;
+}
+
+#endif // APDS9960_ENABLE_GESTURE
+
 // =========================================================================
 //     Wait Engine Methods
 // =========================================================================
 
 int8_t Melopero_APDS9960::enableWaitEngine(bool enable){
-    return andOrRegister(ENABLE_REG_ADDRESS, (enable << 3) | 0xF7, enable << 3);
+    return setField<APDS9960Field::WaitEnable>(enable);
 }
 
 int8_t Melopero_APDS9960::setWaitTime(float wtime, bool long_wait){
     if (!(2.78f <= wtime && wtime <= 712.0f))
         return INVALID_ARGUMENT;
 
+    // Only a float multiplication, the division by the cycle length is an integer one
+    return setWaitCycles((uint32_t) (wtime * 1000.0f + 0.5f) / APDS9960Time::CYCLE_MICROS, long_wait);
+}
+
+int8_t Melopero_APDS9960::setWaitCycles(uint16_t cycles, bool long_wait){
+    if (!APDS9960Time::fits(cycles))
+        return INVALID_ARGUMENT;
+
     // long_wait
-    int8_t status = andOrRegister(CONFIG_1_REG_ADDRESS, (long_wait << 1) | 0xFD, long_wait << 1);
+    int8_t status = setField<APDS9960Field::WaitLong>(long_wait);
     if (status != NO_ERROR) return status;
     // wtime
-    uint8_t reg_value = 256 - ((int) (wtime / 2.78f));
-    return write(WAIT_TIME_REG_ADDRESS, &reg_value, 1);
-}
\ No newline at end of file
+    uint8_t reg_value = APDS9960Time::registerFromCycles(cycles);
+    status = write(WAIT_TIME_REG_ADDRESS, &reg_value, 1);
+    if (status != NO_ERROR) return status;
+    waitCycles = cycles;
+    longWait = long_wait;
+    return NO_ERROR;
+}
+
+int8_t Melopero_APDS9960::setWaitMicros(uint32_t micros, bool long_wait){
+    uint32_t cycles = APDS9960Time::roundedCycles(micros, long_wait);
+    if (!APDS9960Time::fits(cycles))
+        return INVALID_ARGUMENT;
+    return setWaitCycles(cycles, long_wait);
+}
+
+uint32_t Melopero_APDS9960::getWaitMicros(){
+    return APDS9960Time::microsFromCycles(waitCycles, longWait);
+}
+// =========================================================================
+//     Crosstalk Calibration Methods
+// =========================================================================
+
+static uint8_t calibrationChecksum(const uint8_t* blob){
+    uint8_t sum = 0;
+    for (uint8_t i = 0; i < CALIBRATION_BLOB_SIZE - 1; i++)
+        sum += blob[i];
+    return ~sum;
+}
+
+#if APDS9960_ENABLE_PROXIMITY
+int8_t Melopero_APDS9960::measureProximityBaseline(uint8_t samples, uint8_t &baseline){
+    uint16_t sum = 0;
+    for (uint8_t i = 0; i < samples; i++){
+        delay(CALIBRATION_SETTLE_MILLIS);
+        uint8_t value = 0;
+        int8_t status = read(PROX_DATA_REG_ADDRESS, &value, 1);
+        if (status != NO_ERROR) return status;
+        sum += value;
+    }
+    baseline = sum / samples;
+    return NO_ERROR;
+}
+#endif
+
+#if APDS9960_ENABLE_GESTURE
+int8_t Melopero_APDS9960::measureGestureBaseline(uint8_t samples, uint8_t baseline[4]){
+    // The datasets measured with the previous offsets are thrown away
+    int8_t status = setField<APDS9960Field::GestureFifoClear>(1);
+    if (status != NO_ERROR) return status;
+
+    uint16_t sum[4] = {0, 0, 0, 0};
+    uint16_t count = 0;
+    uint8_t fifo[GESTURE_FIFO_SIZE * 4];
+    for (uint8_t i = 0; i < samples; i++){
+        delay(CALIBRATION_SETTLE_MILLIS);
+        status = drainGestureFifo(fifo, GESTURE_FIFO_SIZE);
+        if (status != NO_ERROR) return status;
+        for (uint8_t dataset = 0; dataset < datasetsDrained; dataset++)
+            for (uint8_t j = 0; j < 4; j++)
+                sum[j] += fifo[dataset * 4 + j];
+        count += datasetsDrained;
+    }
+
+    for (uint8_t j = 0; j < 4; j++)
+        baseline[j] = count > 0 ? sum[j] / count : 0;
+    return NO_ERROR;
+}
+#endif
+
+#if APDS9960_ENABLE_PROXIMITY || APDS9960_ENABLE_GESTURE
+int8_t Melopero_APDS9960::searchCrosstalkOffsets(uint8_t blob[CALIBRATION_BLOB_SIZE], uint8_t samples, uint8_t config3){
+    using namespace APDS9960Field;
+    int8_t status = NO_ERROR;
+    uint8_t value = 0;
+
+#if APDS9960_ENABLE_PROXIMITY
+    // Only the proximity engine, without interrupts: with GEN set a baseline above the gesture entry
+    // threshold would start the gesture engine and stop the proximity measurements
+    value = PowerOn::mask | ProximityEnable::mask;
+    status = write(ENABLE_REG_ADDRESS, &value, 1);
+    if (status != NO_ERROR) return status;
+    waitUntilReady();
+
+    // Proximity: one pair at a time, the other one masked (PMASK_D and PMASK_L leave the UP-RIGHT pair)
+    static const uint8_t pairMasks[2] = {0x06, 0x09};
+    for (uint8_t pair = 0; pair < 2; pair++){
+        value = ProximityGainCompensation::mask | ProximityMask::encode(pairMasks[pair]);
+        status = write(CONFIG_3_REG_ADDRESS, &value, 1);
+        if (status != NO_ERROR) return status;
+
+        // The smallest offset that brings the baseline to 0
+        uint8_t low = 0;
+        uint8_t high = 127;
+        while (low < high){
+            uint8_t middle = (low + high) / 2;
+            status = write(PROX_UP_RIGHT_OFFSET_REG_ADDRESS + pair, &middle, 1);
+            uint8_t baseline = 0;
+            if (status == NO_ERROR) status = measureProximityBaseline(samples, baseline);
+            if (status != NO_ERROR) return status;
+            if (baseline == 0)
+                high = middle;
+            else
+                low = middle + 1;
+        }
+        blob[1 + pair] = low;
+    }
+    status = write(CONFIG_3_REG_ADDRESS, &config3, 1);
+    if (status != NO_ERROR) return status;
+#endif
+
+#if APDS9960_ENABLE_GESTURE
+    // Gesture: the four photodiodes together, the engine forced on and kept on by a 0 exit threshold
+    value = PowerOn::mask | ProximityEnable::mask | GestureEnable::mask;
+    status = write(ENABLE_REG_ADDRESS, &value, 1);
+    if (status != NO_ERROR) return status;
+    waitUntilReady();
+
+    value = 0;
+    status = write(GESTURE_EXIT_THR_REG_ADDRESS, &value, 1);
+    if (status == NO_ERROR) status = setField<GestureMode>(1);
+    if (status != NO_ERROR) return status;
+
+    uint8_t low[4] = {0, 0, 0, 0};
+    uint8_t high[4] = {127, 127, 127, 127};
+    for (uint8_t step = 0; step < 7; step++){ // 2^7 offsets
+        uint8_t middle[4];
+        for (uint8_t j = 0; j < 4; j++)
+            middle[j] = (low[j] + high[j]) / 2;
+        status = setGestureOffsets(middle[0], middle[1], middle[2], middle[3]);
+        uint8_t baseline[4];
+        if (status == NO_ERROR) status = measureGestureBaseline(samples, baseline);
+        if (status != NO_ERROR) return status;
+
+        for (uint8_t j = 0; j < 4; j++){
+            if (low[j] == high[j])
+                continue;
+            if (baseline[j] == 0)
+                high[j] = middle[j];
+            else
+                low[j] = middle[j] + 1;
+        }
+    }
+    for (uint8_t j = 0; j < 4; j++)
+        blob[3 + j] = low[j];
+#endif
+    return status;
+}
+
+int8_t Melopero_APDS9960::calibrateCrosstalk(uint8_t blob[CALIBRATION_BLOB_SIZE], uint8_t samples){
+    if (samples == 0)
+        return INVALID_ARGUMENT;
+    for (uint8_t i = 0; i < CALIBRATION_BLOB_SIZE; i++)
+        blob[i] = 0;
+
+    // The registers changed by the calibration, restored at the end. The offsets are restored only
+    // if the search fails, otherwise the new ones are applied.
+    uint8_t enable = 0;
+    uint8_t config3 = 0;
+    uint8_t exitThreshold = 0;
+    uint8_t config4 = 0;
+    uint8_t previous[CALIBRATION_BLOB_SIZE]; // the offsets in force, as a blob
+    int8_t status = read(ENABLE_REG_ADDRESS, &enable, 1);
+    if (status == NO_ERROR) status = read(CONFIG_3_REG_ADDRESS, &config3, 1);
+    if (status == NO_ERROR) status = read(GESTURE_EXIT_THR_REG_ADDRESS, &exitThreshold, 1);
+    if (status == NO_ERROR) status = read(GESTURE_CONFIG_4_REG_ADDRESS, &config4, 1);
+    if (status == NO_ERROR) status = read(PROX_UP_RIGHT_OFFSET_REG_ADDRESS, previous + 1, 2);
+    if (status == NO_ERROR) status = read(GESTURE_OFFSET_UP_REG_ADDRESSES, previous + 3, 2);
+    if (status == NO_ERROR) status = read(GESTURE_OFFSET_LEFT_REG_ADDRESSES, previous + 5, 1);
+    if (status == NO_ERROR) status = read(GESTURE_OFFSET_RIGHT_REG_ADDRESSES, previous + 6, 1);
+    if (status != NO_ERROR) return status;
+    previous[0] = CALIBRATION_BLOB_MAGIC;
+    previous[CALIBRATION_BLOB_SIZE - 1] = calibrationChecksum(previous);
+
+    int8_t searchStatus = searchCrosstalkOffsets(blob, samples, config3);
+
+    // Every register is restored even after an error, the first error is returned. ENABLE goes last,
+    // once the engines it turns back on are configured as before.
+    status = write(CONFIG_3_REG_ADDRESS, &config3, 1);
+    int8_t restoreStatus = write(GESTURE_EXIT_THR_REG_ADDRESS, &exitThreshold, 1);
+    if (status == NO_ERROR) status = restoreStatus;
+    restoreStatus = write(GESTURE_CONFIG_4_REG_ADDRESS, &config4, 1);
+    if (status == NO_ERROR) status = restoreStatus;
+    if (searchStatus != NO_ERROR){
+        restoreStatus = applyCalibration(previous);
+        if (status == NO_ERROR) status = restoreStatus;
+    }
+    restoreStatus = write(ENABLE_REG_ADDRESS, &enable, 1);
+    if (status == NO_ERROR) status = restoreStatus;
+
+    if (searchStatus != NO_ERROR) return searchStatus;
+    if (status != NO_ERROR) return status;
+
+    blob[0] = CALIBRATION_BLOB_MAGIC;
+    blob[CALIBRATION_BLOB_SIZE - 1] = calibrationChecksum(blob);
+    return applyCalibration(blob);
+}
+#endif
+
+int8_t Melopero_APDS9960::applyCalibration(const uint8_t blob[CALIBRATION_BLOB_SIZE]){
+    if (blob[0] != CALIBRATION_BLOB_MAGIC || blob[CALIBRATION_BLOB_SIZE - 1] != calibrationChecksum(blob))
+        return INVALID_ARGUMENT;
+
+    // Same bursts as setGestureOffsets, plus the two proximity offsets
+    uint8_t image[SHADOW_REGISTERS_COUNT];
+    image[SHADOW_PROX_OFFSETS_INDEX] = blob[1];
+    image[SHADOW_PROX_OFFSETS_INDEX + 1] = blob[2];
+    image[SHADOW_GESTURE_OFFSET_UP_INDEX] = blob[3];
+    image[SHADOW_GESTURE_OFFSET_DOWN_INDEX] = blob[4];
+    image[SHADOW_GESTURE_PULSE_INDEX] = shadowRegisters[SHADOW_GESTURE_PULSE_INDEX];
+    image[SHADOW_GESTURE_OFFSET_LEFT_INDEX] = blob[5];
+    image[SHADOW_GESTURE_OFFSET_RIGHT_INDEX] = blob[6];
+
+    uint32_t dirty = (3UL << SHADOW_PROX_OFFSETS_INDEX) 
+        | (1UL << SHADOW_GESTURE_OFFSET_UP_INDEX) | (1UL << SHADOW_GESTURE_OFFSET_DOWN_INDEX) 
+        | (1UL << SHADOW_GESTURE_OFFSET_LEFT_INDEX) | (1UL << SHADOW_GESTURE_OFFSET_RIGHT_INDEX);
+    uint32_t known = dirty;
+    if (shadowEnabled)
+        known |= shadowValid & (1UL << SHADOW_GESTURE_PULSE_INDEX);
+
+    return writeRegisterImage(image, dirty, known);
+}
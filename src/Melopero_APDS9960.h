@@ -2,11 +2,41 @@
 #ifndef Melopero_APDS9960_H_INCLUDED
 #define Melopero_APDS9960_H_INCLUDED
 
+#ifdef ARDUINO
 #include "Arduino.h"
-#include "Wire.h"
+#else
+#include "Melopero_APDS9960_Host.h"
+#endif
 
 #include <stdint.h>
 
+// The bus used to talk to the device is chosen at compile time, so every register access is a 
+// direct (non virtual) call. APDS9960_TRANSPORT is the class of the bus, it must provide the 
+// subset of the TwoWire interface used by the driver (beginTransmission, write, endTransmission,
+// requestFrom, available, read). By default the driver uses TwoWire on Arduino and the register
+// simulator elsewhere (or when APDS9960_USE_SIMULATOR is defined). A custom transport can be 
+// declared in the header named by APDS9960_TRANSPORT_HEADER. These are build flags: the sketch and
+// the library sources must be compiled with the same transport.
+#if defined(APDS9960_TRANSPORT)
+#ifdef APDS9960_TRANSPORT_HEADER
+#include APDS9960_TRANSPORT_HEADER
+#endif
+#elif defined(ARDUINO) && !defined(APDS9960_USE_SIMULATOR)
+#include "Wire.h"
+#define APDS9960_TRANSPORT TwoWire
+#define APDS9960_DEFAULT_TRANSPORT Wire
+#else
+#include "Melopero_APDS9960_Simulator.h"
+#define APDS9960_TRANSPORT APDS9960Simulator
+#define APDS9960_SIMULATED_TRANSPORT
+#endif
+
+#include "Melopero_APDS9960_GestureClassifier.h"
+#include "Melopero_APDS9960_GestureRecognizer.h"
+#include "Melopero_APDS9960_GestureRingBuffer.h"
+#include "Melopero_APDS9960_Light.h"
+#include "Melopero_APDS9960_Trace.h"
+
 #define APDS9960_DEFAULT_I2C_ADDRESS 0x39
 
     //Register addresses
@@ -100,6 +130,11 @@
 #define ALS_GAIN_16X 2
 #define ALS_GAIN_64X 3
 
+    //ALS auto range: band of the clear channel, in percent of the saturation value
+#define ALS_AUTO_RANGE_LOW_PERCENT 10
+#define ALS_AUTO_RANGE_HIGH_PERCENT 80
+#define ALS_AUTO_RANGE_TARGET_PERCENT 50
+
     //Gesture FIFO interrupt levels
 #define FIFO_INT_AFTER_1_DATASET 0
 #define FIFO_INT_AFTER_4_DATASETS 1
@@ -122,38 +157,266 @@
 #define GESTURE_WAIT_30_8_MILLIS 6
 #define GESTURE_WAIT_39_2_MILLIS 7
 
-#define NO_GESTURE 0
-#define UP_GESTURE 1
-#define DOWN_GESTURE 2
-#define LEFT_GESTURE 3
-#define RIGHT_GESTURE 4
+    //Gesture FIFO capacity (number of four byte UDLR datasets)
+#define GESTURE_FIFO_SIZE 32
+
+    //Number of configuration registers mirrored by the shadow register cache (at most 31)
+#define SHADOW_REGISTERS_COUNT 28
+
+    //Crosstalk calibration blob (see calibrateCrosstalk): magic, POFFSET_UR, POFFSET_DL, GOFFSET_U/D/L/R, checksum
+#define CALIBRATION_BLOB_SIZE 8
+#define CALIBRATION_BLOB_MAGIC 0xC7
+
+    //Time given to the engines for a new measurement after the calibration changes an offset
+#define CALIBRATION_SETTLE_MILLIS 10
 
     //Status codes
 #define NO_ERROR 0
 #define I2C_ERROR -1
 #define INVALID_ARGUMENT -2
 
+    //Status register (deviceStatus) flags
+#define STATUS_CLEAR_SATURATION 0x80 // CPSAT
+#define STATUS_PROX_GESTURE_SATURATION 0x40 // PGSAT
+#define STATUS_PROX_INTERRUPT 0x20 // PINT
+#define STATUS_ALS_INTERRUPT 0x10 // AINT
+#define STATUS_GESTURE_INTERRUPT 0x04 // GINT
+#define STATUS_PROX_VALID 0x02 // PVALID
+#define STATUS_ALS_VALID 0x01 // AVALID
+
+    //Registers read by updateSnapshot (STATUS, CDATAL ... BDATAH, PDATA)
+#define SNAPSHOT_LENGTH 10
+
+    //Time between a PON rising edge and the first valid measurement (the datasheet specifies a 5.7ms warm up)
+#ifndef APDS9960_POWER_UP_MICROS
+#define APDS9960_POWER_UP_MICROS 10000
+#endif
+
+    //Bus instrumentation (getBusStats), off by default. It changes the class layout: enable it with
+    //the build flag -DAPDS9960_BUS_STATS=1 so that the sketch and the library sources agree
+#ifndef APDS9960_BUS_STATS
+#define APDS9960_BUS_STATS 0
+#endif
+
+    //Trace recorder hook in read() (attachTraceRecorder), off by default. Like APDS9960_BUS_STATS it
+    //changes the class layout and must be given to the whole build: -DAPDS9960_TRACE=1
+#ifndef APDS9960_TRACE
+#define APDS9960_TRACE 0
+#endif
+
+    //Engines compiled in. Define the unused ones as 0 for the whole build (build flags, not in the sketch: the
+    //library sources must see the same values) to leave out their members and methods, see the footprint report
+#ifndef APDS9960_ENABLE_ALS
+#define APDS9960_ENABLE_ALS 1
+#endif
+#ifndef APDS9960_ENABLE_PROXIMITY
+#define APDS9960_ENABLE_PROXIMITY 1
+#endif
+#ifndef APDS9960_ENABLE_GESTURE
+#define APDS9960_ENABLE_GESTURE 1
+#endif
+
+    //Default retries of a failed read(), write() or addressAccess() and the wait before the first one,
+    //doubled at every retry (setBusRetries)
+#ifndef APDS9960_BUS_RETRIES
+#define APDS9960_BUS_RETRIES 2
+#endif
+#ifndef APDS9960_BUS_RETRY_BACKOFF_MICROS
+#define APDS9960_BUS_RETRY_BACKOFF_MICROS 100
+#endif
+
+    //Bus recovery by toggling SCL (enableBusRecovery), define APDS9960_BUS_RECOVERY as 0 to compile it out
+    //(e.g. on a core whose TwoWire has no end())
+#ifndef APDS9960_BUS_RECOVERY
+#define APDS9960_BUS_RECOVERY 1
+#endif
+
+    //Call sites of the I2C errors counted in BusStats::errors
+#define BUS_SITE_READ_ADDRESS 0 // read(): writing the register address
+#define BUS_SITE_READ_DATA 1 // read(): requesting the data (short reads included)
+#define BUS_SITE_WRITE 2 // write()
+#define BUS_SITE_ADDRESS_ACCESS 3 // addressAccess()
+#define BUS_SITES_COUNT 4
+
+    //Kinds of transfer timed in BusStats
+#define BUS_TRANSFER_READ 0
+#define BUS_TRANSFER_WRITE 1
+#define BUS_TRANSFER_ADDRESS_ACCESS 2
+#define BUS_TRANSFER_KINDS_COUNT 3
+
+    //Default time between two FIFO level polls while a non blocking gesture parse finds the FIFO empty
+#define GESTURE_PARSE_POLL_INTERVAL_MILLIS 3
+
+#include "Melopero_APDS9960_Fields.h"
+
+/*! Called when a gesture parsing window started with beginGestureParse is over. */
+typedef void (*APDS9960GestureCallback)(uint8_t upDownGesture, uint8_t leftRightGesture);
+
+class Melopero_APDS9960;
+
+/*! Called by serviceInterrupt for an interrupt source that is asserted. */
+typedef void (*APDS9960InterruptHandler)(Melopero_APDS9960 &device);
+
 class Melopero_APDS9960 {
 
     public:
-        TwoWire *i2c;
+        /*! A complete device configuration (profile) that can be written with applyConfig.
+         *  The default values are the power on values of the device. The fields use the same
+         *  units and constants as the corresponding setters. */
+        struct Config {
+            // Engines and interrupts (ENABLE register)
+            bool powerOn = false;
+            bool alsEngine = false;
+            bool proximityEngine = false;
+            bool waitEngine = false;
+            bool gestureEngine = false;
+            bool alsInterrupts = false;
+            bool proximityInterrupts = false;
+            bool sleepAfterInterrupt = false;
+
+            // LED
+            uint8_t ledDrive = LED_DRIVE_100_mA;
+            uint8_t ledBoost = LED_BOOST_100;
+
+            // Wait engine: wait time = waitCycles * 2.78ms (x12 if longWait), waitCycles in range [1 - 256]
+            uint16_t waitCycles = 1;
+            bool longWait = false;
+
+            // ALS engine: integration time = alsIntegrationCycles * 2.78ms, alsIntegrationCycles in range [1 - 256]
+            uint16_t alsIntegrationCycles = 1;
+            uint8_t alsGain = ALS_GAIN_1X;
+            uint16_t alsLowThreshold = 0;
+            uint16_t alsHighThreshold = 0;
+            uint8_t alsPersistence = 0;
+            bool alsSaturationInterrupts = false;
+
+            // Proximity engine
+            uint8_t proximityGain = PROXIMITY_GAIN_1X;
+            uint8_t proximityLowThreshold = 0;
+            uint8_t proximityHighThreshold = 0;
+            uint8_t proximityPersistence = 0;
+            uint8_t proximityPulseCount = 1;
+            uint8_t proximityPulseLength = PULSE_LEN_8_MICROS;
+            int8_t proximityUpRightOffset = 0;
+            int8_t proximityDownLeftOffset = 0;
+            bool proximitySaturationInterrupts = false;
+            bool proximityMaskUp = false;
+            bool proximityMaskDown = false;
+            bool proximityMaskLeft = false;
+            bool proximityMaskRight = false;
+            bool proximityGainCompensation = false;
+
+            // Gesture engine
+            uint8_t gestureEnterThreshold = 0;
+            uint8_t gestureExitThreshold = 0;
+            uint8_t gestureFifoThreshold = FIFO_INT_AFTER_1_DATASET;
+            bool gestureExitMaskUp = false;
+            bool gestureExitMaskDown = false;
+            bool gestureExitMaskLeft = false;
+            bool gestureExitMaskRight = false;
+            uint8_t gestureExitPersistence = EXIT_AFTER_1_GESTURE_END;
+            uint8_t gestureGain = PROXIMITY_GAIN_1X;
+            uint8_t gestureLedDrive = LED_DRIVE_100_mA;
+            uint8_t gestureWaitTime = GESTURE_WAIT_0_MILLIS;
+            int8_t gestureUpOffset = 0;
+            int8_t gestureDownOffset = 0;
+            int8_t gestureLeftOffset = 0;
+            int8_t gestureRightOffset = 0;
+            uint8_t gesturePulseCount = 1;
+            uint8_t gesturePulseLength = PULSE_LEN_8_MICROS;
+            bool gestureUpDownActive = false;
+            bool gestureLeftRightActive = false;
+            bool gestureInterrupts = false;
+        };
+
+        /*! The flags of the STATUS and GSTATUS registers, decoded from the last values read 
+         *  (deviceStatus, gestureFifoOverflow and gestureFifoHasData), see getStatus. */
+        struct Status {
+            bool clearSaturation; // CPSAT
+            bool proximityGestureSaturation; // PGSAT
+            bool proximityInterrupt; // PINT
+            bool alsInterrupt; // AINT
+            bool gestureInterrupt; // GINT
+            bool proximityValid; // PVALID
+            bool alsValid; // AVALID
+            bool gestureFifoOverflow; // GFOV
+            bool gestureValid; // GVALID
+        };
+
+#if APDS9960_BUS_STATS
+        /*! Counters maintained by read(), write() and addressAccess(). A transfer is one call of 
+         *  these methods, it may use more than one transaction (a read issues the register address
+         *  and then one request every 32 bytes). Times are measured with micros(). */
+        struct BusStats {
+            uint32_t transactions = 0;
+            uint32_t bytesWritten = 0; // register addresses included
+            uint32_t bytesRead = 0;
+            uint16_t errors[BUS_SITES_COUNT] = {0, 0, 0, 0}; // I2C_ERROR occurrences by BUS_SITE_X
+            uint16_t shortReads = 0; // requests that returned fewer bytes than asked
+            uint32_t transfers[BUS_TRANSFER_KINDS_COUNT] = {0, 0, 0}; // by BUS_TRANSFER_X
+            uint32_t totalMicros[BUS_TRANSFER_KINDS_COUNT] = {0, 0, 0};
+            uint32_t maxMicros[BUS_TRANSFER_KINDS_COUNT] = {0, 0, 0};
+            uint16_t retries = 0; // attempts repeated after an error (each attempt is also counted above)
+            uint16_t recoveries = 0; // bus recoveries performed after the last retry failed
+        };
+#endif
+
+    public:
+        APDS9960_TRANSPORT *i2c;
         uint8_t i2cAddress;
         uint8_t deviceStatus;
+        uint32_t snapshotMicros;
+        uint16_t waitCycles;
+        bool longWait;
+
+#if APDS9960_ENABLE_PROXIMITY
         uint8_t proximityData;
+        bool proximityDataValid;
+#endif
 
+#if APDS9960_ENABLE_GESTURE
         uint8_t datasetsInFifo;
+        uint8_t datasetsDrained;
         bool gestureEngineRunning;
         bool gestureFifoOverflow;
         bool gestureFifoHasData;
+        uint16_t gestureFifoOverflows;
+        volatile bool gestureInterruptPending;
+        GestureRingBuffer* gestureRingBuffer;
         uint8_t gestureData[4];
         uint8_t parsedUpDownGesture;
         uint8_t parsedLeftRightGesture;
-        
+        bool gestureParseRunning;
+        bool gestureParseDone;
+        uint16_t gestureParsePollInterval;
+        bool gestureEarlyDecision;
+        bool gestureDecisionLatched;
+        uint16_t gestureDecisionDatasets;
+        uint32_t gestureDecisionLatencyMicros;
+        uint16_t gestureDatasetMicros; // 0: the dataset period is estimated from the configuration, see gestureDatasetPeriodMicros
+#endif
+
+#if APDS9960_ENABLE_ALS
+        bool colorDataValid;
         uint16_t alsSaturation;
+        uint8_t alsGainMultiplier;
+        uint16_t alsIntegrationCycles;
+        uint32_t alsScale;
+        bool alsAutoRange;
+        bool alsAutoRangeSettling;
         uint16_t red;
         uint16_t green;
         uint16_t blue;
         uint16_t clear;
+#endif
+
+        bool shadowEnabled;
+        uint32_t shadowValid;
+        uint8_t shadowRegisters[SHADOW_REGISTERS_COUNT];
+
+        uint8_t busRetries;
+        uint16_t busRetryBackoffMicros;
+        uint16_t brownouts; // configurations restored by checkBrownout
 
     public:
         Melopero_APDS9960();
@@ -162,7 +425,11 @@ class Melopero_APDS9960 {
     //    I2C functions
     //=========================================================================
 
-    int8_t initI2C(uint8_t i2cAddr=APDS9960_DEFAULT_I2C_ADDRESS, TwoWire &bus = Wire);
+#ifdef APDS9960_DEFAULT_TRANSPORT
+    int8_t initI2C(uint8_t i2cAddr=APDS9960_DEFAULT_I2C_ADDRESS, APDS9960_TRANSPORT &bus = APDS9960_DEFAULT_TRANSPORT);
+#else
+    int8_t initI2C(uint8_t i2cAddr, APDS9960_TRANSPORT &bus);
+#endif
 
     int8_t read(uint8_t registerAddress, uint8_t* buffer, uint8_t amount);
         
@@ -172,6 +439,115 @@ class Melopero_APDS9960 {
 
     int8_t addressAccess(uint8_t registerAddress);
 
+    /*! @brief Writes len bytes to another device on the same bus, for example the control register of an
+     *  I2C mux, with the retries and the bus recovery of write(). Nothing is cached. */
+    int8_t writeToAddress(uint8_t address, const uint8_t* values, uint8_t len);
+
+    /*! @brief Sets how many times read(), write() and addressAccess() are repeated after an I2C error before
+     *  returning I2C_ERROR, so that a glitch on the bus does not abort a multi-step configuration. The
+     *  wait before the first retry is backoffMicros and doubles at every retry. Reads of the gesture FIFO
+     *  are retried only if the register address was not acknowledged (the datasets already read are gone).
+     *  @param[in] retries 0 disables the retries */
+    void setBusRetries(uint8_t retries, uint16_t backoffMicros = APDS9960_BUS_RETRY_BACKOFF_MICROS);
+
+#if APDS9960_BUS_RECOVERY
+    /*! @brief Enables the bus recovery: when the last retry of a transfer fails, SCL is toggled (up to 9
+     *  clocks, until the slave releases SDA) and a STOP is generated, then the transfer is tried once more.
+     *  It frees a bus whose SDA is held low by a slave interrupted in the middle of a byte. On Arduino the
+     *  pins are driven directly, with TwoWire stopped (end()) and started again (begin()) around it; on the
+     *  simulator the pins are ignored. begin() restores the default clock of the core: pass the clock given
+     *  to setClock as busClock to have it set again after the recovery.
+     *  @param[in] busClock the I2C clock in Hz, 0 to keep the default one */
+    void enableBusRecovery(uint8_t sdaPin, uint8_t sclPin, bool enable = true, uint32_t busClock = 0);
+
+    /*! @brief Performs a bus recovery now (see enableBusRecovery).
+     *  @return I2C_ERROR if SDA is still held low, INVALID_ARGUMENT if the recovery is not enabled. */
+    int8_t recoverBus();
+#endif
+
+    /*! @brief Detects a brownout of the sensor and restores its configuration. A sensor that lost power
+     *  restarts with the power on values: its ENABLE register reads 0. If the shadow cache (see
+     *  enableShadowRegisters) expects another value, every cached configuration register is written
+     *  back (ENABLE last, which also restarts the warm up) and brownouts is incremented.
+     *  @return INVALID_ARGUMENT if the shadow registers are disabled or ENABLE is not cached yet. */
+    int8_t checkBrownout();
+
+    /*! @brief Runs checkBrownout automatically at the beginning of updateStatus and updateSnapshot: after a
+     *  transfer that succeeded only thanks to a retry or a bus recovery, and every intervalMillis.
+     *  It needs the shadow registers, disabling them also stops the automatic check. Until ENABLE is cached
+     *  (written or read with the cache enabled) the check has nothing to compare with and does nothing.
+     *  @param[in] intervalMillis 0: only after the bus errors
+     *  @return INVALID_ARGUMENT if enable is true and the shadow registers are disabled (nothing is changed) */
+    int8_t setBrownoutCheck(bool enable, uint16_t intervalMillis = 0);
+
+    /*! @brief Writes a single register field (see APDS9960Field), the other bits of the register are kept.
+     *  @return INVALID_ARGUMENT if the value does not fit in the field. */
+    template <class Field>
+    int8_t setField(uint8_t value){
+        if (!Field::fits(value))
+            return INVALID_ARGUMENT;
+        return andOrRegister(Field::address, (uint8_t) ~Field::mask, Field::encode(value));
+    }
+
+    /*! @brief Same as setField(value) with a constant value: a value that does not fit in the field does not compile. */
+    template <class Field, uint8_t Value>
+    int8_t setField(){
+        static_assert(Value <= Field::maxValue, "the value does not fit in the register field");
+        return andOrRegister(Field::address, (uint8_t) ~Field::mask, Field::encode(Value));
+    }
+
+    /*! @brief Reads a single register field. */
+    template <class Field>
+    int8_t getField(uint8_t &value){
+        uint8_t regValue = 0;
+        int8_t status = read(Field::address, &regValue, 1);
+        if (status != NO_ERROR) return status;
+        value = Field::decode(regValue);
+        return NO_ERROR;
+    }
+
+#if APDS9960_BUS_STATS
+    /*! @brief The bus counters collected since the construction or the last resetBusStats. */
+    const BusStats& getBusStats() const { return busStats; }
+
+    /*! @brief Sets all the bus counters to zero. */
+    void resetBusStats();
+#endif
+
+#if APDS9960_TRACE
+    /*! @brief Records the measurement reads (STATUS, RGBC, proximity, gesture FIFO and its level and
+     *  status, GMODE) from now on, see APDS9960TraceRecorder. NULL stops the recording. */
+    void attachTraceRecorder(APDS9960TraceRecorder* recorder);
+#endif
+
+    //=========================================================================
+    //    Shadow Register Methods
+    //=========================================================================
+
+    /*! @brief Enables a local copy of the configuration registers (ENABLE, CONFIG_1/2/3, CONTROL_1,
+     *  PERS, GCONF1-4 and the time, threshold, pulse and offset registers). While enabled, setters 
+     *  that modify only some bits of these registers use the cached value and issue a single write 
+     *  instead of a read followed by a write, and applyConfig skips the registers that did not change.
+     *  The cache is filled lazily (or with syncShadowFromDevice) and is kept up to date by write().
+     *  @param[in] enable if true enables the cache, else disables it. The cache is invalidated in both cases. */
+    void enableShadowRegisters(bool enable = true);
+
+    /*! @brief Reads all the shadowed registers from the device (two burst reads) and marks the cache as valid. */
+    int8_t syncShadowFromDevice();
+
+    /*! @brief Discards the cached values. Must be called if the device configuration was changed 
+     *  without going through this object (for example after a power cycle of the sensor). */
+    void invalidateShadowRegisters();
+
+    /*! @brief Writes a complete configuration with as few I2C transactions as possible: the registers are 
+     *  written with multi-byte writes over contiguous address ranges and, if the shadow registers are 
+     *  enabled, registers that already hold the requested value are skipped. When the new ENABLE value turns
+     *  on the device or an engine it is written last, in its own transaction, so that no measurement starts
+     *  with a half written configuration.
+     *  @param[in] config the configuration to apply.
+     *  @return INVALID_ARGUMENT if one of the fields is out of range (nothing is written in that case). */
+    int8_t applyConfig(const Config &config);
+
     //=========================================================================
     //    Device Methods
     //=========================================================================
@@ -186,6 +562,23 @@ class Melopero_APDS9960 {
     /*! @brief calling this function resets also the Proximity and ALS interrupt settings. */
     int8_t enableAllEnginesAndPowerUp(bool enable = true);
 
+    /*! @brief Powering the device on (PON rising edge, from wakeUp, enableAllEnginesAndPowerUp or applyConfig)
+     *  starts a warm up of APDS9960_POWER_UP_MICROS. By default these methods wait for it before returning. 
+     *  In non blocking mode they return immediately: use isReady to know when the warm up is over, or let
+     *  the data reads (updateColorData, updateProximityData, updateGestureData, drainGestureFifo and the 
+     *  gesture parsers) wait only for the remaining time. Powering the device off never waits.
+     *  @param[in] enable if true the power transitions do not wait. */
+    void setNonBlockingPowerUp(bool enable = true);
+
+    /*! @return true if the warm up that follows the last power on is over. */
+    bool isReady();
+
+    /*! @return the microseconds left before the warm up is over (0 if the device is ready). */
+    uint32_t remainingPowerUpMicros();
+
+    /*! @brief Waits only for the remaining part of the warm up (returns immediately if the device is ready). */
+    void waitUntilReady();
+
     /*! @brief Sleep After Interrupt. When enabled, the device will automatically enter low power mode when the INT pin is asserted. 
      *  Normal operation is resumed when INT pin is cleared over I2C.*/
     int8_t setSleepAfterInterrupt(bool enable = true);
@@ -204,6 +597,44 @@ class Melopero_APDS9960 {
     /*! @brief Updates the status variable that contains status information. */
     int8_t updateStatus();
 
+    /*! @brief Reads STATUS, the color data and the proximity data (0x93 - 0x9C) in a single burst, so 
+     *  all the values come from the same sensor cycle. Updates deviceStatus and snapshotMicros (the 
+     *  micros() at the beginning of the read). The clear, red, green and blue variables are updated 
+     *  only if AVALID is set and proximityData only if PVALID is set: colorDataValid and 
+     *  proximityDataValid tell if they were.
+     *  @return the status of the execution. */
+    int8_t updateSnapshot();
+
+    /*! @brief Decodes the last status read by updateStatus, updateSnapshot, updateGestureStatus or 
+     *  serviceInterrupt (no bus access). */
+    Status getStatus() const;
+
+    /*! @brief Registers the handlers called by serviceInterrupt (NULL to unregister). An interrupt
+     *  source without a handler is neither read nor cleared. */
+#if APDS9960_ENABLE_PROXIMITY
+    void setProximityInterruptHandler(APDS9960InterruptHandler handler);
+#endif
+#if APDS9960_ENABLE_ALS
+    void setAlsInterruptHandler(APDS9960InterruptHandler handler);
+#endif
+#if APDS9960_ENABLE_GESTURE
+    void setGestureInterruptHandler(APDS9960InterruptHandler handler);
+#endif
+
+    /*! @brief Services the shared INT pin: reads STATUS and, for every asserted source with a handler,
+     *  reads its data and calls the handler. The proximity handler finds the new value in 
+     *  proximityData, the ALS handler in clear/red/green/blue (both are read in one burst when both 
+     *  fired). For the gesture source the FIFO is drained into the attached ring buffer (if any) 
+     *  before calling the handler, without a ring buffer the handler must empty the FIFO itself 
+     *  (e.g. with parseGestureInFifo) to release the pin. Only the handled proximity/ALS 
+     *  interrupts are cleared, with a single address access. The saturation flags (PGSAT, CPSAT),
+     *  which assert the pin when PSIEN/CPSIEN are set, are cleared too: PGSAT with the proximity
+     *  clear command and CPSAT with the ALS one, which also clear the interrupt of that engine even
+     *  without a handler. They stay readable in deviceStatus (getStatus) for the handlers.
+     *  @return the status of the execution. */
+    int8_t serviceInterrupt();
+
+#if APDS9960_ENABLE_PROXIMITY
     // =========================================================================
     //     Proximity Engine Methods
     // =========================================================================
@@ -268,7 +699,9 @@ class Melopero_APDS9960 {
     int8_t disablePhotodiodes(bool mask_up, bool mask_down, bool mask_left, bool mask_right, bool proximity_gain_compensation);
         
     int8_t updateProximityData();
+#endif
 
+#if APDS9960_ENABLE_ALS
     // =========================================================================
     //     ALS Engine Methods
     // =========================================================================
@@ -314,14 +747,41 @@ class Melopero_APDS9960 {
      *  @param[in] wtime the integration time in millis must be in range [2.78 - 712]  */
     int8_t setAlsIntegrationTime(float wtime);
 
+    /*! @brief Sets the integration time rounded to the nearest cycle of 2.78ms, see setAlsIntegrationCycles.
+     *  @param[in] micros the integration time in microseconds, must round to [1 - 256] cycles */
+    int8_t setAlsIntegrationMicros(uint32_t micros);
+
+    /*! The integration time currently programmed, in microseconds. */
+    uint32_t getAlsIntegrationMicros();
+
     /*! updates the saturation value. The values updated by updateColorData can not exceed
      *  this value. */
     int8_t updateSaturation();
 
     /*! Red, green, blue, and clear data is stored as 16-bit values.
-     *  Updates the values of the red green blue and clear variables */
+     *  Updates the values of the red green blue and clear variables.
+     *  When the auto range is enabled the gain and the integration time are adjusted after the read, see enableAlsAutoRange. */
     int8_t updateColorData();
 
+    /*! @brief Sets the integration time in ALS cycles of 2.78ms (ATIME = 256 - cycles) and updates alsSaturation.
+     *  @param[in] cycles must be in range [1 - 256] */
+    int8_t setAlsIntegrationCycles(uint16_t cycles);
+
+    /*! @brief Keeps the clear channel between ALS_AUTO_RANGE_LOW_PERCENT and ALS_AUTO_RANGE_HIGH_PERCENT of the 
+     *  saturation value. When a reading of updateColorData falls outside this band the light level (counts per 
+     *  cycle at 1x) is estimated from it and the highest gain and then the longest integration time (up to 
+     *  maxIntegrationCycles) that bring the next reading near ALS_AUTO_RANGE_TARGET_PERCENT are written at once,
+     *  so a change of light usually settles in one step (saturated readings step down by 4x at least).
+     *  The readings are reported together with alsScale = gain * integration cycles of the settings they were 
+     *  taken with: clear / alsScale is proportional to the irradiance whatever the range. alsAutoRangeSettling 
+     *  is true until a full integration with the new settings has completed.
+     *  @param[in] enable enables or disables the auto range (reads the current gain and integration time)
+     *  @param[in] maxIntegrationCycles the longest integration time allowed, in cycles of 2.78ms [1 - 256]
+     *  @param[in] minIntegrationCycles the shortest integration time allowed, in cycles of 2.78ms [1 - 256] */
+    int8_t enableAlsAutoRange(bool enable = true, uint16_t maxIntegrationCycles = 72, uint16_t minIntegrationCycles = 1);
+#endif
+
+#if APDS9960_ENABLE_GESTURE
     // =========================================================================
     //     Gestures Engine Methods
     // =========================================================================
@@ -433,13 +893,74 @@ class Melopero_APDS9960 {
      *  with the get_number_of_datasets_in_fifo method. */      
     int8_t updateGestureData();
 
+    /*! Reads the FIFO level once and then reads all the available datasets (at most maxDatasets)
+     *  with a single burst read starting at the FIFO UP register. The datasets are stored one 
+     *  after the other in buffer (UP, DOWN, LEFT, RIGHT), which must hold at least 4 * maxDatasets 
+     *  bytes. The FIFO level is stored in datasetsInFifo and the number of datasets read in datasetsDrained.
+     *  The gesture status (gestureFifoOverflow, gestureFifoHasData) is updated with the same read.
+     *  @param buffer the destination of the UDLR datasets.
+     *  @param maxDatasets the maximum number of datasets to read, must be in range [1 - GESTURE_FIFO_SIZE]. */
+    int8_t drainGestureFifo(uint8_t* buffer, uint8_t maxDatasets = GESTURE_FIFO_SIZE);
+
+    /*! Sets the ring buffer filled by serviceGestureFifo (NULL to detach it). */
+    void attachGestureRingBuffer(GestureRingBuffer* ringBuffer);
+
+    /*! Marks the gesture FIFO as in need of service. Does not access the bus, so it can be 
+     *  called directly from the INT pin interrupt handler. */
+    void notifyGestureInterrupt();
+
+    /*! Drains the whole gesture FIFO (one level read and one burst read) into the attached ring 
+     *  buffer. Datasets that don't fit are counted in the ring buffer droppedDatasets and every
+     *  FIFO overflow seen by the device is counted in gestureFifoOverflows. */
+    int8_t serviceGestureFifo();
+
+    /*! Calls serviceGestureFifo only if notifyGestureInterrupt was called since the last drain. */
+    int8_t serviceGestureInterrupt();
+
     /*! Reads the gesture fifo and tries to parse a gesture with the available datasets. 
-     *  The parsed gesture is stored in parsedGesture. */
+     *  The parsed gesture is stored in parsedUpDownGesture and parsedLeftRightGesture. 
+     *  The datasets are classified with a GestureClassifier, see there for the meaning of the parameters. */
     int8_t parseGestureInFifo(uint8_t tolerance = 12, uint8_t der_tolerance = 6, uint8_t confidence = 6);
 
+    /*! Reads the gesture fifo (one level read and one burst read) and pushes the datasets into the 
+     *  recognizer, which is not reset: it can be called again (e.g. at every FIFO interrupt) until 
+     *  recognizer.complete is true, then recognizer.result() holds the gesture. */
+    int8_t recognizeGestureInFifo(GestureRecognizer &recognizer);
+
     /*! Reads the gesture data for the given amount of time and tries to interpret a gesture. */
     int8_t parseGesture(uint16_t parse_millis, uint8_t tolerance = 12, uint8_t der_tolerance = 6, uint16_t confidence = 6);
-    
+
+    /*! Starts parsing the gesture data for the given amount of time without blocking: the work is done 
+     *  by pollGestureParse, which has to be called repeatedly (for example in loop()). When the parsing 
+     *  window is over gestureParseDone is set, the parsed gesture is stored in parsedUpDownGesture and 
+     *  parsedLeftRightGesture and the callback (if any) is called. The parameters are the same of parseGesture. */
+    int8_t beginGestureParse(uint16_t parse_millis, uint8_t tolerance = 12, uint8_t der_tolerance = 6, uint16_t confidence = 6);
+
+    /*! Does a bounded amount of work for the gesture parse started with beginGestureParse and returns 
+     *  immediately: at most one FIFO drain (one level read and one burst read). While the FIFO is empty
+     *  the FIFO level is polled at most once every gestureParsePollInterval milliseconds. */
+    int8_t pollGestureParse();
+
+    /*! Sets the function called when a non blocking gesture parse completes (NULL to remove it). */
+    void setGestureParseCallback(APDS9960GestureCallback callback);
+
+    /*! @brief In early decision mode parseGesture, pollGestureParse and parseGestureInFifo evaluate the 
+     *  confidence margin after every dataset and report the gesture as soon as it is met, instead of at
+     *  the end of the window or of the FIFO (the window becomes a timeout). The datasets of a reported 
+     *  gesture are then discarded (gestureDecisionLatched) until the gesture engine exits, so a swipe is 
+     *  reported only once. gestureDecisionDatasets is the number of datasets from the first one of the 
+     *  gesture to the deciding one, gestureDecisionLatencyMicros the time from the first motion to the
+     *  decision, the same measure for the three parsers: the first motion is placed before the drain
+     *  that returned the first dataset by the datasets it returned, (datasetsDrained - 1) times
+     *  gestureDatasetPeriodMicros (the time the last one waited in the FIFO is not known).
+     *  @param enable enables or disables the mode, in both cases the latch is released */
+    void setGestureEarlyDecision(bool enable = true);
+
+    /*! The time between two gesture datasets used for gestureDecisionLatencyMicros: gestureDatasetMicros 
+     *  if it is not 0, otherwise the estimate of APDS9960Time::gestureDatasetMicros for the gesture pulses,
+     *  wait time and active pairs last written to (or read from) the device. No bus access. */
+    uint32_t gestureDatasetPeriodMicros() const;
+#endif
         
     // =========================================================================
     //     Wait Engine Methods
@@ -454,6 +975,126 @@ class Melopero_APDS9960 {
     *   @param long_wait If true the wait time is multiplied by 12.\n */
     int8_t setWaitTime(float wtime, bool long_wait = false);
 
+    /*! Sets the wait time in cycles of 2.78ms (33.36ms if long_wait), WTIME = 256 - cycles.
+    *   @param cycles must be in range [1 - 256]\n
+    *   @param long_wait If true the wait time is multiplied by 12.\n */
+    int8_t setWaitCycles(uint16_t cycles, bool long_wait = false);
+
+    /*! Sets the wait time rounded to the nearest cycle, see setWaitCycles.
+    *   @param micros the wait time in microseconds, must round to [1 - 256] cycles\n
+    *   @param long_wait If true the cycles are 12 times longer.\n */
+    int8_t setWaitMicros(uint32_t micros, bool long_wait = false);
+
+    /*! The wait time currently programmed, in microseconds. */
+    uint32_t getWaitMicros();
+
+    // =========================================================================
+    //     Crosstalk Calibration Methods
+    // =========================================================================
+
+    /*! @brief Measures the proximity and gesture data with no target in front of the sensor and finds the
+     *  smallest offsets that null it: a binary search on each sign-magnitude offset register, every step
+     *  measured after CALIBRATION_SETTLE_MILLIS. The proximity pairs are calibrated one at a time (the other
+     *  pair masked, with gain compensation, the gesture engine off), then the four gesture photodiodes together
+     *  with the gesture engine forced on. The registers changed during the calibration are restored, also when
+     *  it fails (the previous offsets included, ENABLE last), then the new offsets are applied.
+     *  Takes about 21 * samples settle times. Configure the LED and pulse settings of the application first.
+     *  Only the engines compiled in are calibrated, the offsets of the others are 0 in the blob.
+     *  @param[out] blob CALIBRATION_BLOB_SIZE bytes that can be stored (EEPROM, flash) and given to applyCalibration
+     *  @param[in] samples the number of measurements averaged at every step */
+#if APDS9960_ENABLE_PROXIMITY || APDS9960_ENABLE_GESTURE
+    int8_t calibrateCrosstalk(uint8_t blob[CALIBRATION_BLOB_SIZE], uint8_t samples = 4);
+#endif
+
+    /*! @brief Writes the offsets of a calibration blob in 3 transactions (4 if the gesture pulse register is not
+     *  cached: the offset registers are not contiguous).
+     *  @return INVALID_ARGUMENT if the blob is not valid (magic or checksum) */
+    int8_t applyCalibration(const uint8_t blob[CALIBRATION_BLOB_SIZE]);
+
+    private:
+#if APDS9960_ENABLE_GESTURE
+        uint32_t parseStartMillis;
+        uint32_t parseNextPollMillis;
+        uint16_t parseWindowMillis;
+        GestureClassifier parseClassifier;
+        APDS9960GestureCallback gestureParseCallback;
+        bool parseMotionSeen;
+        uint32_t parseFirstMotionMicros;
+        // GCONF2, GPULSE and GCONF3 as last written or read: they set the dataset period
+        uint8_t gestureConfig2;
+        uint8_t gesturePulse;
+        uint8_t gestureConfig3;
+
+        void trackGestureTiming(uint8_t registerAddress, const uint8_t* values, uint8_t len);
+        uint32_t firstMotionMicros();
+        void finishGestureParse();
+        bool classifyDatasets(GestureClassifier &classifier, const uint8_t* datasets, uint8_t count);
+        int8_t releaseGestureDecision();
+        APDS9960InterruptHandler gestureInterruptHandler;
+        int8_t measureGestureBaseline(uint8_t samples, uint8_t baseline[4]);
+#endif
+
+#if APDS9960_ENABLE_PROXIMITY
+        APDS9960InterruptHandler proximityInterruptHandler;
+        int8_t measureProximityBaseline(uint8_t samples, uint8_t &baseline);
+#endif
+
+#if APDS9960_ENABLE_PROXIMITY || APDS9960_ENABLE_GESTURE
+        int8_t searchCrosstalkOffsets(uint8_t blob[CALIBRATION_BLOB_SIZE], uint8_t samples, uint8_t config3);
+#endif
+
+        bool nonBlockingPowerUp;
+        bool devicePoweredOn;
+        bool powerUpPending;
+        uint32_t readyDeadlineMicros;
+
+        void trackPowerState(bool poweredOn, bool written);
+
+#if APDS9960_ENABLE_ALS
+        APDS9960InterruptHandler alsInterruptHandler;
+        uint8_t alsGainSetting;
+        uint16_t alsMinCycles;
+        uint16_t alsMaxCycles;
+        uint32_t alsSettleDeadlineMillis;
+
+        int8_t autoRangeAls();
+        void updateAlsScale(uint8_t gain, uint16_t cycles);
+#endif
+
+#if APDS9960_TRACE
+        APDS9960TraceRecorder* traceRecorder;
+#endif
+
+#if APDS9960_BUS_STATS
+        BusStats busStats;
+
+        void recordTransfer(uint8_t kind, uint32_t startMicros);
+#endif
+
+        bool busErrorRecovered; // a transfer succeeded after an error, checked by the brownout check
+        bool brownoutCheck;
+        uint16_t brownoutCheckMillis;
+        uint32_t lastBrownoutCheckMillis;
+#if APDS9960_BUS_RECOVERY
+        bool busRecovery;
+        uint8_t recoverySdaPin;
+        uint8_t recoverySclPin;
+        uint32_t recoveryBusClock;
+#endif
+
+        int8_t readOnce(uint8_t registerAddress, uint8_t* buffer, uint8_t amount);
+        int8_t writeOnce(uint8_t registerAddress, uint8_t* values, uint8_t len);
+        int8_t addressAccessOnce(uint8_t registerAddress);
+        int8_t writeToAddressOnce(uint8_t address, const uint8_t* values, uint8_t len);
+        bool prepareRetry(uint8_t &attempt);
+        int8_t autoCheckBrownout();
+
+        int8_t writeRegisterImage(const uint8_t* image, uint32_t dirty, uint32_t known);
+
+        void updateShadow(uint8_t registerAddress, const uint8_t* values, uint8_t len);
+
+        bool gestureStateMachineActive();
+
 };
 
 #endif // Melopero_APDS9960_H_INCLUDED
\ No newline at end of file
@@ -0,0 +1,165 @@
+//Author: Leonardo La Rocca
+#ifndef Melopero_APDS9960_Fields_H_INCLUDED
+#define Melopero_APDS9960_Fields_H_INCLUDED
+
+// Included by Melopero_APDS9960.h after the register addresses.
+
+#include <stdint.h>
+
+/*! Compile time descriptor of a bit field of a register: everything is a constant expression, 
+ *  so the masks cost nothing at run time and a field that does not fit its register does not compile. */
+template <uint8_t Register, uint8_t Shift, uint8_t Width>
+struct RegisterField {
+    static_assert(Width >= 1 && Shift + Width <= 8, "the field must fit in its register");
+
+    static const uint8_t address = Register;
+    static const uint8_t shift = Shift;
+    static const uint8_t width = Width;
+    static const uint8_t maxValue = (uint8_t) ((1 << Width) - 1);
+    static const uint8_t mask = (uint8_t) (((1 << Width) - 1) << Shift);
+
+    static constexpr bool fits(uint8_t value){ return value <= maxValue; }
+
+    /*! The register bits that hold value (value must fit). */
+    static constexpr uint8_t encode(uint8_t value){ return (uint8_t) ((value << Shift) & mask); }
+
+    /*! The value of the field in the register value regValue. */
+    static constexpr uint8_t decode(uint8_t regValue){ return (uint8_t) ((regValue & mask) >> Shift); }
+};
+
+namespace APDS9960Field {
+    // ENABLE
+    typedef RegisterField<ENABLE_REG_ADDRESS, 0, 1> PowerOn; // PON
+    typedef RegisterField<ENABLE_REG_ADDRESS, 1, 1> AlsEnable; // AEN
+    typedef RegisterField<ENABLE_REG_ADDRESS, 2, 1> ProximityEnable; // PEN
+    typedef RegisterField<ENABLE_REG_ADDRESS, 3, 1> WaitEnable; // WEN
+    typedef RegisterField<ENABLE_REG_ADDRESS, 4, 1> AlsInterruptEnable; // AIEN
+    typedef RegisterField<ENABLE_REG_ADDRESS, 5, 1> ProximityInterruptEnable; // PIEN
+    typedef RegisterField<ENABLE_REG_ADDRESS, 6, 1> GestureEnable; // GEN
+
+    // PERS
+    typedef RegisterField<INTERRUPT_PERSISTANCE_REG_ADDRESS, 0, 4> AlsPersistence; // APERS
+    typedef RegisterField<INTERRUPT_PERSISTANCE_REG_ADDRESS, 4, 4> ProximityPersistence; // PPERS
+
+    // CONFIG1
+    typedef RegisterField<CONFIG_1_REG_ADDRESS, 1, 1> WaitLong; // WLONG
+
+    // PPULSE
+    typedef RegisterField<PROX_PULSE_COUNT_REG_ADDRESS, 0, 6> ProximityPulseCount; // PPULSE (count - 1)
+    typedef RegisterField<PROX_PULSE_COUNT_REG_ADDRESS, 6, 2> ProximityPulseLength; // PPLEN
+
+    // CONTROL
+    typedef RegisterField<CONTROL_1_REG_ADDRESS, 0, 2> AlsGain; // AGAIN
+    typedef RegisterField<CONTROL_1_REG_ADDRESS, 2, 2> ProximityGain; // PGAIN
+    typedef RegisterField<CONTROL_1_REG_ADDRESS, 6, 2> LedDrive; // LDRIVE
+
+    // CONFIG2
+    typedef RegisterField<CONFIG_2_REG_ADDRESS, 4, 2> LedBoost; // LED_BOOST
+    typedef RegisterField<CONFIG_2_REG_ADDRESS, 6, 1> AlsSaturationInterruptEnable; // CPSIEN
+    typedef RegisterField<CONFIG_2_REG_ADDRESS, 7, 1> ProximitySaturationInterruptEnable; // PSIEN
+
+    // CONFIG3
+    typedef RegisterField<CONFIG_3_REG_ADDRESS, 0, 4> ProximityMask; // PMASK_R, PMASK_L, PMASK_D, PMASK_U
+    typedef RegisterField<CONFIG_3_REG_ADDRESS, 4, 1> SleepAfterInterrupt; // SAI
+    typedef RegisterField<CONFIG_3_REG_ADDRESS, 5, 1> ProximityGainCompensation; // PCMP
+
+    // GCONF1
+    typedef RegisterField<GESTURE_CONFIG_1_REG_ADDRESS, 0, 2> GestureExitPersistence; // GEXPERS
+    typedef RegisterField<GESTURE_CONFIG_1_REG_ADDRESS, 2, 4> GestureExitMask; // GEXMSK (R, L, D, U)
+    typedef RegisterField<GESTURE_CONFIG_1_REG_ADDRESS, 6, 2> GestureFifoThreshold; // GFIFOTH
+
+    // GCONF2
+    typedef RegisterField<GESTURE_CONFIG_2_REG_ADDRESS, 0, 3> GestureWaitTime; // GWTIME
+    typedef RegisterField<GESTURE_CONFIG_2_REG_ADDRESS, 3, 2> GestureLedDrive; // GLDRIVE
+    typedef RegisterField<GESTURE_CONFIG_2_REG_ADDRESS, 5, 2> GestureGain; // GGAIN
+
+    // GPULSE
+    typedef RegisterField<GESTURE_PULSE_COUNT_AND_LEN_REG_ADDRESS, 0, 6> GesturePulseCount; // GPULSE (count - 1)
+    typedef RegisterField<GESTURE_PULSE_COUNT_AND_LEN_REG_ADDRESS, 6, 2> GesturePulseLength; // GPLEN
+
+    // GCONF3
+    typedef RegisterField<GESTURE_CONFIG_3_REG_ADDRESS, 0, 2> GestureDimensions; // GDIMS
+
+    // GCONF4
+    typedef RegisterField<GESTURE_CONFIG_4_REG_ADDRESS, 0, 1> GestureMode; // GMODE
+    typedef RegisterField<GESTURE_CONFIG_4_REG_ADDRESS, 1, 1> GestureInterruptEnable; // GIEN
+    typedef RegisterField<GESTURE_CONFIG_4_REG_ADDRESS, 2, 1> GestureFifoClear; // GFIFO_CLR
+
+    // GSTATUS
+    typedef RegisterField<GESTURE_STATUS_REG_ADDRESS, 0, 1> GestureValid; // GVALID
+    typedef RegisterField<GESTURE_STATUS_REG_ADDRESS, 1, 1> GestureFifoOverflow; // GFOV
+}
+
+/*! Compile time conversions between times and the values of the ATIME and WTIME registers.
+ *  One cycle lasts 2.78ms (12 times longer for WTIME when WLONG is set) and the register holds 256 - cycles.
+ *  Times are rounded to the nearest cycle, so constant arguments fold into a register value:
+ *  APDS9960Time::registerFromMicros(100000) is 220 (36 cycles, 100.08ms). */
+namespace APDS9960Time {
+
+    const uint32_t CYCLE_MICROS = 2780;
+    const uint32_t LONG_WAIT_FACTOR = 12;
+
+    constexpr uint32_t cycleMicros(bool long_wait = false){
+        return long_wait ? CYCLE_MICROS * LONG_WAIT_FACTOR : CYCLE_MICROS;
+    }
+
+    /*! The number of cycles nearest to micros, not clamped (check it with fits). */
+    constexpr uint32_t roundedCycles(uint32_t micros, bool long_wait = false){
+        return micros / cycleMicros(long_wait) + (micros % cycleMicros(long_wait) >= cycleMicros(long_wait) / 2 ? 1 : 0);
+    }
+
+    constexpr bool fits(uint32_t cycles){
+        return 1 <= cycles && cycles <= 256;
+    }
+
+    /*! The number of cycles nearest to micros, clamped to [1 - 256]. */
+    constexpr uint16_t cyclesFromMicros(uint32_t micros, bool long_wait = false){
+        return roundedCycles(micros, long_wait) < 1 ? 1 : roundedCycles(micros, long_wait) > 256 ? 256 : roundedCycles(micros, long_wait);
+    }
+
+    constexpr uint8_t registerFromCycles(uint16_t cycles){
+        return (uint8_t) (256 - cycles);
+    }
+
+    constexpr uint8_t registerFromMicros(uint32_t micros, bool long_wait = false){
+        return registerFromCycles(cyclesFromMicros(micros, long_wait));
+    }
+
+    constexpr uint16_t cyclesFromRegister(uint8_t value){
+        return 256 - value;
+    }
+
+    /*! The period actually programmed for a number of cycles. */
+    constexpr uint32_t microsFromCycles(uint16_t cycles, bool long_wait = false){
+        return (uint32_t) cycles * cycleMicros(long_wait);
+    }
+
+    constexpr uint32_t microsFromRegister(uint8_t value, bool long_wait = false){
+        return microsFromCycles(cyclesFromRegister(value), long_wait);
+    }
+
+    /*! Fixed part of a proximity or gesture measurement (the LED pulses excluded). Rough value: the
+     *  datasheet does not give the whole cycle timing. */
+    const uint32_t PULSE_OVERHEAD_MICROS = 700;
+
+    /*! LED on time of a measurement (pulse_length is one of PULSE_LEN_N_MICROS): the pulse period is
+     *  taken as twice the pulse length. */
+    constexpr uint32_t pulsesMicros(uint8_t pulse_count, uint8_t pulse_length){
+        return (uint32_t) pulse_count * (8u << (pulse_length & 0x03));
+    }
+
+    /*! The time between two gesture cycles set by GWTIME (one of GESTURE_WAIT_N_MILLIS). */
+    constexpr uint32_t gestureWaitMicros(uint8_t wait_time){
+        return (wait_time & 0x07) < 4 ? (uint32_t) (wait_time & 0x07) * 2800 : 14000 + (uint32_t) ((wait_time & 0x07) - 4) * 8400;
+    }
+
+    /*! Estimated period of the gesture datasets: one measurement per active pair (both pairs when 
+     *  neither is selected) and the gesture wait time. */
+    constexpr uint32_t gestureDatasetMicros(uint8_t pulse_count, uint8_t pulse_length, uint8_t wait_time,
+            bool up_down_active, bool left_right_active){
+        return (up_down_active != left_right_active ? 1 : 2) * (PULSE_OVERHEAD_MICROS + pulsesMicros(pulse_count, pulse_length))
+            + gestureWaitMicros(wait_time);
+    }
+}
+
+#endif // Melopero_APDS9960_Fields_H_INCLUDED
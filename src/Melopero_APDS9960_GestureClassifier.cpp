@@ -0,0 +1,96 @@
+//Author: Leonardo La Rocca
+
+#include "Melopero_APDS9960_GestureClassifier.h"
+
+GestureClassifier::GestureClassifier(uint8_t tolerance, uint8_t der_tolerance, uint16_t confidence){
+    configure(tolerance, der_tolerance, confidence);
+    reset();
+}
+
+void GestureClassifier::configure(uint8_t tolerance, uint8_t der_tolerance, uint16_t confidence){
+    this->tolerance = tolerance;
+    this->derTolerance = der_tolerance;
+    this->confidence = confidence;
+}
+
+void GestureClassifier::reset(){
+    upCount = 0;
+    downCount = 0;
+    leftCount = 0;
+    rightCount = 0;
+    datasets = 0;
+    hasPrevious = false;
+}
+
+static inline void saturatingIncrement(uint16_t &counter){
+    if (counter != 0xFFFF)
+        counter++;
+}
+
+static inline int16_t absolute(int16_t value){
+    return value < 0 ? -value : value;
+}
+
+void GestureClassifier::vote(uint8_t first, uint8_t second, int16_t first_der, int16_t second_der, 
+        uint8_t tolerance, uint8_t der_tolerance, uint16_t &firstCount, uint16_t &secondCount){
+    int16_t diff = (int16_t) first - (int16_t) second;
+    if (!(absolute(diff) > tolerance && (absolute(first_der) > der_tolerance || absolute(second_der) > der_tolerance)))
+        return;
+
+    if (first_der >= 0 && second_der >= 0){
+        // raising curves: the greater one is the side the object comes from
+        if (first > second)
+            saturatingIncrement(firstCount);
+        else 
+            saturatingIncrement(secondCount);
+    }
+    else if (first_der <= 0 && second_der <= 0){
+        // falling curves: the greater one is the side the object leaves from
+        if (first < second)
+            saturatingIncrement(firstCount);
+        else 
+            saturatingIncrement(secondCount);
+    }
+}
+
+void GestureClassifier::push(const uint8_t udlr[4]){
+    saturatingIncrement(datasets);
+    if (hasPrevious){
+        int16_t up_der = (int16_t) udlr[0] - previous[0];
+        int16_t down_der = (int16_t) udlr[1] - previous[1];
+        int16_t left_der = (int16_t) udlr[2] - previous[2];
+        int16_t right_der = (int16_t) udlr[3] - previous[3];
+
+        vote(udlr[0], udlr[1], up_der, down_der, tolerance, derTolerance, upCount, downCount);
+        vote(udlr[2], udlr[3], left_der, right_der, tolerance, derTolerance, leftCount, rightCount);
+    }
+
+    for (int i = 0; i < 4; i++)
+        previous[i] = udlr[i];
+    hasPrevious = true;
+}
+
+void GestureClassifier::push(const uint8_t* udlrDatasets, uint8_t count){
+    for (uint8_t i = 0; i < count; i++)
+        push(udlrDatasets + i * 4);
+}
+
+GestureClassifier::Result GestureClassifier::result() const {
+    Result result;
+
+    if ((uint32_t) downCount >= (uint32_t) upCount + confidence)
+        result.upDown = DOWN_GESTURE;
+    else if ((uint32_t) upCount >= (uint32_t) downCount + confidence)
+        result.upDown = UP_GESTURE;
+    else 
+        result.upDown = NO_GESTURE;
+
+    if ((uint32_t) rightCount >= (uint32_t) leftCount + confidence)
+        result.leftRight = RIGHT_GESTURE;
+    else if ((uint32_t) leftCount >= (uint32_t) rightCount + confidence)
+        result.leftRight = LEFT_GESTURE;
+    else 
+        result.leftRight = NO_GESTURE;
+
+    return result;
+}
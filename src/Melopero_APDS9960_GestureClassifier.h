@@ -0,0 +1,72 @@
+//Author: Leonardo La Rocca
+#ifndef Melopero_APDS9960_GestureClassifier_H_INCLUDED
+#define Melopero_APDS9960_GestureClassifier_H_INCLUDED
+
+#include <stdint.h>
+
+#define NO_GESTURE 0
+#define UP_GESTURE 1
+#define DOWN_GESTURE 2
+#define LEFT_GESTURE 3
+#define RIGHT_GESTURE 4
+
+/*! Streaming gesture classifier. The UDLR datasets are pushed one at a time (or in batches) and
+ *  only a constant amount of state is kept, so the datasets can come from any source: the gesture 
+ *  FIFO, an interrupt buffer or a recorded trace. Only integer arithmetic is used.
+ *
+ *  Detecting method:
+ *  1) identify instants where difference between values on same axis is greater than tolerance
+ *  2) identify instants where both curves are raising or falling (derivative greater than der_tolerance)
+ *  3) In those instants which value is greater ? 
+ *      if up > down: up_count++ if the curves are raising, down_count++ if they are falling
+ *  4) if up_count >= down_count + confidence the gesture is UP_GESTURE, and vice versa for DOWN_GESTURE.
+ *  The same is done on the left-right axis. */
+class GestureClassifier {
+
+    public:
+        struct Result {
+            uint8_t upDown;
+            uint8_t leftRight;
+        };
+
+        uint8_t tolerance;
+        uint8_t derTolerance;
+        uint16_t confidence;
+
+        // Number of datasets that voted for each direction (saturating)
+        uint16_t upCount;
+        uint16_t downCount;
+        uint16_t leftCount;
+        uint16_t rightCount;
+
+        // Number of datasets pushed since the last reset (saturating)
+        uint16_t datasets;
+
+    public:
+        GestureClassifier(uint8_t tolerance = 12, uint8_t der_tolerance = 6, uint16_t confidence = 6);
+
+        /*! Changes the parameters, see parseGestureInFifo for their meaning. Does not reset the counts. */
+        void configure(uint8_t tolerance, uint8_t der_tolerance, uint16_t confidence);
+
+        /*! Forgets all the datasets pushed so far. */
+        void reset();
+
+        /*! Processes one dataset.
+         *  @param udlr the UP, DOWN, LEFT and RIGHT values of the dataset. */
+        void push(const uint8_t udlr[4]);
+
+        /*! Processes count datasets stored one after the other (as read from the gesture FIFO). */
+        void push(const uint8_t* udlrDatasets, uint8_t count);
+
+        /*! The gestures detected with the datasets pushed so far. */
+        Result result() const;
+
+    private:
+        uint8_t previous[4];
+        bool hasPrevious;
+
+        static void vote(uint8_t first, uint8_t second, int16_t first_der, int16_t second_der, 
+            uint8_t tolerance, uint8_t der_tolerance, uint16_t &firstCount, uint16_t &secondCount);
+};
+
+#endif // Melopero_APDS9960_GestureClassifier_H_INCLUDED
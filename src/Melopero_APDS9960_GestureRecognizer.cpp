@@ -0,0 +1,148 @@
+//Author: Leonardo La Rocca
+
+#include "Melopero_APDS9960_GestureRecognizer.h"
+
+GestureRecognizer::GestureRecognizer(uint8_t threshold, uint8_t sensitivity, uint16_t datasetMicros){
+    configure(threshold, sensitivity, datasetMicros);
+    reset();
+}
+
+void GestureRecognizer::configure(uint8_t threshold, uint8_t sensitivity, uint16_t datasetMicros){
+    this->threshold = threshold;
+    this->sensitivity = sensitivity;
+    this->datasetMicros = datasetMicros;
+}
+
+void GestureRecognizer::reset(){
+    datasets = 0;
+    validDatasets = 0;
+    complete = false;
+    firstSum = 0;
+    lastSum = 0;
+    peakSum = 0;
+    firstIndex = 0;
+    lastIndex = 0;
+    for (uint8_t i = 0; i < 4; i++){
+        peakValue[i] = 0;
+        peakIndex[i] = 0;
+    }
+    for (uint8_t i = 0; i < 2; i++){
+        firstRatio[i] = 0;
+        lastRatio[i] = 0;
+    }
+}
+
+static inline uint16_t absolute(int16_t value){
+    return value < 0 ? -value : value;
+}
+
+// (first - second) / (first + second) in 1/256
+static inline int16_t ratio(uint8_t first, uint8_t second){
+    uint16_t sum = (uint16_t) first + second;
+    if (sum == 0)
+        return 0;
+    // In 32 bits: the product overflows a 16 bit int (AVR) as soon as |first - second| >= 128
+    return (int16_t) ((int32_t) ((int16_t) first - (int16_t) second) * 256 / (int32_t) sum);
+}
+
+bool GestureRecognizer::push(const uint8_t udlr[4]){
+    if (datasets != 0xFFFF)
+        datasets++;
+
+    bool valid = udlr[0] > threshold && udlr[1] > threshold && udlr[2] > threshold && udlr[3] > threshold;
+    if (!valid){
+        if (validDatasets > 0 && !complete){
+            complete = true;
+            return true;
+        }
+        return false;
+    }
+    // The datasets after the end of the gesture belong to the next one: reset to recognize it
+    if (complete)
+        return false;
+
+    uint16_t sum = (uint16_t) udlr[0] + udlr[1] + udlr[2] + udlr[3];
+    int16_t upDown = ratio(udlr[0], udlr[1]);
+    int16_t leftRight = ratio(udlr[2], udlr[3]);
+    if (validDatasets == 0){
+        firstRatio[0] = upDown;
+        firstRatio[1] = leftRight;
+        firstSum = sum;
+        firstIndex = datasets;
+    }
+    lastRatio[0] = upDown;
+    lastRatio[1] = leftRight;
+    lastSum = sum;
+    lastIndex = datasets;
+
+    if (sum > peakSum)
+        peakSum = sum;
+    for (uint8_t i = 0; i < 4; i++){
+        if (udlr[i] > peakValue[i]){
+            peakValue[i] = udlr[i];
+            peakIndex[i] = datasets;
+        }
+    }
+
+    if (validDatasets != 0xFFFF)
+        validDatasets++;
+    return false;
+}
+
+bool GestureRecognizer::push(const uint8_t* udlrDatasets, uint8_t count){
+    for (uint8_t i = 0; i < count; i++)
+        push(udlrDatasets + i * 4);
+    return complete;
+}
+
+uint32_t GestureRecognizer::peakLag(uint8_t first, uint8_t second) const {
+    uint16_t lag = peakIndex[first] > peakIndex[second] ? peakIndex[first] - peakIndex[second] : peakIndex[second] - peakIndex[first];
+    return (uint32_t) lag * datasetMicros;
+}
+
+GestureRecognizer::Result GestureRecognizer::result() const {
+    Result result;
+    result.gesture = NO_GESTURE;
+    result.peakLagMicros = 0;
+    result.speed = 0;
+    result.durationMicros = 0;
+    if (validDatasets == 0)
+        return result;
+    result.durationMicros = (uint32_t) (lastIndex - firstIndex) * datasetMicros;
+
+    // Positive when the object comes from the up (left) side
+    int16_t upDown = firstRatio[0] - lastRatio[0];
+    int16_t leftRight = firstRatio[1] - lastRatio[1];
+    uint16_t upDownLength = absolute(upDown);
+    uint16_t leftRightLength = absolute(leftRight);
+    uint16_t longer = upDownLength > leftRightLength ? upDownLength : leftRightLength;
+    uint16_t shorter = upDownLength > leftRightLength ? leftRightLength : upDownLength;
+
+    if (longer >= sensitivity){
+        if ((uint32_t) shorter * 256 >= (uint32_t) longer * 106){ // tan(22.5) = 106 / 256
+            if (upDown > 0)
+                result.gesture = leftRight > 0 ? UP_LEFT_GESTURE : UP_RIGHT_GESTURE;
+            else
+                result.gesture = leftRight > 0 ? DOWN_LEFT_GESTURE : DOWN_RIGHT_GESTURE;
+            result.peakLagMicros = (peakLag(0, 1) + peakLag(2, 3)) / 2;
+        }
+        else if (upDownLength > leftRightLength){
+            result.gesture = upDown > 0 ? UP_GESTURE : DOWN_GESTURE;
+            result.peakLagMicros = peakLag(0, 1);
+        }
+        else {
+            result.gesture = leftRight > 0 ? LEFT_GESTURE : RIGHT_GESTURE;
+            result.peakLagMicros = peakLag(2, 3);
+        }
+
+        uint32_t lag = result.peakLagMicros > datasetMicros / 2 ? result.peakLagMicros : datasetMicros / 2;
+        uint32_t speed = lag > 0 ? 1000000UL / lag : 0xFFFF;
+        result.speed = speed > 0xFFFF ? 0xFFFF : speed;
+    }
+    else if ((uint32_t) lastSum * 4 >= (uint32_t) peakSum * 3 && (uint32_t) firstSum * 2 <= peakSum)
+        result.gesture = NEAR_GESTURE;
+    else if ((uint32_t) firstSum * 4 >= (uint32_t) peakSum * 3 && (uint32_t) lastSum * 2 <= peakSum)
+        result.gesture = FAR_GESTURE;
+
+    return result;
+}
@@ -0,0 +1,94 @@
+//Author: Leonardo La Rocca
+#ifndef Melopero_APDS9960_GestureRecognizer_H_INCLUDED
+#define Melopero_APDS9960_GestureRecognizer_H_INCLUDED
+
+#include <stdint.h>
+#include "Melopero_APDS9960_GestureClassifier.h"
+
+// Gesture codes reported by the GestureRecognizer besides NO_GESTURE and UP_GESTURE ... RIGHT_GESTURE
+#define UP_LEFT_GESTURE 5
+#define UP_RIGHT_GESTURE 6
+#define DOWN_LEFT_GESTURE 7
+#define DOWN_RIGHT_GESTURE 8
+#define NEAR_GESTURE 9
+#define FAR_GESTURE 10
+
+// Default time between two gesture datasets, used to express the peak lag in microseconds
+#define GESTURE_RECOGNIZER_DATASET_MICROS 2800
+
+/*! Streaming gesture recognizer that uses both axes together. The UDLR datasets are pushed one at a
+ *  time like in the GestureClassifier and every push takes a constant time.
+ *
+ *  Detecting method:
+ *  1) a dataset is valid when all the channels are above the threshold
+ *  2) for the first and the last valid datasets the ratios (U - D) / (U + D) and (L - R) / (L + R) are kept
+ *  3) the change of the two ratios is a vector: the side the object comes from sees more light at the
+ *     beginning, the side it leaves from at the end (same meaning of the codes as the GestureClassifier).
+ *     If the vector is longer than the sensitivity it gives one of 8 directions: a diagonal when the
+ *     shorter component is at least tan(22.5) times the longer one.
+ *  4) otherwise the summed UDLR envelope tells an approach (NEAR: the sum ends near its peak after
+ *     starting at most at half of it) from a retreat (FAR: the opposite).
+ *  The swipe speed comes from the lag between the peaks of the channels along the direction. */
+class GestureRecognizer {
+
+    public:
+        struct Result {
+            uint8_t gesture;
+            // Time between the peaks of the opposite channels along the direction (0 for NEAR/FAR)
+            uint32_t peakLagMicros;
+            // Swipes per second: 1000000 / peakLagMicros (peaks in the same dataset count as half a dataset)
+            uint16_t speed;
+            // Time from the first to the last valid dataset
+            uint32_t durationMicros;
+        };
+
+        uint8_t threshold;
+        uint8_t sensitivity;
+        uint16_t datasetMicros;
+
+        // Number of datasets pushed since the last reset (saturating) and the valid ones among them
+        uint16_t datasets;
+        uint16_t validDatasets;
+
+        // True when the valid datasets have been followed by a dataset below the threshold
+        bool complete;
+
+    public:
+        /*! @param threshold the minimum value of every channel for a dataset to be valid
+         *  @param sensitivity the minimum change of the ratios (1/256) to report a direction
+         *  @param datasetMicros the time between two datasets (depends on the gesture wait time and pulses) */
+        GestureRecognizer(uint8_t threshold = 10, uint8_t sensitivity = 40, uint16_t datasetMicros = GESTURE_RECOGNIZER_DATASET_MICROS);
+
+        /*! Changes the parameters. Does not reset the datasets pushed so far. */
+        void configure(uint8_t threshold, uint8_t sensitivity, uint16_t datasetMicros);
+
+        /*! Forgets all the datasets pushed so far. */
+        void reset();
+
+        /*! Processes one dataset.
+         *  @param udlr the UP, DOWN, LEFT and RIGHT values of the dataset.
+         *  @return true if this dataset completed the gesture (see complete) */
+        bool push(const uint8_t udlr[4]);
+
+        /*! Processes count datasets stored one after the other (as read from the gesture FIFO).
+         *  @return true if the gesture is complete */
+        bool push(const uint8_t* udlrDatasets, uint8_t count);
+
+        /*! The gesture recognized with the datasets pushed so far. */
+        Result result() const;
+
+    private:
+        int16_t firstRatio[2]; // up-down, left-right
+        int16_t lastRatio[2];
+        uint16_t firstSum;
+        uint16_t lastSum;
+        uint16_t peakSum;
+        uint8_t peakValue[4];
+        uint16_t peakIndex[4];
+        uint16_t firstIndex;
+        uint16_t lastIndex;
+
+        uint32_t peakLag(uint8_t first, uint8_t second) const;
+};
+
+#endif // Melopero_APDS9960_GestureRecognizer_H_INCLUDED
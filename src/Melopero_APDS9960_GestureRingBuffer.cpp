@@ -0,0 +1,75 @@
+//Author: Leonardo La Rocca
+
+#include "Melopero_APDS9960_GestureRingBuffer.h"
+
+// Orders the slot accesses with respect to the index updates. A compiler barrier is enough 
+// on single core AVRs, a full memory barrier is used everywhere else (e.g. dual core ESP32).
+#if defined(__AVR__)
+#define RING_BUFFER_BARRIER() __asm__ __volatile__("" ::: "memory")
+#else
+#define RING_BUFFER_BARRIER() __sync_synchronize()
+#endif
+
+GestureRingBuffer::GestureRingBuffer(uint8_t* storage, uint8_t capacity){
+    // No slot at all: push() finds the buffer full and never writes
+    this->storage = capacity > 0 ? storage : NULL;
+    // Round down to a power of two so that the free running indexes wrap correctly
+    uint8_t size = 1;
+    while (size <= 64 && (uint8_t) (size << 1) <= capacity)
+        size <<= 1;
+    mask = size - 1;
+    head = 0;
+    tail = 0;
+    droppedDatasets = 0;
+}
+
+bool GestureRingBuffer::push(const uint8_t udlr[4]){
+    uint8_t currentHead = head;
+    if (storage == NULL || (uint8_t) (currentHead - tail) > mask){
+        if (droppedDatasets != 0xFF)
+            droppedDatasets = droppedDatasets + 1;
+        return false;
+    }
+
+    uint8_t* slot = storage + (currentHead & mask) * 4;
+    for (int i = 0; i < 4; i++)
+        slot[i] = udlr[i];
+    // Publish the dataset only after it has been written
+    RING_BUFFER_BARRIER();
+    head = currentHead + 1;
+    return true;
+}
+
+uint8_t GestureRingBuffer::push(const uint8_t* udlrDatasets, uint8_t count){
+    uint8_t stored = 0;
+    for (uint8_t i = 0; i < count; i++)
+        if (push(udlrDatasets + i * 4))
+            stored++;
+    return stored;
+}
+
+bool GestureRingBuffer::pop(uint8_t udlr[4]){
+    uint8_t currentTail = tail;
+    if (currentTail == head)
+        return false;
+    RING_BUFFER_BARRIER();
+
+    const uint8_t* slot = storage + (currentTail & mask) * 4;
+    for (int i = 0; i < 4; i++)
+        udlr[i] = slot[i];
+    // Release the slot only after it has been read
+    RING_BUFFER_BARRIER();
+    tail = currentTail + 1;
+    return true;
+}
+
+uint8_t GestureRingBuffer::pop(uint8_t* udlrDatasets, uint8_t maxCount){
+    uint8_t copied = 0;
+    while (copied < maxCount && pop(udlrDatasets + copied * 4))
+        copied++;
+    return copied;
+}
+
+void GestureRingBuffer::clear(){
+    tail = head;
+}
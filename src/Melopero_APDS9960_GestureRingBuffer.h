@@ -0,0 +1,63 @@
+//Author: Leonardo La Rocca
+#ifndef Melopero_APDS9960_GestureRingBuffer_H_INCLUDED
+#define Melopero_APDS9960_GestureRingBuffer_H_INCLUDED
+
+#include <stdint.h>
+#include <stddef.h>
+
+/*! Single producer / single consumer lock free ring buffer of UDLR gesture datasets.
+ *  The producer (the driver draining the gesture FIFO) and the consumer (the application)
+ *  can run in different contexts (interrupt, task, loop) without disabling interrupts: 
+ *  each side writes only its own index and the indexes are single bytes, so every access 
+ *  is atomic even on 8 bit MCUs.
+ *
+ *  The storage is provided by the user and must hold 4 * capacity bytes. The capacity 
+ *  (number of datasets) must be a power of two in range [1 - 128]; other values are rounded
+ *  down to a power of two. A capacity of 0 gives a buffer that stores nothing (every push is
+ *  counted in droppedDatasets) and never touches the storage. */
+class GestureRingBuffer {
+
+    public:
+        // Number of datasets that could not be stored because the buffer was full, saturates at 255.
+        // A single byte like the indexes, so that the consumer can read it while the producer counts.
+        volatile uint8_t droppedDatasets;
+
+    public:
+        GestureRingBuffer(uint8_t* storage, uint8_t capacity);
+
+        uint8_t capacity() const { return storage != NULL ? mask + 1 : 0; }
+
+        /*! Number of datasets ready to be consumed. */
+        uint8_t available() const { return (uint8_t) (head - tail); }
+
+        /*! Number of datasets that can be pushed before the buffer is full. */
+        uint8_t space() const { return capacity() - available(); }
+
+        // Producer side
+
+        /*! Stores one dataset, returns false (and counts a dropped dataset) if the buffer is full. */
+        bool push(const uint8_t udlr[4]);
+
+        /*! Stores count datasets, returns how many were stored. */
+        uint8_t push(const uint8_t* udlrDatasets, uint8_t count);
+
+        // Consumer side
+
+        /*! Copies the oldest dataset in udlr and removes it, returns false if the buffer is empty. */
+        bool pop(uint8_t udlr[4]);
+
+        /*! Copies at most maxCount of the oldest datasets in udlrDatasets and removes them, returns how many were copied. */
+        uint8_t pop(uint8_t* udlrDatasets, uint8_t maxCount);
+
+        /*! Discards all the datasets. Must be called from the consumer side. */
+        void clear();
+
+    private:
+        uint8_t* storage;
+        uint8_t mask;
+        // Free running indexes: head is written only by the producer, tail only by the consumer
+        volatile uint8_t head;
+        volatile uint8_t tail;
+};
+
+#endif // Melopero_APDS9960_GestureRingBuffer_H_INCLUDED
@@ -0,0 +1,33 @@
+//Author: Leonardo La Rocca
+
+#include "Melopero_APDS9960_Host.h"
+
+#ifndef ARDUINO
+
+static uint64_t hostMicros = 0;
+
+unsigned long millis(){
+    return (unsigned long) (hostMicros / 1000);
+}
+
+unsigned long micros(){
+    return (unsigned long) hostMicros;
+}
+
+void delay(unsigned long ms){
+    hostMicros += (uint64_t) ms * 1000;
+}
+
+void delayMicroseconds(unsigned int us){
+    hostMicros += us;
+}
+
+void apds9960HostAdvanceMicros(uint32_t us){
+    hostMicros += us;
+}
+
+uint64_t apds9960HostMicros(){
+    return hostMicros;
+}
+
+#endif // ARDUINO
@@ -0,0 +1,31 @@
+//Author: Leonardo La Rocca
+#ifndef Melopero_APDS9960_Host_H_INCLUDED
+#define Melopero_APDS9960_Host_H_INCLUDED
+
+// Minimal replacement of the Arduino core used when the library is built on a host 
+// (ARDUINO not defined), for example together with the APDS9960Simulator transport.
+// Time is virtual: it only advances with delay()/delayMicroseconds() and with
+// apds9960HostAdvanceMicros() (the simulator advances it by the modeled bus time), 
+// so every run is deterministic.
+
+#ifndef ARDUINO
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+
+unsigned long millis();
+unsigned long micros();
+void delay(unsigned long ms);
+void delayMicroseconds(unsigned int us);
+
+/*! Advances the virtual clock. */
+void apds9960HostAdvanceMicros(uint32_t us);
+
+/*! The virtual clock in microseconds, without the 32 bit wrap around of micros(). */
+uint64_t apds9960HostMicros();
+
+#endif // ARDUINO
+
+#endif // Melopero_APDS9960_Host_H_INCLUDED
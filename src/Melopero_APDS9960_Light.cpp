@@ -0,0 +1,130 @@
+//Author: Leonardo La Rocca
+
+#include "Melopero_APDS9960_Light.h"
+#include "Melopero_APDS9960.h"
+
+// IR compensated RGB to CIE 1931 XYZ in Q10 (TAOS DN25 matrix)
+static const int16_t XYZ_MATRIX[3][3] = {
+    { -146, 1586, -979 },
+    { -332, 1616, -749 },
+    { -698,  789,  577 }
+};
+
+LightCalculator::LightCalculator(){
+    setCoefficients(LIGHT_GLASS_ATTENUATION_OPEN_AIR, LIGHT_DN40_DEVICE_FACTOR, LIGHT_DN40_RED_COEFFICIENT,
+        LIGHT_DN40_GREEN_COEFFICIENT, LIGHT_DN40_BLUE_COEFFICIENT, LIGHT_DN40_CCT_COEFFICIENT, LIGHT_DN40_CCT_OFFSET);
+    milliLux = 0;
+    cct = 0;
+    chromaticityX = 0;
+    chromaticityY = 0;
+    infrared = 0;
+    saturated = false;
+}
+
+void LightCalculator::setCoefficients(uint16_t glass_attenuation, uint16_t device_factor, int16_t red_coef, int16_t green_coef,
+        int16_t blue_coef, uint16_t cct_coef, uint16_t cct_offset){
+    glassAttenuation = glass_attenuation;
+    deviceFactor = device_factor;
+    redCoefficient = red_coef;
+    greenCoefficient = green_coef;
+    blueCoefficient = blue_coef;
+    cctCoefficient = cct_coef;
+    cctOffset = cct_offset;
+    cachedScale = 0;
+}
+
+void LightCalculator::setGlassAttenuation(uint16_t glass_attenuation){
+    glassAttenuation = glass_attenuation;
+    cachedScale = 0;
+}
+
+void LightCalculator::updateLuxFactor(uint32_t alsScale){
+    cachedScale = alsScale;
+
+    // millilux per count with alsScale = 1: GA / 256 * DF * 1000 / 2.78 = GA * DF * 3125 / 2224
+    uint32_t base = (uint32_t) glassAttenuation * deviceFactor;
+    uint32_t perCount = base / 2224 * 3125 + base % 2224 * 3125 / 2224;
+    if (perCount == 0){
+        luxMantissa = 0;
+        luxShift = 0;
+        return;
+    }
+
+    // perCount / alsScale as a 13 bit mantissa and a shift, so that a sample needs no division:
+    // the illuminance counts (Q2) are below 2^19 and their product with the mantissa fits in 32 bits
+    int8_t shift = 2;
+    while (!(perCount & 0x80000000UL)){
+        perCount <<= 1;
+        shift++;
+    }
+    uint32_t mantissa = perCount / alsScale;
+    while (mantissa >= 0x2000){
+        mantissa >>= 1;
+        shift--;
+    }
+    luxMantissa = mantissa;
+    luxShift = shift;
+}
+
+bool LightCalculator::compute(uint16_t red, uint16_t green, uint16_t blue, uint16_t clear, uint32_t alsScale, uint16_t saturation){
+    saturated = clear >= saturation;
+
+    int32_t ir = ((int32_t) red + green + blue - clear) / 2;
+    if (ir < 0) ir = 0;
+    infrared = ir > 0xFFFF ? 0xFFFF : ir;
+    int32_t r = (int32_t) red - ir;
+    int32_t g = (int32_t) green - ir;
+    int32_t b = (int32_t) blue - ir;
+    if (r < 0) r = 0;
+    if (g < 0) g = 0;
+    if (b < 0) b = 0;
+
+    // Illuminance
+    int32_t counts = (int32_t) redCoefficient * r + (int32_t) greenCoefficient * g + (int32_t) blueCoefficient * b;
+    if (counts > 0){
+        counts >>= 10;
+        if (counts > 0x7FFFF) counts = 0x7FFFF;
+        if (alsScale == 0) alsScale = 1;
+        if (alsScale != cachedScale)
+            updateLuxFactor(alsScale);
+        uint32_t product = (uint32_t) counts * luxMantissa;
+        if (luxShift >= 0)
+            milliLux = product >> luxShift;
+        else
+            milliLux = product > (0xFFFFFFFFUL >> -luxShift) ? 0xFFFFFFFFUL : product << -luxShift;
+    }
+    else
+        milliLux = 0;
+
+    // Correlated color temperature
+    if (r > 0){
+        uint32_t temperature = (uint32_t) cctCoefficient * (uint32_t) b / (uint32_t) r + cctOffset;
+        cct = temperature > 0xFFFF ? 0xFFFF : temperature;
+    }
+    else
+        cct = 0;
+
+    // Chromaticity
+    int32_t xyz[3];
+    for (uint8_t i = 0; i < 3; i++){
+        xyz[i] = (int32_t) XYZ_MATRIX[i][0] * r + (int32_t) XYZ_MATRIX[i][1] * g + (int32_t) XYZ_MATRIX[i][2] * b;
+        xyz[i] = xyz[i] > 0 ? xyz[i] >> 10 : 0;
+    }
+    int32_t sum = xyz[0] + xyz[1] + xyz[2];
+    if (sum > 0){
+        chromaticityX = xyz[0] * 10000 / sum;
+        chromaticityY = xyz[1] * 10000 / sum;
+    }
+    else {
+        chromaticityX = 0;
+        chromaticityY = 0;
+    }
+
+    return !saturated;
+}
+
+#if APDS9960_ENABLE_ALS
+bool LightCalculator::compute(const Melopero_APDS9960 &device){
+    return compute(device.red, device.green, device.blue, device.clear, device.alsScale, device.alsSaturation);
+}
+#endif
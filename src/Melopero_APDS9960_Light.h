@@ -0,0 +1,82 @@
+//Author: Leonardo La Rocca
+#ifndef Melopero_APDS9960_Light_H_INCLUDED
+#define Melopero_APDS9960_Light_H_INCLUDED
+
+#include <stdint.h>
+
+// Open air coefficients of the DN40 lux and CCT equations (TCS3472 family, same RGBC photodiode
+// architecture as the APDS9960). They should be calibrated for the enclosure of the final product.
+#define LIGHT_GLASS_ATTENUATION_OPEN_AIR 256 // Q8: 256 = 1.0
+#define LIGHT_DN40_DEVICE_FACTOR 310
+#define LIGHT_DN40_RED_COEFFICIENT 557 // Q12: 0.136
+#define LIGHT_DN40_GREEN_COEFFICIENT 4096 // Q12: 1.000
+#define LIGHT_DN40_BLUE_COEFFICIENT -1819 // Q12: -0.444
+#define LIGHT_DN40_CCT_COEFFICIENT 3810
+#define LIGHT_DN40_CCT_OFFSET 1391
+
+class Melopero_APDS9960;
+
+/*! Computes illuminance, correlated color temperature and chromaticity from the RGBC counts with
+ *  integer arithmetic only (no floats, no libm). The DN40 method is used:
+ *
+ *  1) the IR component IR = (R + G + B - C) / 2 is removed from every channel
+ *  2) G'' = Rc * R' + Gc * G' + Bc * B' is the illuminance in counts
+ *  3) lux = G'' * GA * DF / (integration time in ms * gain), GA being the glass attenuation
+ *  4) CCT = CTc * B' / R' + CToffset
+ *
+ *  The counts per lux only depend on the glass attenuation, the device factor and alsScale (gain *
+ *  integration cycles), so they are computed again only when one of them changes: a sample costs a few
+ *  multiplications and the two divisions of the ratios. */
+class LightCalculator {
+
+    public:
+        // Coefficients, change them with setCoefficients / setGlassAttenuation
+        uint16_t glassAttenuation; // Q8
+        uint16_t deviceFactor;
+        int16_t redCoefficient; // Q12
+        int16_t greenCoefficient; // Q12
+        int16_t blueCoefficient; // Q12
+        uint16_t cctCoefficient;
+        uint16_t cctOffset;
+
+        // Results of the last compute
+        uint32_t milliLux;
+        uint16_t cct; // kelvin, 0 if it could not be computed
+        uint16_t chromaticityX; // CIE 1931 x * 10000, 0 if it could not be computed
+        uint16_t chromaticityY; // CIE 1931 y * 10000, 0 if it could not be computed
+        uint16_t infrared; // IR component in counts
+        bool saturated; // the clear channel reached the saturation value, the results are a lower bound
+
+    public:
+        LightCalculator();
+
+        /*! Sets all the coefficients of the DN40 equations.
+         *  @param glass_attenuation the attenuation of the cover glass in Q8 (256 = open air)
+         *  @param device_factor the device factor DF
+         *  @param red_coef, green_coef, blue_coef the channel coefficients in Q12 (4096 = 1.0)
+         *  @param cct_coef, cct_offset the color temperature coefficient and offset in kelvin */
+        void setCoefficients(uint16_t glass_attenuation, uint16_t device_factor, int16_t red_coef, int16_t green_coef,
+            int16_t blue_coef, uint16_t cct_coef, uint16_t cct_offset);
+
+        /*! Sets only the attenuation of the cover glass, in Q8 (256 = open air, 512 = the glass halves the light). */
+        void setGlassAttenuation(uint16_t glass_attenuation);
+
+        /*! Computes the results from raw counts.
+         *  @param alsScale gain * integration cycles the counts were measured with
+         *  @param saturation the saturation value for that integration time
+         *  @return false if the clear channel is saturated (the results are still computed) */
+        bool compute(uint16_t red, uint16_t green, uint16_t blue, uint16_t clear, uint32_t alsScale, uint16_t saturation);
+
+        /*! Computes the results from the last updateColorData of the device, with its current gain and integration time.
+         *  Not available when the ALS engine is not compiled in (APDS9960_ENABLE_ALS 0). */
+        bool compute(const Melopero_APDS9960 &device);
+
+    private:
+        uint32_t cachedScale;
+        uint16_t luxMantissa;
+        int8_t luxShift;
+
+        void updateLuxFactor(uint32_t alsScale);
+};
+
+#endif // Melopero_APDS9960_Light_H_INCLUDED
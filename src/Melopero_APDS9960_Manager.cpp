@@ -0,0 +1,198 @@
+//Author: Leonardo La Rocca
+
+#include "Melopero_APDS9960_Manager.h"
+
+// The services whose engines are compiled in
+static const uint8_t compiledServices = (APDS9960_ENABLE_GESTURE ? SERVICE_GESTURE : 0) |
+    (APDS9960_ENABLE_ALS ? SERVICE_COLOR : 0) | (APDS9960_ENABLE_PROXIMITY ? SERVICE_PROXIMITY : 0);
+
+APDS9960Manager::APDS9960Manager(){
+    sensorsCount = 0;
+    muxesCount = 0;
+    lastServicedSensor = APDS9960_MANAGER_NO_SENSOR;
+    roundRobinStart = 0;
+    serviceCallback = NULL;
+}
+
+int8_t APDS9960Manager::addSensor(Melopero_APDS9960 &device, uint8_t services, uint16_t pollMillis, uint8_t muxAddress, uint8_t muxChannel){
+    if (sensorsCount == APDS9960_MANAGER_MAX_SENSORS || muxChannel > 7)
+        return INVALID_ARGUMENT;
+    if ((services & ~compiledServices) != 0)
+        return INVALID_ARGUMENT;
+#if APDS9960_ENABLE_GESTURE
+    if ((services & SERVICE_GESTURE) && device.gestureRingBuffer == NULL)
+        return INVALID_ARGUMENT;
+#endif
+
+    uint8_t mux = APDS9960_MANAGER_MAX_MUXES;
+    if (muxAddress != APDS9960_NO_MUX){
+        for (uint8_t i = 0; i < muxesCount; i++)
+            if (muxes[i].bus == device.i2c && muxes[i].address == muxAddress)
+                mux = i;
+
+        if (mux == APDS9960_MANAGER_MAX_MUXES){
+            if (muxesCount == APDS9960_MANAGER_MAX_MUXES)
+                return INVALID_ARGUMENT;
+            mux = muxesCount++;
+            muxes[mux].bus = device.i2c;
+            muxes[mux].address = muxAddress;
+            muxes[mux].selectionKnown = false;
+        }
+    }
+
+    Sensor &sensor = sensors[sensorsCount];
+    sensor.device = &device;
+    sensor.services = services;
+    sensor.mux = mux;
+    sensor.muxChannel = muxChannel;
+    sensor.pollMillis = pollMillis;
+    sensor.interruptPending = false;
+    sensor.lastServiceMicros = micros();
+    sensor.stats = ServiceStats();
+    return sensorsCount++;
+}
+
+int8_t APDS9960Manager::selectMuxChannels(uint8_t mux, Melopero_APDS9960 &device, uint8_t channels){
+    Mux &m = muxes[mux];
+    if (m.bus != device.i2c || (m.selectionKnown && m.selectedChannels == channels))
+        return NO_ERROR;
+
+    // Through the device, so that the mux write gets its bus retries and recovery
+    if (device.writeToAddress(m.address, &channels, 1) != NO_ERROR){
+        m.selectionKnown = false;
+        return I2C_ERROR;
+    }
+    m.selectedChannels = channels;
+    m.selectionKnown = true;
+    return NO_ERROR;
+}
+
+int8_t APDS9960Manager::select(uint8_t sensorIndex){
+    if (sensorIndex >= sensorsCount)
+        return INVALID_ARGUMENT;
+
+    const Sensor &sensor = sensors[sensorIndex];
+    // Every sensor answers at the same address: the other muxes on the bus must be closed first
+    for (uint8_t i = 0; i < muxesCount; i++){
+        if (i == sensor.mux) continue;
+        int8_t status = selectMuxChannels(i, *sensor.device, 0);
+        if (status != NO_ERROR) return status;
+    }
+    if (sensor.mux == APDS9960_MANAGER_MAX_MUXES)
+        return NO_ERROR;
+    return selectMuxChannels(sensor.mux, *sensor.device, 1 << sensor.muxChannel);
+}
+
+void APDS9960Manager::notifyInterrupt(uint8_t sensorIndex){
+    if (sensorIndex >= sensorsCount)
+        return;
+
+    Sensor &sensor = sensors[sensorIndex];
+    if (!sensor.interruptPending){
+        sensor.interruptMicros = micros();
+        sensor.interruptPending = true;
+    }
+}
+
+bool APDS9960Manager::dueSince(const Sensor &sensor, uint32_t now, uint32_t &since){
+    bool due = false;
+    if (sensor.interruptPending){
+        since = sensor.interruptMicros;
+        due = true;
+    }
+    if (sensor.pollMillis != 0){
+        uint32_t pollDeadline = sensor.lastServiceMicros + (uint32_t) sensor.pollMillis * 1000;
+        if ((int32_t) (now - pollDeadline) >= 0 && (!due || (int32_t) (pollDeadline - since) < 0)){
+            since = pollDeadline;
+            due = true;
+        }
+    }
+    return due;
+}
+
+int8_t APDS9960Manager::service(){
+    lastServicedSensor = APDS9960_MANAGER_NO_SENSOR;
+    if (sensorsCount == 0)
+        return NO_ERROR;
+
+    uint32_t now = micros();
+    uint8_t chosen = APDS9960_MANAGER_NO_SENSOR;
+    uint32_t chosenUrgency = 0;
+    uint32_t chosenSince = 0;
+    // Scanning from the sensor after the last serviced one breaks the ties round robin
+    for (uint8_t n = 0; n < sensorsCount; n++){
+        uint8_t i = (uint8_t) ((roundRobinStart + n) % sensorsCount);
+        uint32_t since = 0;
+        if (!dueSince(sensors[i], now, since))
+            continue;
+
+        uint32_t urgency = now - since;
+#if APDS9960_ENABLE_GESTURE
+        if (sensors[i].services & SERVICE_GESTURE)
+            urgency += (uint32_t) sensors[i].device->datasetsInFifo * APDS9960_MANAGER_DATASET_URGENCY_MICROS;
+#endif
+        if (chosen == APDS9960_MANAGER_NO_SENSOR || urgency > chosenUrgency){
+            chosen = i;
+            chosenUrgency = urgency;
+            chosenSince = since;
+        }
+    }
+    if (chosen == APDS9960_MANAGER_NO_SENSOR)
+        return NO_ERROR;
+
+    roundRobinStart = (uint8_t) ((chosen + 1) % sensorsCount);
+    Sensor &sensor = sensors[chosen];
+    Melopero_APDS9960 &device = *sensor.device;
+    // Cleared before the bus operations so that an interrupt arriving meanwhile is not lost
+    sensor.interruptPending = false;
+
+    int8_t status = select(chosen);
+#if APDS9960_ENABLE_GESTURE
+    if (status == NO_ERROR && (sensor.services & SERVICE_GESTURE))
+        status = device.serviceGestureFifo();
+#endif
+    if (status == NO_ERROR && (sensor.services & SERVICE_COLOR) && (sensor.services & SERVICE_PROXIMITY))
+        status = device.updateSnapshot(); // both in one burst
+#if APDS9960_ENABLE_ALS
+    else if (status == NO_ERROR && (sensor.services & SERVICE_COLOR))
+        status = device.updateColorData();
+#endif
+#if APDS9960_ENABLE_PROXIMITY
+    else if (status == NO_ERROR && (sensor.services & SERVICE_PROXIMITY))
+        status = device.updateProximityData();
+#endif
+
+    uint32_t done = micros();
+    sensor.lastServiceMicros = done;
+    lastServicedSensor = chosen;
+
+    uint32_t latency = now - chosenSince;
+    ServiceStats &stats = sensor.stats;
+    stats.services++;
+    stats.lastLatencyMicros = latency;
+    stats.totalLatencyMicros += latency;
+    if (latency > stats.maxLatencyMicros)
+        stats.maxLatencyMicros = latency;
+    if (status != NO_ERROR){
+        stats.errors++;
+        return status;
+    }
+
+    if (serviceCallback != NULL)
+        serviceCallback(chosen, device, sensor.services);
+    return NO_ERROR;
+}
+
+void APDS9960Manager::setServiceCallback(APDS9960ServiceCallback callback){
+    serviceCallback = callback;
+}
+
+void APDS9960Manager::resetServiceStats(){
+    for (uint8_t i = 0; i < sensorsCount; i++)
+        sensors[i].stats = ServiceStats();
+}
+
+void APDS9960Manager::invalidateMuxCache(){
+    for (uint8_t i = 0; i < muxesCount; i++)
+        muxes[i].selectionKnown = false;
+}
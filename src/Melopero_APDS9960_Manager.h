@@ -0,0 +1,118 @@
+//Author: Leonardo La Rocca
+#ifndef Melopero_APDS9960_Manager_H_INCLUDED
+#define Melopero_APDS9960_Manager_H_INCLUDED
+
+#include "Melopero_APDS9960.h"
+
+    //Maximum number of sensors handled by one manager
+#define APDS9960_MANAGER_MAX_SENSORS 16
+
+    //Maximum number of distinct (bus, mux) pairs
+#define APDS9960_MANAGER_MAX_MUXES 8
+
+    //Sensor not behind a mux
+#define APDS9960_NO_MUX 0
+
+    //Services performed on a sensor (can be or-ed)
+#define SERVICE_GESTURE 0x01 // drain the gesture FIFO into the ring buffer attached to the device
+#define SERVICE_COLOR 0x02 // updateColorData
+#define SERVICE_PROXIMITY 0x04 // updateProximityData (updateSnapshot together with SERVICE_COLOR)
+
+    //Urgency added for every dataset seen in the gesture FIFO (the FIFO overflows after 32 datasets)
+#define APDS9960_MANAGER_DATASET_URGENCY_MICROS 1000
+
+    //No sensor was serviced by the last service() call
+#define APDS9960_MANAGER_NO_SENSOR 0xFF
+
+/*! Called after a sensor has been serviced, the new data is in the device fields (and ring buffer). */
+typedef void (*APDS9960ServiceCallback)(uint8_t sensorIndex, Melopero_APDS9960 &device, uint8_t services);
+
+/*! Owns the scheduling of many sensors spread across buses and TCA9548A style I2C muxes.
+ *  Every sensor becomes due when its interrupt is notified (notifyInterrupt) or when its poll
+ *  period elapses. Each service() call selects the mux channel of the most urgent due sensor 
+ *  and performs all its services. The urgency is the time the sensor has been waiting plus 
+ *  APDS9960_MANAGER_DATASET_URGENCY_MICROS for every dataset last seen in its gesture FIFO; ties
+ *  are broken round robin. The mux channels are cached, so a channel is written only when it changes; 
+ *  the mux writes go through the sensor device (writeToAddress), with its bus retries and recovery. */
+class APDS9960Manager {
+
+    public:
+        /*! Service latency of a sensor: time between the moment it became due and its service. */
+        struct ServiceStats {
+            uint32_t services = 0;
+            uint32_t lastLatencyMicros = 0;
+            uint32_t maxLatencyMicros = 0;
+            uint32_t totalLatencyMicros = 0;
+            uint16_t errors = 0;
+        };
+
+    public:
+        uint8_t sensorsCount;
+        uint8_t lastServicedSensor;
+
+    public:
+        APDS9960Manager();
+
+        /*! @brief Adds a sensor. The device must already be initialized with initI2C (its bus and address are used).
+         *  Gesture sensors need a GestureRingBuffer attached to the device. The services of engines that are
+         *  not compiled in (see APDS9960_ENABLE_X) are refused.
+         *  @param[in] device the sensor
+         *  @param[in] services or of SERVICE_X
+         *  @param[in] pollMillis the sensor becomes due every pollMillis (0: only when notifyInterrupt is called)
+         *  @param[in] muxAddress the I2C address of the mux the sensor is behind, or APDS9960_NO_MUX
+         *  @param[in] muxChannel the mux channel (0 - 7)
+         *  @return the index of the sensor or INVALID_ARGUMENT */
+        int8_t addSensor(Melopero_APDS9960 &device, uint8_t services, uint16_t pollMillis,
+                uint8_t muxAddress = APDS9960_NO_MUX, uint8_t muxChannel = 0);
+
+        /*! @brief Makes the sensor reachable on its bus (selects its mux channel and deselects the other
+         *  muxes on the same bus). Use it before configuring a sensor behind a mux. */
+        int8_t select(uint8_t sensorIndex);
+
+        /*! @brief Marks a sensor as due, can be called from an interrupt service routine. */
+        void notifyInterrupt(uint8_t sensorIndex);
+
+        /*! @brief Services the most urgent due sensor, if any. lastServicedSensor tells which one.
+         *  @return the status of the bus operations. */
+        int8_t service();
+
+        void setServiceCallback(APDS9960ServiceCallback callback);
+
+        const ServiceStats& getServiceStats(uint8_t sensorIndex) const { return sensors[sensorIndex].stats; }
+
+        void resetServiceStats();
+
+        /*! @brief Forgets the cached mux selections (e.g. after a mux reset). */
+        void invalidateMuxCache();
+
+    private:
+        struct Sensor {
+            Melopero_APDS9960* device;
+            uint8_t services;
+            uint8_t mux; // index in muxes or APDS9960_MANAGER_MAX_MUXES
+            uint8_t muxChannel;
+            uint16_t pollMillis;
+            volatile bool interruptPending;
+            volatile uint32_t interruptMicros;
+            uint32_t lastServiceMicros;
+            ServiceStats stats;
+        };
+
+        struct Mux {
+            APDS9960_TRANSPORT* bus;
+            uint8_t address;
+            uint8_t selectedChannels;
+            bool selectionKnown;
+        };
+
+        Sensor sensors[APDS9960_MANAGER_MAX_SENSORS];
+        Mux muxes[APDS9960_MANAGER_MAX_MUXES];
+        uint8_t muxesCount;
+        uint8_t roundRobinStart;
+        APDS9960ServiceCallback serviceCallback;
+
+        int8_t selectMuxChannels(uint8_t mux, Melopero_APDS9960 &device, uint8_t channels);
+        bool dueSince(const Sensor &sensor, uint32_t now, uint32_t &since);
+};
+
+#endif // Melopero_APDS9960_Manager_H_INCLUDED
@@ -0,0 +1,161 @@
+//Author: Leonardo La Rocca
+
+#include "Melopero_APDS9960_Power.h"
+
+APDS9960PowerScheduler::APDS9960PowerScheduler(Melopero_APDS9960 &device)
+        : APDS9960PowerScheduler(device, defaultRelaxedProfile(), defaultActiveProfile()){
+}
+
+APDS9960PowerScheduler::APDS9960PowerScheduler(Melopero_APDS9960 &device, const Melopero_APDS9960::Config &relaxed,
+        const Melopero_APDS9960::Config &active){
+    this->device = &device;
+    this->relaxed = relaxed;
+    this->active = active;
+    proximityThreshold = relaxed.proximityHighThreshold != 0 ? relaxed.proximityHighThreshold : POWER_DEFAULT_PROXIMITY_THRESHOLD;
+    alsChangeQ8 = POWER_DEFAULT_ALS_CHANGE_Q8;
+    idleMillis = POWER_DEFAULT_IDLE_MILLIS;
+    profile = POWER_PROFILE_RELAXED;
+    lastActivityMillis = 0;
+    profileSwitches = 0;
+    lastClear = 0;
+    lastClearValid = false;
+    gestureSeen = false;
+}
+
+int8_t APDS9960PowerScheduler::begin(){
+    lastActivityMillis = millis();
+    int8_t status = switchTo(POWER_PROFILE_RELAXED);
+    profileSwitches = 0;
+    return status;
+}
+
+int8_t APDS9960PowerScheduler::switchTo(uint8_t profile){
+    int8_t status = device->applyConfig(profile == POWER_PROFILE_ACTIVE ? active : relaxed);
+    if (status != NO_ERROR) return status;
+    this->profile = profile;
+    profileSwitches++;
+    // The clear counts of the new profile can use another gain and integration time
+    lastClearValid = false;
+    gestureSeen = false;
+    return NO_ERROR;
+}
+
+int8_t APDS9960PowerScheduler::setProfile(uint8_t profile){
+    if (profile > POWER_PROFILE_ACTIVE)
+        return INVALID_ARGUMENT;
+    lastActivityMillis = millis();
+    return switchTo(profile);
+}
+
+int8_t APDS9960PowerScheduler::notifyActivity(){
+    lastActivityMillis = millis();
+    if (profile == POWER_PROFILE_ACTIVE)
+        return NO_ERROR;
+    return switchTo(POWER_PROFILE_ACTIVE);
+}
+
+bool APDS9960PowerScheduler::activitySeen(){
+    uint8_t deviceStatus = device->deviceStatus;
+    gestureSeen = deviceStatus & STATUS_GESTURE_INTERRUPT;
+    bool activity = (deviceStatus & (STATUS_PROX_INTERRUPT | STATUS_GESTURE_INTERRUPT)) != 0;
+
+#if APDS9960_ENABLE_PROXIMITY
+    if (proximityThreshold != 0 && device->proximityDataValid && device->proximityData >= proximityThreshold)
+        activity = true;
+#endif
+
+#if APDS9960_ENABLE_ALS
+    if (alsChangeQ8 != 0 && device->colorDataValid){
+        uint16_t clear = device->clear;
+        if (lastClearValid){
+            uint32_t change = clear > lastClear ? clear - lastClear : lastClear - clear;
+            uint32_t reference = lastClear > 0 ? lastClear : 1;
+            if (change * 256 > (uint32_t) alsChangeQ8 * reference)
+                activity = true;
+        }
+        lastClear = clear;
+        lastClearValid = true;
+    }
+#endif
+    return activity;
+}
+
+int8_t APDS9960PowerScheduler::update(){
+    int8_t status = device->updateSnapshot();
+    if (status != NO_ERROR) return status;
+
+    bool activity = activitySeen();
+    if (device->deviceStatus & STATUS_PROX_INTERRUPT){
+        status = device->addressAccess(PROXIMITY_INT_CLEAR_REG_ADDRESS);
+        if (status != NO_ERROR) return status;
+    }
+
+    uint32_t now = millis();
+    if (activity){
+        lastActivityMillis = now;
+        if (profile != POWER_PROFILE_ACTIVE)
+            return switchTo(POWER_PROFILE_ACTIVE);
+    }
+    else if (profile == POWER_PROFILE_ACTIVE && now - lastActivityMillis >= idleMillis)
+        return switchTo(POWER_PROFILE_RELAXED);
+    return NO_ERROR;
+}
+
+uint32_t APDS9960PowerScheduler::samplingRateMilliHz() const {
+    const Melopero_APDS9960::Config &config = profile == POWER_PROFILE_ACTIVE ? active : relaxed;
+    uint32_t period = gestureSeen ? gesturePeriodMicros(config) : 0;
+    if (period == 0)
+        period = cyclePeriodMicros(config);
+    if (period == 0)
+        return 0;
+    return (1000000000UL + period / 2) / period; // at most 3.15e9: no 64 bit division
+}
+
+Melopero_APDS9960::Config APDS9960PowerScheduler::defaultRelaxedProfile(){
+    Melopero_APDS9960::Config relaxed;
+    relaxed.powerOn = true;
+    relaxed.proximityEngine = true;
+    relaxed.proximityInterrupts = true;
+    relaxed.proximityHighThreshold = POWER_DEFAULT_PROXIMITY_THRESHOLD;
+    relaxed.proximityPersistence = 2; // with 0 the interrupt fires every cycle
+    relaxed.sleepAfterInterrupt = true;
+    relaxed.waitEngine = true;
+    relaxed.waitCycles = POWER_DEFAULT_RELAXED_WAIT_CYCLES;
+    relaxed.longWait = true;
+    return relaxed;
+}
+
+Melopero_APDS9960::Config APDS9960PowerScheduler::defaultActiveProfile(){
+    Melopero_APDS9960::Config active = defaultRelaxedProfile();
+    active.sleepAfterInterrupt = false;
+    active.waitEngine = false;
+#if APDS9960_ENABLE_GESTURE
+    active.gestureEngine = true;
+    active.gestureInterrupts = true;
+    active.gestureEnterThreshold = POWER_DEFAULT_PROXIMITY_THRESHOLD;
+    active.gestureExitThreshold = POWER_DEFAULT_PROXIMITY_THRESHOLD - 10;
+    active.gestureWaitTime = GESTURE_WAIT_0_MILLIS;
+#endif
+    return active;
+}
+
+uint32_t APDS9960PowerScheduler::cyclePeriodMicros(const Melopero_APDS9960::Config &config){
+    if (!config.powerOn)
+        return 0;
+    uint32_t period = 0;
+    // The gesture engine needs the proximity one, which measures while no gesture is in progress
+    if (config.proximityEngine || config.gestureEngine)
+        period += APDS9960Time::PULSE_OVERHEAD_MICROS + APDS9960Time::pulsesMicros(config.proximityPulseCount, config.proximityPulseLength);
+    if (config.alsEngine)
+        period += APDS9960Time::microsFromCycles(config.alsIntegrationCycles);
+    if (config.waitEngine)
+        period += APDS9960Time::microsFromCycles(config.waitCycles, config.longWait);
+    return period;
+}
+
+uint32_t APDS9960PowerScheduler::gesturePeriodMicros(const Melopero_APDS9960::Config &config){
+    if (!config.powerOn || !config.gestureEngine)
+        return 0;
+    return APDS9960Time::gestureDatasetMicros(config.gesturePulseCount, config.gesturePulseLength, config.gestureWaitTime,
+        config.gestureUpDownActive, config.gestureLeftRightActive);
+}
@@ -0,0 +1,109 @@
+//Author: Leonardo La Rocca
+#ifndef Melopero_APDS9960_Power_H_INCLUDED
+#define Melopero_APDS9960_Power_H_INCLUDED
+
+#include "Melopero_APDS9960.h"
+
+    //Sampling profiles of the scheduler
+#define POWER_PROFILE_RELAXED 0
+#define POWER_PROFILE_ACTIVE 1
+
+    //Default activity detection settings
+#define POWER_DEFAULT_PROXIMITY_THRESHOLD 50
+#define POWER_DEFAULT_ALS_CHANGE_Q8 64 // 25% of the clear channel between two updates
+#define POWER_DEFAULT_IDLE_MILLIS 3000
+
+    //Default relaxed profile: one proximity measurement about every second (long wait cycles of 33.4ms)
+#define POWER_DEFAULT_RELAXED_WAIT_CYCLES 30
+
+    //Fixed part of a proximity or gesture measurement (the LED pulses excluded), used by the
+    //sampling period estimates (see APDS9960Time::PULSE_OVERHEAD_MICROS)
+#define POWER_PULSE_OVERHEAD_MICROS APDS9960Time::PULSE_OVERHEAD_MICROS
+
+/*! Moves a sensor between a relaxed and an active sampling profile following the activity it sees,
+ *  so that a battery powered node samples slowly while nothing happens and quickly while a hand is
+ *  present. Both profiles are complete configurations (Melopero_APDS9960::Config), for example a
+ *  relaxed one with the wait engine, a long wait and sleepAfterInterrupt on a proximity interrupt,
+ *  and an active one with the gesture engine and GESTURE_WAIT_0_MILLIS. Switching applies the profile
+ *  with applyConfig: with the shadow registers enabled only the registers that differ are written.
+ *
+ *  Activity is a proximity value at or above proximityThreshold, a proximity or gesture interrupt
+ *  flag in the status, a change of the clear channel larger than alsChangeQ8 / 256 between two
+ *  updates, or a call to notifyActivity. The first activity switches to the active profile, which
+ *  is kept until no activity has been seen for idleMillis. */
+class APDS9960PowerScheduler {
+
+    public:
+        Melopero_APDS9960::Config relaxed;
+        Melopero_APDS9960::Config active;
+
+        uint8_t proximityThreshold; // 0: the proximity value is not used
+        uint16_t alsChangeQ8; // 0: the clear channel is not used
+        uint32_t idleMillis;
+
+        uint8_t profile; // POWER_PROFILE_X currently applied
+        uint32_t lastActivityMillis;
+        uint32_t profileSwitches;
+
+    public:
+        /*! Uses the default profiles, see defaultRelaxedProfile and defaultActiveProfile. */
+        APDS9960PowerScheduler(Melopero_APDS9960 &device);
+
+        /*! The profiles are copied, they can be changed later through relaxed and active (the change
+         *  is written at the next switch). proximityThreshold defaults to the proximity high threshold
+         *  of the relaxed profile, or to POWER_DEFAULT_PROXIMITY_THRESHOLD if it has none. */
+        APDS9960PowerScheduler(Melopero_APDS9960 &device, const Melopero_APDS9960::Config &relaxed,
+                const Melopero_APDS9960::Config &active);
+
+        /*! @brief Applies the relaxed profile. */
+        int8_t begin();
+
+        /*! @brief Reads the status and the data of the sensor (updateSnapshot, one burst), looks for
+         *  activity and switches profile if needed. Call it periodically, or when the interrupt pin of
+         *  the sensor goes low: the data read is left in the device fields. A proximity interrupt is
+         *  cleared (this also ends the sleep after interrupt); the gesture interrupt is left to the
+         *  gesture parser, which clears it by reading the FIFO. */
+        int8_t update();
+
+        /*! @brief Reports activity seen by the application (for example a parsed gesture): switches to
+         *  the active profile if needed and restarts the idle time. */
+        int8_t notifyActivity();
+
+        /*! @brief Applies a profile now. The automatic switching continues from it. */
+        int8_t setProfile(uint8_t profile);
+
+        /*! The estimated sampling rate of the current profile in mHz (1000 = one measurement per second):
+         *  the gesture dataset rate if the last update found the gesture engine busy, the proximity / ALS
+         *  cycle rate otherwise. 0 if the profile powers the device off. */
+        uint32_t samplingRateMilliHz() const;
+
+        /*! The default relaxed profile: the proximity engine with its interrupt (high threshold
+         *  POWER_DEFAULT_PROXIMITY_THRESHOLD, persistence 2) and sleepAfterInterrupt, and the wait engine with
+         *  POWER_DEFAULT_RELAXED_WAIT_CYCLES long wait cycles between the measurements. */
+        static Melopero_APDS9960::Config defaultRelaxedProfile();
+
+        /*! The default active profile: the relaxed one without the wait engine and the sleep after interrupt,
+         *  with the gesture engine and its interrupt and GESTURE_WAIT_0_MILLIS between the datasets (in a build
+         *  without the gesture engine only the proximity engine, measuring continuously). */
+        static Melopero_APDS9960::Config defaultActiveProfile();
+
+        /*! Estimated period of the proximity / ALS measurements of a configuration: the proximity pulses,
+         *  the ALS integration time and the wait time of the enabled engines. 0 if the device is off. */
+        static uint32_t cyclePeriodMicros(const Melopero_APDS9960::Config &config);
+
+        /*! Estimated period of the gesture datasets while the gesture engine runs: the gesture pulses and
+         *  the gesture wait time (APDS9960Time::gestureDatasetMicros, the estimate the driver uses for the
+         *  gesture decision latency). 0 if the gesture engine is disabled. */
+        static uint32_t gesturePeriodMicros(const Melopero_APDS9960::Config &config);
+
+    private:
+        Melopero_APDS9960* device;
+        uint16_t lastClear;
+        bool lastClearValid;
+        bool gestureSeen; // the last update found the gesture interrupt flag
+
+        bool activitySeen();
+        int8_t switchTo(uint8_t profile);
+};
+
+#endif // Melopero_APDS9960_Power_H_INCLUDED
@@ -0,0 +1,519 @@
+//Author: Leonardo La Rocca
+
+#include "Melopero_APDS9960_Simulator.h"
+
+#ifndef ARDUINO
+#include "Melopero_APDS9960_Host.h"
+#endif
+
+    //Register addresses used by the model (same values as in Melopero_APDS9960.h)
+#define SIM_ENABLE 0x80
+#define SIM_ATIME 0x81
+#define SIM_WTIME 0x83
+#define SIM_AILTL 0x84
+#define SIM_PILT 0x89
+#define SIM_PIHT 0x8B
+#define SIM_PERS 0x8C
+#define SIM_CONFIG1 0x8D
+#define SIM_PPULSE 0x8E
+#define SIM_CONFIG2 0x90
+#define SIM_ID 0x92
+#define SIM_STATUS 0x93
+#define SIM_CDATAL 0x94
+#define SIM_PDATA 0x9C
+#define SIM_POFFSET_UR 0x9D
+#define SIM_POFFSET_DL 0x9E
+#define SIM_CONFIG3 0x9F
+#define SIM_GCONF1 0xA2
+#define SIM_GOFFSET_U 0xA4
+#define SIM_GOFFSET_D 0xA5
+#define SIM_GPULSE 0xA6
+#define SIM_GOFFSET_L 0xA7
+#define SIM_GOFFSET_R 0xA9
+#define SIM_GCONF4 0xAB
+#define SIM_GFLVL 0xAE
+#define SIM_GSTATUS 0xAF
+#define SIM_IFORCE 0xE4
+#define SIM_PICLEAR 0xE5
+#define SIM_CICLEAR 0xE6
+#define SIM_AICLEAR 0xE7
+#define SIM_GFIFO_U 0xFC
+
+    //ENABLE bits
+#define SIM_PON 0x01
+#define SIM_AEN 0x02
+#define SIM_PEN 0x04
+#define SIM_AIEN 0x10
+#define SIM_PIEN 0x20
+#define SIM_GEN 0x40
+
+    //STATUS bits
+#define SIM_CPSAT 0x80
+#define SIM_PGSAT 0x40
+#define SIM_PINT 0x20
+#define SIM_AINT 0x10
+#define SIM_GINT 0x04
+#define SIM_PVALID 0x02
+#define SIM_AVALID 0x01
+
+    //GSTATUS bits
+#define SIM_GFOV 0x02
+#define SIM_GVALID 0x01
+
+// =========================================================================
+//     APDS9960SimDevice
+// =========================================================================
+
+APDS9960SimDevice::APDS9960SimDevice(){
+    powerOnReset();
+}
+
+void APDS9960SimDevice::powerOnReset(){
+    for (int i = 0; i < 256; i++)
+        registers[i] = 0;
+    registers[SIM_ATIME] = 0xFF;
+    registers[SIM_WTIME] = 0xFF;
+    registers[SIM_CONFIG1] = 0x40;
+    registers[SIM_PPULSE] = 0x40;
+    registers[SIM_CONFIG2] = 0x01;
+    registers[SIM_ID] = APDS9960_SIMULATOR_DEVICE_ID;
+    registers[SIM_GPULSE] = 0x40;
+    fifoHead = 0;
+    fifoCount = 0;
+    pointer = 0;
+    crosstalkModel = false;
+}
+
+static bool engineRunning(const uint8_t* registers, uint8_t engineBit){
+    return (registers[SIM_ENABLE] & (SIM_PON | engineBit)) == (SIM_PON | engineBit);
+}
+
+void APDS9960SimDevice::setColorData(uint16_t clear, uint16_t red, uint16_t green, uint16_t blue){
+    if (!engineRunning(registers, SIM_AEN))
+        return;
+
+    uint16_t values[4] = {clear, red, green, blue};
+    for (int i = 0; i < 4; i++){
+        registers[SIM_CDATAL + i * 2] = values[i] & 0xFF;
+        registers[SIM_CDATAL + i * 2 + 1] = values[i] >> 8;
+    }
+    registers[SIM_STATUS] |= SIM_AVALID;
+
+    uint32_t saturation = (uint32_t) (256 - registers[SIM_ATIME]) * 1025;
+    if (saturation > 65535) saturation = 65535;
+    // Kept until CICLEAR, AICLEAR or AEN = 0
+    if (clear >= saturation)
+        registers[SIM_STATUS] |= SIM_CPSAT;
+
+    if (registers[SIM_ENABLE] & SIM_AIEN){
+        uint16_t low = registers[SIM_AILTL] | (registers[SIM_AILTL + 1] << 8);
+        uint16_t high = registers[SIM_AILTL + 2] | (registers[SIM_AILTL + 3] << 8);
+        // Persistence 0 means an interrupt every cycle, the persistence counter is not modeled
+        if ((registers[SIM_PERS] & 0x0F) == 0 || clear < low || clear > high)
+            registers[SIM_STATUS] |= SIM_AINT;
+    }
+}
+
+void APDS9960SimDevice::setProximitySaturation(){
+    if (engineRunning(registers, SIM_PEN))
+        registers[SIM_STATUS] |= SIM_PGSAT;
+}
+
+void APDS9960SimDevice::setProximityData(uint8_t proximity){
+    if (!engineRunning(registers, SIM_PEN))
+        return;
+
+    registers[SIM_PDATA] = proximity;
+    registers[SIM_STATUS] |= SIM_PVALID;
+
+    if (registers[SIM_ENABLE] & SIM_PIEN){
+        if ((registers[SIM_PERS] >> 4) == 0 || proximity < registers[SIM_PILT] || proximity > registers[SIM_PIHT])
+            registers[SIM_STATUS] |= SIM_PINT;
+    }
+}
+
+uint8_t APDS9960SimDevice::fifoThreshold() const {
+    static const uint8_t thresholds[4] = {1, 4, 8, 16};
+    return thresholds[registers[SIM_GCONF1] >> 6];
+}
+
+bool APDS9960SimDevice::pushGestureDataset(uint8_t up, uint8_t down, uint8_t left, uint8_t right){
+    if (!engineRunning(registers, SIM_GEN))
+        return false;
+
+    // Entering the gesture state machine
+    registers[SIM_GCONF4] |= 0x01;
+
+    if (fifoCount == APDS9960_SIMULATOR_FIFO_SIZE){
+        registers[SIM_GSTATUS] |= SIM_GFOV;
+        return false;
+    }
+
+    uint8_t* slot = fifo[(fifoHead + fifoCount) % APDS9960_SIMULATOR_FIFO_SIZE];
+    slot[0] = up;
+    slot[1] = down;
+    slot[2] = left;
+    slot[3] = right;
+    fifoCount++;
+    if (fifoCount >= fifoThreshold())
+        registers[SIM_GSTATUS] |= SIM_GVALID;
+    updateGestureStatus();
+    return true;
+}
+
+void APDS9960SimDevice::setCrosstalk(uint8_t upRight, uint8_t downLeft, const uint8_t udlr[4]){
+    crosstalkModel = true;
+    proximityCrosstalk[0] = upRight;
+    proximityCrosstalk[1] = downLeft;
+    for (int i = 0; i < 4; i++)
+        gestureCrosstalk[i] = udlr[i];
+}
+
+// value minus a sign-magnitude offset, clamped to [0 - 255]
+static uint8_t applyOffset(uint8_t value, uint8_t offset){
+    int16_t magnitude = offset & 0x7F;
+    int16_t result = (int16_t) value - ((offset & 0x80) ? -magnitude : magnitude);
+    return result < 0 ? 0 : result > 255 ? 255 : result;
+}
+
+void APDS9960SimDevice::updateCrosstalkData(uint8_t address){
+    if (address == SIM_PDATA && engineRunning(registers, SIM_PEN)){
+        uint8_t mask = registers[SIM_CONFIG3] & 0x0F; // U D L R
+        uint8_t upRightDiodes = !(mask & 0x08) + !(mask & 0x01);
+        uint8_t downLeftDiodes = !(mask & 0x04) + !(mask & 0x02);
+        uint16_t value = applyOffset(proximityCrosstalk[0], registers[SIM_POFFSET_UR]) * upRightDiodes / 2 
+            + applyOffset(proximityCrosstalk[1], registers[SIM_POFFSET_DL]) * downLeftDiodes / 2;
+        if ((registers[SIM_CONFIG3] & 0x20) && upRightDiodes + downLeftDiodes == 2)
+            value *= 2; // PCMP: gain compensation with only one pair enabled
+        registers[SIM_PDATA] = value > 255 ? 255 : value;
+        registers[SIM_STATUS] |= SIM_PVALID;
+    }
+    else if (address == SIM_GFLVL && (registers[SIM_GCONF4] & 0x01) && fifoCount == 0){
+        static const uint8_t offsets[4] = {SIM_GOFFSET_U, SIM_GOFFSET_D, SIM_GOFFSET_L, SIM_GOFFSET_R};
+        uint8_t udlr[4];
+        for (int i = 0; i < 4; i++)
+            udlr[i] = applyOffset(gestureCrosstalk[i], registers[offsets[i]]);
+        for (int i = 0; i < 4; i++)
+            pushGestureDataset(udlr[0], udlr[1], udlr[2], udlr[3]);
+    }
+}
+
+void APDS9960SimDevice::updateGestureStatus(){
+    registers[SIM_GFLVL] = fifoCount;
+    if (fifoCount == 0)
+        // GVALID, GFOV and GINT are cleared when the FIFO is emptied
+        registers[SIM_GSTATUS] &= ~(SIM_GVALID | SIM_GFOV);
+
+    if ((registers[SIM_GSTATUS] & SIM_GVALID) && (registers[SIM_GCONF4] & 0x02))
+        registers[SIM_STATUS] |= SIM_GINT;
+    else 
+        registers[SIM_STATUS] &= ~SIM_GINT;
+}
+
+void APDS9960SimDevice::clearFifo(){
+    fifoHead = 0;
+    fifoCount = 0;
+    updateGestureStatus();
+}
+
+bool APDS9960SimDevice::interruptAsserted() const {
+    uint8_t status = registers[SIM_STATUS];
+    // CPSIEN and PSIEN (CONFIG2) let the saturation flags drive the pin
+    bool clearSaturation = (status & SIM_CPSAT) && (registers[SIM_CONFIG2] & 0x40);
+    bool proximitySaturation = (status & SIM_PGSAT) && (registers[SIM_CONFIG2] & 0x80);
+    return (status & (SIM_PINT | SIM_AINT | SIM_GINT)) != 0 || clearSaturation || proximitySaturation;
+}
+
+void APDS9960SimDevice::setRegisterPointer(uint8_t address){
+    pointer = address;
+}
+
+uint8_t APDS9960SimDevice::readNext(){
+    uint8_t value;
+    if (pointer >= SIM_GFIFO_U){
+        // FIFO page: the pointer wraps from RIGHT back to UP and every complete dataset read is removed
+        value = fifoCount > 0 ? fifo[fifoHead][pointer - SIM_GFIFO_U] : 0;
+        if (pointer == 0xFF){
+            if (fifoCount > 0){
+                fifoHead = (fifoHead + 1) % APDS9960_SIMULATOR_FIFO_SIZE;
+                fifoCount--;
+                updateGestureStatus();
+            }
+            pointer = SIM_GFIFO_U;
+        }
+        else 
+            pointer++;
+        return value;
+    }
+
+    if (crosstalkModel)
+        updateCrosstalkData(pointer);
+    value = registers[pointer];
+    pointer++;
+    return value;
+}
+
+void APDS9960SimDevice::writeRegister(uint8_t address, uint8_t value){
+    // Read only registers
+    if (address == SIM_ID || (SIM_STATUS <= address && address <= SIM_PDATA) 
+            || address == SIM_GFLVL || address == SIM_GSTATUS || address >= SIM_GFIFO_U)
+        return;
+
+    if (address == SIM_GCONF4){
+        if (value & 0x04)
+            clearFifo();
+        registers[address] = value & ~0x04; // GFIFO_CLR clears itself
+        updateGestureStatus();
+        return;
+    }
+
+    registers[address] = value;
+    if (address == SIM_ENABLE){
+        // Disabling an engine also clears its saturation flag
+        if (!(value & SIM_AEN))
+            registers[SIM_STATUS] &= ~SIM_CPSAT;
+        if (!(value & SIM_PEN))
+            registers[SIM_STATUS] &= ~SIM_PGSAT;
+    }
+    if (address == SIM_ENABLE || address == SIM_GCONF1)
+        updateGestureStatus();
+}
+
+void APDS9960SimDevice::writeNext(uint8_t value){
+    writeRegister(pointer, value);
+    pointer++;
+}
+
+void APDS9960SimDevice::addressAccess(uint8_t address){
+    if (address == SIM_IFORCE)
+        registers[SIM_STATUS] |= SIM_AINT | SIM_PINT;
+    else if (address == SIM_PICLEAR)
+        registers[SIM_STATUS] &= ~(SIM_PINT | SIM_PGSAT);
+    else if (address == SIM_CICLEAR)
+        registers[SIM_STATUS] &= ~(SIM_AINT | SIM_CPSAT);
+    else if (address == SIM_AICLEAR)
+        registers[SIM_STATUS] &= ~(SIM_AINT | SIM_PINT | SIM_CPSAT | SIM_PGSAT);
+}
+
+// =========================================================================
+//     APDS9960Simulator
+// =========================================================================
+
+APDS9960Simulator::APDS9960Simulator(uint8_t address){
+    deviceAddress = address;
+    busClock = 100000;
+    txLength = 0;
+    rxLength = 0;
+    rxIndex = 0;
+    transactionHook = NULL;
+    transactionHookContext = NULL;
+    muxesCount = 0;
+    for (int mux = 0; mux < APDS9960_SIMULATOR_MUXES; mux++){
+        muxAddresses[mux] = 0;
+        selectedChannels[mux] = 0;
+        for (int i = 0; i < APDS9960_SIMULATOR_MUX_CHANNELS; i++)
+            muxChannels[mux][i] = NULL;
+    }
+    nacksToInject = 0;
+    nacksSkip = 0;
+    sdaHeld = false;
+    resetCounters();
+}
+
+void APDS9960Simulator::resetCounters(){
+    transactions = 0;
+    bytesWritten = 0;
+    bytesRead = 0;
+    muxSelections = 0;
+    muxConflicts = 0;
+    injectedNacks = 0;
+    busRecoveries = 0;
+}
+
+void APDS9960Simulator::attachMux(uint8_t address){
+    if (muxesCount == APDS9960_SIMULATOR_MUXES || muxIndex(address) >= 0)
+        return;
+    muxAddresses[muxesCount] = address;
+    selectedChannels[muxesCount] = 0;
+    muxesCount++;
+}
+
+void APDS9960Simulator::connectToMuxChannel(uint8_t channel, APDS9960SimDevice* sensor){
+    if (muxesCount > 0)
+        connectToMuxChannel(muxAddresses[muxesCount - 1], channel, sensor);
+}
+
+void APDS9960Simulator::connectToMuxChannel(uint8_t muxAddress, uint8_t channel, APDS9960SimDevice* sensor){
+    int8_t mux = muxIndex(muxAddress);
+    if (mux >= 0 && channel < APDS9960_SIMULATOR_MUX_CHANNELS)
+        muxChannels[mux][channel] = sensor;
+}
+
+int8_t APDS9960Simulator::muxIndex(uint8_t address) const {
+    for (uint8_t mux = 0; mux < muxesCount; mux++)
+        if (muxAddresses[mux] == address)
+            return mux;
+    return -1;
+}
+
+void APDS9960Simulator::setTransactionHook(void (*hook)(void* context), void* context){
+    transactionHook = hook;
+    transactionHookContext = context;
+}
+
+void APDS9960Simulator::injectNacks(uint16_t count, uint32_t skip){
+    nacksToInject = count;
+    nacksSkip = skip;
+}
+
+void APDS9960Simulator::holdSda(bool held){
+    sdaHeld = held;
+}
+
+bool APDS9960Simulator::recoverBus(){
+    busRecoveries++;
+    sdaHeld = false;
+    return true;
+}
+
+bool APDS9960Simulator::faulted(){
+    if (!sdaHeld){
+        if (nacksToInject == 0)
+            return false;
+        if (nacksSkip > 0){
+            nacksSkip--;
+            return false;
+        }
+        nacksToInject--;
+    }
+    injectedNacks++;
+    return true;
+}
+
+APDS9960SimDevice* APDS9960Simulator::target(uint8_t address){
+    if (address != deviceAddress)
+        return NULL;
+    if (muxesCount == 0)
+        return &device;
+
+    // The channels of every mux are wired together downstream
+    APDS9960SimDevice* found = NULL;
+    for (int mux = 0; mux < muxesCount; mux++){
+        for (int i = 0; i < APDS9960_SIMULATOR_MUX_CHANNELS; i++){
+            if (!(selectedChannels[mux] & (1 << i)) || muxChannels[mux][i] == NULL)
+                continue;
+            if (found != NULL){
+                muxConflicts++;
+                return NULL;
+            }
+            found = muxChannels[mux][i];
+        }
+    }
+    return found;
+}
+
+void APDS9960Simulator::begin(){
+}
+
+void APDS9960Simulator::setClock(uint32_t clock){
+    busClock = clock;
+}
+
+void APDS9960Simulator::accountTransaction(uint8_t dataBytes){
+    transactions++;
+#ifndef ARDUINO
+    // START + address byte + data bytes (8 bits + ACK each) + STOP
+    uint32_t bits = 9 * (1 + (uint32_t) dataBytes) + 2;
+    apds9960HostAdvanceMicros((bits * 1000000UL + busClock - 1) / busClock);
+#endif
+}
+
+void APDS9960Simulator::beginTransmission(uint8_t address){
+    txAddress = address;
+    txLength = 0;
+}
+
+size_t APDS9960Simulator::write(uint8_t value){
+    if (txLength >= sizeof(txBuffer))
+        return 0;
+    txBuffer[txLength++] = value;
+    return 1;
+}
+
+size_t APDS9960Simulator::write(const uint8_t* values, size_t len){
+    size_t written = 0;
+    for (size_t i = 0; i < len; i++)
+        written += write(values[i]);
+    return written;
+}
+
+uint8_t APDS9960Simulator::endTransmission(bool sendStop){
+    (void) sendStop;
+    if (transactionHook != NULL)
+        transactionHook(transactionHookContext);
+    accountTransaction(txLength);
+    if (faulted())
+        return 2;
+    bytesWritten += txLength;
+    int8_t mux = muxIndex(txAddress);
+    if (mux >= 0){
+        // The mux control register is a single byte, one bit per channel
+        if (txLength > 0){
+            selectedChannels[mux] = txBuffer[txLength - 1];
+            muxSelections++;
+        }
+        return 0;
+    }
+
+    APDS9960SimDevice* sensor = target(txAddress);
+    if (sensor == NULL)
+        return 2; // NACK on address
+
+    if (txLength == 0)
+        return 0;
+
+    sensor->setRegisterPointer(txBuffer[0]);
+    if (txLength == 1)
+        sensor->addressAccess(txBuffer[0]);
+    for (uint8_t i = 1; i < txLength; i++)
+        sensor->writeNext(txBuffer[i]);
+    return 0;
+}
+
+uint8_t APDS9960Simulator::requestFrom(uint8_t address, uint8_t quantity){
+    rxLength = 0;
+    rxIndex = 0;
+    if (quantity > sizeof(rxBuffer))
+        quantity = sizeof(rxBuffer);
+    accountTransaction(quantity);
+    if (faulted())
+        return 0;
+    int8_t mux = muxIndex(address);
+    if (mux >= 0){
+        for (uint8_t i = 0; i < quantity; i++)
+            rxBuffer[i] = selectedChannels[mux];
+        rxLength = quantity;
+        bytesRead += quantity;
+        return quantity;
+    }
+
+    APDS9960SimDevice* sensor = target(address);
+    if (sensor == NULL)
+        return 0;
+
+    for (uint8_t i = 0; i < quantity; i++)
+        rxBuffer[i] = sensor->readNext();
+    rxLength = quantity;
+    bytesRead += quantity;
+    return quantity;
+}
+
+int APDS9960Simulator::available(){
+    return rxLength - rxIndex;
+}
+
+int APDS9960Simulator::read(){
+    if (rxIndex >= rxLength)
+        return -1;
+    return rxBuffer[rxIndex++];
+}
@@ -0,0 +1,175 @@
+//Author: Leonardo La Rocca
+#ifndef Melopero_APDS9960_Simulator_H_INCLUDED
+#define Melopero_APDS9960_Simulator_H_INCLUDED
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define APDS9960_SIMULATOR_FIFO_SIZE 32
+#define APDS9960_SIMULATOR_DEVICE_ID 0xAB
+#define APDS9960_SIMULATOR_MUX_CHANNELS 8
+#define APDS9960_SIMULATOR_MUXES 4
+
+/*! Register level model of an APDS9960. It models the ENABLE and STATUS registers, the ALS and
+ *  proximity data registers with their interrupts and the gesture FIFO (level, overflow, 
+ *  threshold interrupt, clear). The measurements are not simulated: the test code provides 
+ *  them with setColorData, setProximityData and pushGestureDataset. */
+class APDS9960SimDevice {
+
+    public:
+        uint8_t registers[256];
+
+    public:
+        APDS9960SimDevice();
+
+        /*! Restores the power on value of every register and empties the FIFO. */
+        void powerOnReset();
+
+        /*! Stores a new ALS/color measurement: sets AVALID and AINT (if AIEN is set and the clear
+         *  channel is outside the ALS thresholds) and CPSAT if the clear channel reached the saturation,
+         *  kept until CICLEAR, AICLEAR or AEN = 0. Ignored while PON or AEN are cleared. */
+        void setColorData(uint16_t clear, uint16_t red, uint16_t green, uint16_t blue);
+
+        /*! Stores a new proximity measurement: sets PVALID and PINT (if PIEN is set and the value is
+         *  outside the proximity thresholds). Ignored while PON or PEN are cleared. */
+        void setProximityData(uint8_t proximity);
+
+        /*! Models an analog saturation during a proximity or gesture cycle: sets PGSAT, kept until PICLEAR,
+         *  AICLEAR or PEN = 0. Ignored while PON or PEN are cleared. */
+        void setProximitySaturation();
+
+        /*! Appends a dataset to the gesture FIFO, sets GVALID/GINT when the FIFO threshold is reached and 
+         *  GFOV when the FIFO is full (the dataset is lost). Ignored while PON or GEN are cleared.
+         *  @return false if the dataset was not stored. */
+        bool pushGestureDataset(uint8_t up, uint8_t down, uint8_t left, uint8_t right);
+
+        /*! Models the light reflected by the enclosure with no target present. From now on PDATA is computed 
+         *  when it is read, from the crosstalk of the photodiode pairs that are not masked (PMASK, PCMP) minus 
+         *  the proximity offsets, and while GMODE is set an empty FIFO gets 4 datasets (crosstalk minus the 
+         *  gesture offsets) whenever its level is read. The offsets are sign-magnitude, positive values subtract.
+         *  @param udlr the gesture crosstalk of the UP, DOWN, LEFT and RIGHT photodiodes */
+        void setCrosstalk(uint8_t upRight, uint8_t downLeft, const uint8_t udlr[4]);
+
+        uint8_t fifoLevel() const { return fifoCount; }
+
+        /*! The level of the (active low) INT pin: true when an enabled interrupt is pending (the saturation
+         *  flags included when CPSIEN / PSIEN are set). */
+        bool interruptAsserted() const;
+
+        // Bus side, used by the transport
+        void setRegisterPointer(uint8_t address);
+        uint8_t readNext();
+        void writeNext(uint8_t value);
+        void addressAccess(uint8_t address);
+
+    private:
+        uint8_t fifo[APDS9960_SIMULATOR_FIFO_SIZE][4];
+        uint8_t fifoHead;
+        uint8_t fifoCount;
+        uint8_t pointer;
+        bool crosstalkModel;
+        uint8_t proximityCrosstalk[2];
+        uint8_t gestureCrosstalk[4];
+
+        uint8_t fifoThreshold() const;
+        void updateGestureStatus();
+        void clearFifo();
+        void updateCrosstalkData(uint8_t address);
+        void writeRegister(uint8_t address, uint8_t value);
+};
+
+/*! Transport that connects the driver to an APDS9960SimDevice instead of a real I2C bus. It provides
+ *  the subset of the TwoWire interface used by the driver, so it is selected at compile time 
+ *  (see APDS9960_TRANSPORT) without any virtual call. Every transaction is counted and, on a host, 
+ *  advances the virtual clock by the time it would take on a bus running at busClock Hz.
+ *  Up to APDS9960_SIMULATOR_MUXES TCA9548A style muxes can be attached to the bus: the devices connected
+ *  to their channels answer at deviceAddress only while their channel is the only selected one on the
+ *  whole bus (with more than one channel selected, on one mux or on several, the sensors would collide,
+ *  the transaction is NACKed and counted in muxConflicts). */
+class APDS9960Simulator {
+
+    public:
+        APDS9960SimDevice device;
+        uint8_t deviceAddress;
+        uint32_t busClock;
+
+        // Transaction counters
+        uint32_t transactions;
+        uint32_t bytesWritten;
+        uint32_t bytesRead;
+
+        // Simulated muxes (muxesCount 0 means no mux)
+        uint8_t muxesCount;
+        uint8_t muxAddresses[APDS9960_SIMULATOR_MUXES];
+        uint8_t selectedChannels[APDS9960_SIMULATOR_MUXES];
+        APDS9960SimDevice* muxChannels[APDS9960_SIMULATOR_MUXES][APDS9960_SIMULATOR_MUX_CHANNELS];
+        uint32_t muxSelections; // writes to the control register of a mux
+        uint32_t muxConflicts;
+
+        // Fault injection
+        uint32_t injectedNacks; // transactions failed on purpose
+        uint32_t busRecoveries; // recoverBus calls
+
+    public:
+        APDS9960Simulator(uint8_t address = 0x39);
+
+        void resetCounters();
+
+        /*! Attaches a mux at the given address (up to APDS9960_SIMULATOR_MUXES), after the first call the
+         *  device member is no longer on the bus. */
+        void attachMux(uint8_t address);
+
+        /*! Connects a simulated sensor to a channel (0 - 7) of the mux attached last. */
+        void connectToMuxChannel(uint8_t channel, APDS9960SimDevice* sensor);
+
+        /*! Connects a simulated sensor to a channel (0 - 7) of the mux at muxAddress. */
+        void connectToMuxChannel(uint8_t muxAddress, uint8_t channel, APDS9960SimDevice* sensor);
+
+        /*! Sets a function called at the start of every endTransmission, before the device sees the
+         *  transaction (NULL to remove it). It lets a stimulus, e.g. an APDS9960TraceReplay, update the
+         *  measurements of the device as the virtual clock advances. */
+        void setTransactionHook(void (*hook)(void* context), void* context);
+
+        /*! Makes count transactions fail after skipping the next skip ones: endTransmission returns 2 (address
+         *  not acknowledged) and requestFrom returns no data, the device does not see them. */
+        void injectNacks(uint16_t count, uint32_t skip = 0);
+
+        /*! Models a slave holding SDA low: every transaction fails until recoverBus is called. */
+        void holdSda(bool held = true);
+
+        /*! Bus recovery (SCL toggling on a real bus): releases SDA.
+         *  @return true, SDA is always released */
+        bool recoverBus();
+
+        // TwoWire interface
+        void begin();
+        void setClock(uint32_t clock);
+        void beginTransmission(uint8_t address);
+        size_t write(uint8_t value);
+        size_t write(const uint8_t* values, size_t len);
+        uint8_t endTransmission(bool sendStop = true);
+        uint8_t requestFrom(uint8_t address, uint8_t quantity);
+        int available();
+        int read();
+
+    private:
+        uint8_t txAddress;
+        uint8_t txBuffer[33];
+        uint8_t txLength;
+        uint8_t rxBuffer[32];
+        uint8_t rxLength;
+        uint8_t rxIndex;
+        void (*transactionHook)(void* context);
+        void* transactionHookContext;
+
+        uint16_t nacksToInject;
+        uint32_t nacksSkip;
+        bool sdaHeld;
+
+        void accountTransaction(uint8_t dataBytes);
+        bool faulted();
+        int8_t muxIndex(uint8_t address) const;
+        APDS9960SimDevice* target(uint8_t address);
+};
+
+#endif // Melopero_APDS9960_Simulator_H_INCLUDED
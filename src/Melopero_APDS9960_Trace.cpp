@@ -0,0 +1,236 @@
+//Author: Leonardo La Rocca
+
+#include "Melopero_APDS9960_Trace.h"
+#include <string.h>
+
+#ifdef ARDUINO
+#include "Arduino.h"
+#else
+#include "Melopero_APDS9960_Host.h"
+#endif
+
+    //Traced registers (same values as in Melopero_APDS9960.h)
+#define TRACE_STATUS 0x93
+#define TRACE_CDATAL 0x94
+#define TRACE_BDATAH 0x9B
+#define TRACE_PDATA 0x9C
+#define TRACE_GCONF4 0xAB
+#define TRACE_GFLVL 0xAE
+#define TRACE_GSTATUS 0xAF
+#define TRACE_GFIFO_U 0xFC
+
+static const uint8_t TRACE_MAGIC[3] = { 'A', '9', 'T' };
+
+// True if the len registers starting at first include address
+static inline bool covers(uint8_t first, uint8_t len, uint8_t address){
+    return first <= address && (uint16_t) first + len > address;
+}
+
+// =========================================================================
+//     Recorder
+// =========================================================================
+
+APDS9960TraceRecorder::APDS9960TraceRecorder(uint8_t* buffer, uint16_t size){
+    this->buffer = buffer;
+    this->size = size;
+    restart();
+}
+
+void APDS9960TraceRecorder::restart(){
+    length = 0;
+    records = 0;
+    droppedRecords = 0;
+    lastMicros = 0;
+    started = false;
+    if (size < TRACE_HEADER_SIZE)
+        return;
+    buffer[0] = TRACE_MAGIC[0];
+    buffer[1] = TRACE_MAGIC[1];
+    buffer[2] = TRACE_MAGIC[2];
+    buffer[3] = TRACE_FORMAT_VERSION;
+    length = TRACE_HEADER_SIZE;
+}
+
+void APDS9960TraceRecorder::clear(){
+    length = 0;
+}
+
+bool APDS9960TraceRecorder::traced(uint8_t registerAddress, uint8_t len){
+    if (registerAddress >= TRACE_GFIFO_U)
+        return true;
+    if (registerAddress <= TRACE_PDATA)
+        return (uint16_t) registerAddress + len > TRACE_STATUS;
+    return covers(registerAddress, len, TRACE_GCONF4) || covers(registerAddress, len, TRACE_GFLVL) ||
+        covers(registerAddress, len, TRACE_GSTATUS);
+}
+
+bool APDS9960TraceRecorder::record(uint8_t registerAddress, const uint8_t* values, uint8_t len, uint32_t startMicros){
+    if (len == 0 || !traced(registerAddress, len))
+        return true;
+
+    uint32_t delta = started ? startMicros - lastMicros : 0;
+    uint8_t header[7];
+    uint8_t headerLength = 2;
+    header[0] = registerAddress;
+    header[1] = len;
+    do {
+        uint8_t byte = delta & 0x7F;
+        delta >>= 7;
+        header[headerLength++] = delta != 0 ? byte | 0x80 : byte;
+    }
+    while (delta != 0);
+
+    if ((uint32_t) length + headerLength + len > size){
+        droppedRecords++;
+        return false;
+    }
+    memcpy(buffer + length, header, headerLength);
+    memcpy(buffer + length + headerLength, values, len);
+    length += headerLength + len;
+    lastMicros = startMicros;
+    started = true;
+    records++;
+    return true;
+}
+
+// =========================================================================
+//     Reader
+// =========================================================================
+
+APDS9960TraceReader::APDS9960TraceReader(const uint8_t* trace, uint32_t size){
+    this->trace = trace;
+    this->size = size;
+    rewind();
+}
+
+void APDS9960TraceReader::rewind(){
+    elapsedMicros = 0;
+    position = TRACE_HEADER_SIZE;
+    valid = size >= TRACE_HEADER_SIZE && trace[0] == TRACE_MAGIC[0] && trace[1] == TRACE_MAGIC[1] &&
+        trace[2] == TRACE_MAGIC[2] && trace[3] == TRACE_FORMAT_VERSION;
+}
+
+bool APDS9960TraceReader::next(APDS9960TraceRecord &record){
+    if (!valid || position >= size)
+        return false;
+
+    uint32_t cursor = position;
+    if (size - cursor < 3){
+        valid = false;
+        return false;
+    }
+    record.address = trace[cursor++];
+    record.length = trace[cursor++];
+
+    uint32_t delta = 0;
+    for (uint8_t shift = 0; ; shift += 7){
+        if (cursor >= size || shift > 28){
+            valid = false;
+            return false;
+        }
+        uint8_t byte = trace[cursor++];
+        delta |= (uint32_t) (byte & 0x7F) << shift;
+        if (!(byte & 0x80))
+            break;
+    }
+
+    if (record.length == 0 || size - cursor < record.length){
+        valid = false;
+        return false;
+    }
+    record.values = trace + cursor;
+    elapsedMicros += delta;
+    record.micros = elapsedMicros;
+    position = cursor + record.length;
+    return true;
+}
+
+// =========================================================================
+//     Replay
+// =========================================================================
+
+APDS9960TraceReplay::APDS9960TraceReplay(const uint8_t* trace, uint32_t size) : reader(trace, size){
+    device = NULL;
+    appliedRecords = 0;
+    pushedDatasets = 0;
+    lostDatasets = 0;
+    hasPending = false;
+    startMicros = 0;
+    announcedDatasets = 0;
+}
+
+void APDS9960TraceReplay::start(APDS9960Simulator &bus){
+    device = &bus.device;
+    reader.rewind();
+    appliedRecords = 0;
+    pushedDatasets = 0;
+    lostDatasets = 0;
+    announcedDatasets = 0;
+    startMicros = micros();
+    fetch();
+    bus.setTransactionHook(transactionHook, this);
+}
+
+void APDS9960TraceReplay::transactionHook(void* context){
+    APDS9960TraceReplay* replay = (APDS9960TraceReplay*) context;
+    replay->advance(micros());
+}
+
+void APDS9960TraceReplay::fetch(){
+    hasPending = reader.next(pending);
+}
+
+void APDS9960TraceReplay::advance(uint32_t nowMicros){
+    uint32_t elapsed = nowMicros - startMicros;
+    while (hasPending){
+        bool announced = pending.address >= TRACE_GFIFO_U && announcedDatasets > 0;
+        if (!announced && (int32_t) (elapsed - pending.micros) < 0)
+            break;
+        apply(pending);
+        fetch();
+    }
+}
+
+void APDS9960TraceReplay::apply(const APDS9960TraceRecord &record){
+    appliedRecords++;
+    if (device == NULL)
+        return;
+
+    const uint8_t* values = record.values;
+    if (record.address >= TRACE_GFIFO_U){
+        for (uint8_t i = 0; i + 4 <= record.length; i += 4){
+            if (device->pushGestureDataset(values[i], values[i + 1], values[i + 2], values[i + 3]))
+                pushedDatasets++;
+            else
+                lostDatasets++;
+            if (announcedDatasets > 0)
+                announcedDatasets--;
+        }
+        return;
+    }
+
+    announcedDatasets = 0;
+    uint8_t first = record.address;
+    if (covers(first, record.length, TRACE_CDATAL) && covers(first, record.length, TRACE_BDATAH)){
+        const uint8_t* rgbc = values + (TRACE_CDATAL - first);
+        device->setColorData(rgbc[0] | (uint16_t) rgbc[1] << 8, rgbc[2] | (uint16_t) rgbc[3] << 8,
+            rgbc[4] | (uint16_t) rgbc[5] << 8, rgbc[6] | (uint16_t) rgbc[7] << 8);
+    }
+    if (covers(first, record.length, TRACE_PDATA))
+        device->setProximityData(values[TRACE_PDATA - first]);
+    if (covers(first, record.length, TRACE_GCONF4)){
+        uint8_t gmode = values[TRACE_GCONF4 - first] & 0x01;
+        device->registers[TRACE_GCONF4] = (device->registers[TRACE_GCONF4] & ~0x01) | gmode;
+    }
+    if (covers(first, record.length, TRACE_GFLVL))
+        announcedDatasets = values[TRACE_GFLVL - first];
+}
+
+uint32_t APDS9960TraceReplay::durationMicros(){
+    APDS9960TraceReader scan(reader.trace, reader.size);
+    APDS9960TraceRecord record;
+    uint32_t last = 0;
+    while (scan.next(record))
+        last = record.micros;
+    return last;
+}
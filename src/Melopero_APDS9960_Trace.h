@@ -0,0 +1,132 @@
+//Author: Leonardo La Rocca
+#ifndef Melopero_APDS9960_Trace_H_INCLUDED
+#define Melopero_APDS9960_Trace_H_INCLUDED
+
+#include <stdint.h>
+#include <stddef.h>
+#include "Melopero_APDS9960_Simulator.h"
+
+// Trace format: a 4 bytes header ('A', '9', 'T', version) followed by one record per register read:
+//   register address (1 byte), length (1 byte, 1 - 255), time since the previous record in
+//   microseconds (unsigned LEB128, 1 - 5 bytes), the bytes read (length bytes).
+// The time of a record is the start of the read. All values are little endian.
+#define TRACE_FORMAT_VERSION 1
+#define TRACE_HEADER_SIZE 4
+#define TRACE_RECORD_MAX_SIZE (2 + 5 + 255)
+
+/*! A register read as stored in a trace. */
+struct APDS9960TraceRecord {
+    uint32_t micros; // start of the read, relative to the first record of the trace
+    uint8_t address;
+    uint8_t length;
+    const uint8_t* values; // points into the trace
+};
+
+/*! Records the measurement reads of a driver (see Melopero_APDS9960::attachTraceRecorder) in a
+ *  caller provided buffer: the STATUS, RGBC and proximity data, the GCONF4 (GMODE), GFLVL and GSTATUS
+ *  registers and the gesture FIFO. Configuration reads are not recorded. A record usually takes 3 bytes
+ *  plus the data (4 bytes per gesture dataset), so a 512 bytes buffer holds a whole swipe.
+ *  When the buffer is full the records are counted in droppedRecords: send the content (e.g. with
+ *  Serial.write(recorder.buffer, recorder.length)) and call clear() before it fills up. */
+class APDS9960TraceRecorder {
+
+    public:
+        uint8_t* buffer;
+        uint16_t size;
+        uint16_t length; // bytes used in buffer
+
+        uint32_t records;
+        uint32_t droppedRecords;
+
+    public:
+        APDS9960TraceRecorder(uint8_t* buffer, uint16_t size);
+
+        /*! Starts a new trace: the buffer gets the header, the counters are set to zero. */
+        void restart();
+
+        /*! Empties the buffer after its content has been sent. The next records continue the
+         *  same trace (no header, times relative to the last stored record). */
+        void clear();
+
+        /*! True if a read of len bytes starting at registerAddress is recorded. */
+        static bool traced(uint8_t registerAddress, uint8_t len);
+
+        /*! Stores a read if it is traced. Called by the driver after every successful read.
+         *  @param startMicros micros() at the start of the read
+         *  @return false if the record was dropped */
+        bool record(uint8_t registerAddress, const uint8_t* values, uint8_t len, uint32_t startMicros);
+
+    private:
+        uint32_t lastMicros;
+        bool started;
+};
+
+/*! Reads the records of a trace one at a time. */
+class APDS9960TraceReader {
+
+    public:
+        const uint8_t* trace;
+        uint32_t size;
+        uint32_t position;
+        bool valid; // the header is correct and no truncated record was found
+
+    public:
+        APDS9960TraceReader(const uint8_t* trace, uint32_t size);
+
+        /*! Goes back to the first record. */
+        void rewind();
+
+        /*! Reads the next record.
+         *  @return false at the end of the trace or on a truncated record (valid is cleared) */
+        bool next(APDS9960TraceRecord &record);
+
+    private:
+        uint32_t elapsedMicros;
+};
+
+/*! Plays a trace into a simulated sensor, so that the unchanged driver code (parseGesture,
+ *  parseGestureInFifo, updateColorData, ...) reads the recorded measurements on a host. The
+ *  records are applied when the virtual clock reaches their time, relative to the start():
+ *  RGBC and proximity reads set the data registers, gesture FIFO reads push their datasets and
+ *  GCONF4 reads set GMODE. The datasets announced by a FIFO level read are pushed together with
+ *  it, so that the replayed driver finds them when it reads the level. STATUS and GSTATUS are not
+ *  applied: the simulator derives them. The driver has to be configured (engines enabled and powered
+ *  on) like the recorded one, otherwise the sensor model ignores the measurements. */
+class APDS9960TraceReplay {
+
+    public:
+        APDS9960TraceReader reader;
+        APDS9960SimDevice* device;
+        uint32_t appliedRecords;
+        uint32_t pushedDatasets;
+        uint32_t lostDatasets; // not stored by the simulated FIFO (full, or gestures disabled)
+
+    public:
+        APDS9960TraceReplay(const uint8_t* trace, uint32_t size);
+
+        /*! Starts the replay on the device of the bus at the current time and advances it at every
+         *  transaction of the bus (see APDS9960Simulator::setTransactionHook). */
+        void start(APDS9960Simulator &bus);
+
+        /*! Applies the records that are due at nowMicros. Called by the bus, it can also be called directly. */
+        void advance(uint32_t nowMicros);
+
+        /*! True when every record has been applied. */
+        bool finished() const { return !hasPending; }
+
+        /*! The time of the last record relative to the start of the trace. */
+        uint32_t durationMicros();
+
+    private:
+        APDS9960TraceRecord pending;
+        bool hasPending;
+        uint32_t startMicros;
+        uint8_t announcedDatasets;
+
+        void apply(const APDS9960TraceRecord &record);
+        void fetch();
+
+        static void transactionHook(void* context);
+};
+
+#endif // Melopero_APDS9960_Trace_H_INCLUDED